@@ -1,9 +1,27 @@
 #pragma once
 
-#define MAXDATASIZE 100 // Maximum number of bytes we can receive in one recv() call and in send()
-#define MAX_CLIENTS 100  // Maximum number of clients we'll handle
+#define MAXDATASIZE 100 // Longest command: one datagram, one line of a stream client
+#define STREAM_READ_SIZE (16 * 1024)  // Bytes one recv() of a stream client may return, many pipelined commands
+#define CONN_SLAB_SIZE 1024  // Connections carved out of one slab allocation, see connection_funcs.h
+#define LOOP_INITIAL_CAPACITY 64  // Initial poll array size, it doubles when full
+#define DGRAM_BATCH_MAX 128  // Upper bound for -m/--dgram-batch (datagrams per recvmmsg/sendmmsg)
+#define DGRAM_BATCH_DEFAULT 32
+#define IO_BUDGET 16  // accept4/recv/recvmmsg calls one handler may make per wakeup before yielding
+#define CONN_OUTBUF_MAX (64 * 1024)  // Unsent reply bytes a client may pile up before we drop it
 
 // Handlers for the message process
 #define TCP_HANDLE 0
 #define UDP_HANDLE 1
-#define KEYBOARD_HANDLE 2
\ No newline at end of file
+#define KEYBOARD_HANDLE 2
+
+// Kinds of the handlers registered in the drinks_bar event loop
+#define HANDLER_ADMIN        0   // keyboard or admin socket client, see admin_funcs.h
+#define HANDLER_TCP_LISTEN   1
+#define HANDLER_UNIX_LISTEN  2
+#define HANDLER_UDP          3
+#define HANDLER_UNIX_UDP     4
+#define HANDLER_CLIENT       5
+#define HANDLER_TIMER        6
+#define HANDLER_ADMIN_LISTEN 7
+#define HANDLER_RESP_LISTEN  8   // -R/--resp-port, see resp_funcs.h
+#define HANDLER_WAREHOUSE_TIMER 9   // timerfd of warehouse_wheel (HOLD TTLs, backorder deadlines), reactor 0 only
@@ -15,6 +15,24 @@ typedef enum {
 	UNKNOWN
 } Element, *PElement;
 
+/*
+ * Perfect hash of the element names: first byte + last byte + length,
+ * 5 bits (the command names use COMMAND_HASH, parse_funcs.h). No two
+ * names of one table share a value, the lookups switch on it, so the
+ * compiler rejects a new name that collides (duplicate case value).
+ */
+#define NAME_HASH(first, last, len) (((unsigned)(unsigned char)(first) + (unsigned)(unsigned char)(last) + (unsigned)(len)) & 31)
+
+/**
+ * @brief Element of a name that is not NUL terminated: one hash, one
+ * compare
+ *
+ * @param name the name, "SOFT DRINK" has its single space
+ * @param len bytes in name
+ * @return Element enum, UNKNOWN if it is no element
+ */
+Element element_from_name(const char *name, size_t len);
+
 /**
  * @brief Translates strings to enums for better use
  * 
@@ -0,0 +1,48 @@
+#pragma once
+#include <stdio.h>
+#include <sys/types.h>
+#include "../const.h"
+#include "event_loop_funcs.h"
+
+#define ADMIN_LINE_MAX 256      // longest admin command, longer lines are rejected
+
+// Admin UNIX stream socket, -a/--admin-path (-1 when not used)
+extern int admin_sockfd;
+
+/**
+ * @brief An admin channel: the keyboard (fd 0, answered on stdout) or a
+ * client of the admin socket. Input is line-buffered, a partial line
+ * waits in in[] until its newline arrives, nothing ever blocks on it.
+ */
+typedef struct AdminClient {
+    Handler h;                  // must stay first, the loop hands us &h
+    size_t in_len;
+    char in[ADMIN_LINE_MAX];
+} AdminClient;
+
+/**
+ * @brief Creates the admin UNIX stream socket (mode 0600) and starts
+ * listening. Exits the process on failure.
+ *
+ * @param path filesystem path of the socket
+ * @return the listening socket
+ */
+int open_admin_socket(const char *path);
+
+/**
+ * @brief Runs one admin command:
+ * STATS, CONNECTIONS, GEN ALL, GEN <drink>, FLUSH, SNAPSHOT [path], HELP
+ *
+ * @param line the command, without its newline
+ * @param out where the answer is written
+ */
+void admin_command(const char *line, FILE *out);
+
+/**
+ * @brief Thread body of the control plane: its own poll loop watching
+ * stdin, the admin socket and the admin clients, so admin traffic never
+ * runs on (or stalls) a reactor
+ *
+ * @param arg unused
+ */
+void *admin_main(void *arg);
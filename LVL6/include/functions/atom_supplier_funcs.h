@@ -39,4 +39,39 @@ void ask_requester(unsigned long long* amount, char* atom, size_t atom_size);
  * @param sa Pointer to sockaddr structure (could be IPv4 or IPv6)
  * @return Pointer to the IP address part of the structure
  */
-void *get_in_addr(struct sockaddr *sa);
\ No newline at end of file
+void *get_in_addr(struct sockaddr *sa);
+
+/**
+ * @brief Encodes a binary request (wire_funcs.h) for -b/--binary
+ *
+ * @param opcode WIRE_OP_ADD or WIRE_OP_DELIVER
+ * @param element name of the atom or molecule, as ask_supplier/ask_requester return it
+ * @param amount amount to add or deliver
+ * @param timeout_ms -t, how long the server may keep the request waiting, 0 for no limit
+ * @param out where to encode, at least WIRE_HEADER_SIZE bytes
+ * @param out_size size of out
+ * @return length of the request
+ */
+size_t encode_wire_request(u_int8_t opcode, const char *element, unsigned long long amount, u_int32_t timeout_ms,
+                           char *out, size_t out_size);
+
+/**
+ * @brief Parses the value of -t: milliseconds, 1 to UINT32_MAX. Exits on a bad value.
+ */
+u_int32_t parse_timeout_arg(const char *arg);
+
+/**
+ * @brief -t: gives up on the reply after timeout_ms, the request asked
+ * the server to drop it by then anyway (SO_RCVTIMEO)
+ */
+void set_reply_timeout(int sockfd, u_int32_t timeout_ms);
+
+/**
+ * @brief Turns a binary reply into a line for the user
+ *
+ * @param buf the received reply
+ * @param len its length
+ * @param out where to write the text
+ * @param out_size size of out
+ */
+void format_wire_reply(const char *buf, size_t len, char *out, size_t out_size);
\ No newline at end of file
@@ -13,21 +13,183 @@
 #include <sys/wait.h>
 #include <signal.h>
 #include <ctype.h>
+#include <pthread.h>
 #include "../const.h"
+#include "../elements.h"
+#include "parse_funcs.h"
+#include "timer_wheel_funcs.h"
+#include "inventory_funcs.h"
+#include "combine_funcs.h"
+#include "pipeline_funcs.h"
+#include "partition_funcs.h"
 
-#define BACKLOG 10   // Maximum number of pending client connections in the queue
-
-// Warehouse supply, (unsigned long long = 10^18)
-// Atom Storage Structure
-typedef struct AtomStorage {
-    unsigned long long carbon;    // Carbon atoms count
-    unsigned long long oxygen;    // Oxygen atoms count
-    unsigned long long hydrogen;  // Hydrogen atoms count
-} AtomStorage;
+#define BACKLOG SOMAXCONN   // Default number of pending client connections in the queue, see -l/--backlog
 
 // Global storage instance
 extern AtomStorage warehouse;
 
+// Taken by process_message(), the reactor threads share one warehouse
+extern pthread_mutex_t warehouse_mutex;
+
+// How a plain ADD or DELIVER reaches the inventory, -I/--inventory
+typedef enum {
+    INVENTORY_LOCK_FREE,    // DELIVER with inventory_reserve(), the default (the mutex with -f)
+    INVENTORY_COMBINING,    // ADD and DELIVER flat-combined, see combine_funcs.h
+    INVENTORY_MUTEX,        // each operation takes warehouse_mutex
+    INVENTORY_PIPELINE,     // every operation runs on one apply thread, see pipeline_funcs.h
+    INVENTORY_PARTITIONED   // ADD and DELIVER on the reactor's own slice, see partition_funcs.h
+} InventoryMode;
+extern InventoryMode warehouse_inventory;
+
+// Set before the reactors start when no storage file is used: a plain
+// DELIVER then takes its atoms with inventory_reserve() instead of
+// warehouse_mutex. The holder of the mutex closes a gate and waits for the
+// lock-free DELIVERs in flight, so everything that runs under the lock
+// still has the warehouse to itself.
+extern u_int8_t warehouse_lock_free;
+
+// INVENTORY_COMBINING: plain ADDs and DELIVERs are published to it, its
+// combiner runs each batch under warehouse_mutex with one reload and one
+// save of the storage file
+extern u_int8_t warehouse_combining;
+extern Combiner warehouse_combiner;
+
+// INVENTORY_PARTITIONED without a storage file: plain ADDs and DELIVERs
+// run on the reactor's slice. warehouse_lock() gathers the slices into
+// the warehouse and counts their changes into warehouse_generation, the
+// replies of the slices carry the generation of the last gather.
+extern u_int8_t warehouse_partitioned;
+
+// INVENTORY_PIPELINE: every change runs on the apply thread, which owns
+// the warehouse and the storage file. warehouse_lock() there only opens
+// the write section for the lock-free readers, without warehouse_mutex.
+extern u_int8_t warehouse_pipelined;
+
+// Set when this server holds LOCK_EX on the storage file for its whole run
+// (-b uring with -f): save_to_file() then neither takes nor drops the
+// lock, and reload_from_file() keeps the inventory in memory.
+extern u_int8_t storage_owned;
+
+/**
+ * @brief Parses the -I/--inventory argument
+ *
+ * @param str "lock-free", "combining", "mutex", "pipeline" or "partitioned"
+ * @param mode receives the mode
+ * @return 0 on success, -1 if str is no mode
+ */
+int inventory_mode_from_str(const char *str, InventoryMode *mode);
+
+/**
+ * @brief Sets up warehouse_inventory, before the reactors start. With
+ * INVENTORY_PIPELINE it starts the apply thread, which then owns the
+ * storage file: it is never reloaded, and saved once per batch before
+ * the batch is answered. INVENTORY_PARTITIONED needs the inventory in
+ * memory, with any storage file it runs like INVENTORY_MUTEX.
+ *
+ * @param file_flag the apply thread saves the storage file
+ * @param fd the storage file, -1 for none
+ * @param reactors one inventory slice each
+ * @return 0 on success, -1 if the apply thread could not start
+ */
+int warehouse_inventory_init(int file_flag, int fd, int reactors);
+
+// A process_message() or process_wire_message() call, see message_submit()
+typedef struct MessageCall {
+    u_int8_t wire;                          // buf is a binary frame
+    char *buf;
+    size_t size_buf;
+    u_int8_t sock_handle;
+    char *response;
+    size_t response_size;
+    int file_flag, fd;
+    int origin_fd;                          // backorder_origin() of the caller
+    struct sockaddr_storage origin_addr;
+    socklen_t origin_len;
+    size_t len;                             // the reply length, once it ran
+} MessageCall;
+
+/**
+ * @brief Runs process_message() (or process_wire_message() when wire is
+ * set) now, or with -I pipeline queues it on the apply thread: call->len
+ * is then set once pipeline_wait() returns. call and the buffers must
+ * stay valid until then.
+ */
+void message_submit(MessageCall *call, u_int8_t wire, char *buf, size_t size_buf, u_int8_t sock_handle,
+                    char *response, size_t response_size, int file_flag, int fd);
+
+// Bumped every time process_message() changes the warehouse. It is the
+// inventory version every reply carries and IF_VERSION compares with.
+extern unsigned long long warehouse_generation;
+
+// HOLD TTLs and backorder deadlines. Any thread may add or delete its
+// timers under warehouse_mutex, reactor 0 runs them.
+extern TimerWheel warehouse_wheel;
+
+/**
+ * @brief Takes warehouse_mutex, then waits out the lock-free DELIVERs in
+ * flight, or gathers the partitioned slices. Every thread that changes or
+ * reads the whole warehouse under the lock takes it this way. With
+ * warehouse_pipelined only the apply thread may call it.
+ */
+void warehouse_lock(void);
+
+/**
+ * @brief Reopens the lock-free path and drops warehouse_mutex, with
+ * nothing else to do (warehouse_unlock() does the bookkeeping first)
+ */
+void warehouse_lock_drop(void);
+
+/**
+ * @brief Runs fn(arg) with the warehouse to itself, for the threads that
+ * only read or write it whole (admin FLUSH, shutdown): under
+ * warehouse_lock(), or with -I pipeline on the apply thread, the only
+ * writer, so the data path never sees the mutex
+ */
+void warehouse_call(PipelineFn fn, void *arg);
+
+/**
+ * @brief Creates warehouse_wheel's timerfd, before the reactors start
+ *
+ * @return 0 on success, -1 on failure (errno is set)
+ */
+int warehouse_timers_init(void);
+
+/**
+ * @brief Runs the due timers of warehouse_wheel when its timerfd is
+ * readable, under warehouse_mutex, and saves what they changed
+ *
+ * @param file_flag the storage file is used
+ * @param fd the storage file
+ */
+void warehouse_timers_expire(int file_flag, int fd);
+
+/**
+ * @brief End of an operation that took warehouse_mutex: fills the
+ * backorders the inventory now covers, saves the storage file and bumps
+ * warehouse_generation if the inventory changed, drops the lock, then
+ * sends the backorder replies
+ *
+ * @param before the inventory when the operation started
+ * @param after receives the inventory, may be NULL
+ * @param version receives warehouse_generation, may be NULL
+ * @param file_flag the storage file is used
+ * @param fd the storage file
+ */
+void warehouse_unlock(const AtomStorage *before, AtomStorage *after, unsigned long long *version, int file_flag, int fd);
+
+/**
+ * @brief Copies the warehouse without the lock. Every change of it is a
+ * write section of a sequence lock (inventory_funcs.h), the copy is redone
+ * until no change overlapped it, so the three counters and the generation
+ * always match and no writer ever waits for a reader. With
+ * warehouse_partitioned the slices are summed the same way, the
+ * generation is the one of the last gather. Not under warehouse_mutex.
+ * 
+ * @param out where to copy the storage
+ * @param generation if not NULL, receives the matching warehouse_generation
+ */
+void warehouse_snapshot(AtomStorage *out, unsigned long long *generation);
+
 /**
  * @brief Each itteration that the system wants to do a subtraction or addition operation, 
  * it calls reloard to reload the last saved values of the storage warehosue
@@ -53,6 +215,14 @@ void init_warehouse(unsigned long long c, unsigned long long o, unsigned long lo
  */
 void print_storage();
 
+/**
+ * @brief Writes the inventory reply of ADD, "CARBON: <n>\nOXYGEN: ..."
+ *
+ * @param inv the inventory to show
+ * @return length of the reply
+ */
+size_t format_storage(const AtomStorage *inv, char *out, size_t out_size);
+
 /**
  * @brief processes a message buffer containing a command, 
  * an atom type, and an amount. It validates the message format, 
@@ -66,8 +236,146 @@ void print_storage();
 * @param response the response we want to send to the client
 * @param response_size size of the response
 * @param file_flag file flag for updating the storage file in parallel
+* Thread safe, the whole command runs under warehouse_lock(), a plain
+* DELIVER on the lock-free path when warehouse_lock_free is set, a plain
+* ADD or DELIVER through warehouse_combiner when warehouse_combining is,
+* on the reactor's slice when warehouse_partitioned is.
+* @return length of the reply (also NUL terminated), 0 for none
 */
-void process_message(char* buf, size_t size_buf, u_int8_t sock_handle, char *response, size_t response_size, int file_flag, int fd);
+size_t process_message(char* buf, size_t size_buf, u_int8_t sock_handle, char *response, size_t response_size, int file_flag, int fd);
+
+// Outcome of one inventory operation, shared by the text and the binary protocol
+typedef enum {
+    WAREHOUSE_OK,
+    WAREHOUSE_UNKNOWN_ELEMENT,  // not an atom (ADD), a molecule (DELIVER) or a drink (GEN)
+    WAREHOUSE_NOT_ENOUGH,       // DELIVER or ORDER, the inventory is short, nothing was taken
+    WAREHOUSE_VERSION_MISMATCH, // IF_VERSION, the inventory changed since, nothing was done
+    WAREHOUSE_NO_HOLD,          // COMMIT or RELEASE of a hold that expired or was settled
+    WAREHOUSE_HOLDS_FULL,       // HOLD, HOLDS_MAX holds are open
+    WAREHOUSE_BACKORDERED,      // DELIVER ... BACKORDER, queued until the inventory covers it
+    WAREHOUSE_BACKORDERS_FULL   // DELIVER ... BACKORDER, BACKORDERS_MAX wait already
+} WarehouseStatus;
+
+/**
+ * @brief Name of an atom or a molecule in the replies ("CARBON DIOXIDE")
+ *
+ * @param element CARBON to ALCOHOL
+ */
+const char *warehouse_element_name(Element element);
+
+/**
+ * @brief Adds atoms to the warehouse. Caller holds warehouse_mutex.
+ *
+ * @param atom CARBON, OXYGEN or HYDROGEN
+ * @param amount atoms to add
+ */
+WarehouseStatus warehouse_add(Element atom, unsigned long long amount);
+
+/**
+ * @brief Takes the atoms of amount molecules, all or nothing.
+ * Caller holds warehouse_mutex.
+ *
+ * @param molecule WATER, CARBON_DIOXIDE, GLUCOSE or ALCOHOL
+ * @param amount molecules to deliver
+ */
+WarehouseStatus warehouse_deliver(Element molecule, unsigned long long amount);
+
+/**
+ * @brief Takes amount atoms of one kind or the atoms of amount molecules,
+ * all or nothing. Caller holds warehouse_mutex.
+ *
+ * @param element an atom or a molecule
+ * @param amount atoms or molecules
+ * @param taken receives what was taken, may be NULL
+ */
+WarehouseStatus warehouse_take(Element element, unsigned long long amount, AtomStorage *taken);
+
+/**
+ * @brief Takes the atoms of every item of an order, all or nothing: the
+ * needs of all the items are summed and checked once, so an order is
+ * never left half-filled. Caller holds warehouse_mutex.
+ *
+ * @param items the molecules and their amounts, a molecule may repeat
+ * @param count number of items
+ * @return WAREHOUSE_UNKNOWN_ELEMENT if an item is no molecule,
+ * WAREHOUSE_NOT_ENOUGH if the sum does not fit the inventory
+ */
+WarehouseStatus warehouse_order(const OrderItem *items, int count);
+
+/**
+ * @brief How many of a drink the inventory can make, the GEN command.
+ * Caller holds warehouse_mutex.
+ *
+ * @param drink SOFT_DRINK, VODKA or CHAMPAGNE
+ * @param count receives the number of drinks
+ */
+WarehouseStatus warehouse_gen(Element drink, unsigned long long *count);
+
+// Inventory operations of warehouse_apply()
+typedef enum {
+    WAREHOUSE_OP_ADD,
+    WAREHOUSE_OP_DELIVER,
+    WAREHOUSE_OP_GEN,
+    WAREHOUSE_OP_HOLD,          // warehouse_apply_hold() only
+    WAREHOUSE_OP_COMMIT,
+    WAREHOUSE_OP_RELEASE
+} WarehouseOp;
+
+/**
+ * @brief Runs one inventory operation under warehouse_mutex, for the
+ * protocols that do not go through process_message(). Reloads the
+ * storage file first (-f), saves it and bumps warehouse_generation when
+ * the inventory changed. An unconditional DELIVER takes the lock-free
+ * path instead when warehouse_lock_free is set, an unconditional ADD or
+ * DELIVER goes through warehouse_combiner when warehouse_combining is.
+ * With warehouse_partitioned they run on the reactor's slice. GEN without
+ * IF_VERSION or a storage file computes from warehouse_snapshot() and
+ * takes no lock at all.
+ *
+ * @param op what to do
+ * @param element the atom, molecule or drink
+ * @param amount atoms to add or molecules to deliver, unused by GEN
+ * @param if_version if not NULL, nothing runs unless warehouse_generation
+ * still has this value (WAREHOUSE_VERSION_MISMATCH)
+ * @param count GEN: receives the number of drinks, may be NULL otherwise
+ * @param after receives the inventory after the operation, may be NULL
+ * @param version receives warehouse_generation after the operation, may be NULL
+ * @param file_flag the storage file is used
+ * @param fd the storage file
+ */
+WarehouseStatus warehouse_apply(WarehouseOp op, Element element, unsigned long long amount,
+                                const unsigned long long *if_version, unsigned long long *count,
+                                AtomStorage *after, unsigned long long *version, int file_flag, int fd);
+
+/**
+ * @brief warehouse_order() under warehouse_mutex, with the storage file
+ * reloaded once and saved once for the whole order, like warehouse_apply()
+ *
+ * @param items the molecules and their amounts
+ * @param count number of items
+ * @param if_version if not NULL, the version the order is conditional on
+ * @param version receives warehouse_generation after the order, may be NULL
+ * @param file_flag the storage file is used
+ * @param fd the storage file
+ */
+WarehouseStatus warehouse_apply_order(const OrderItem *items, int count, const unsigned long long *if_version,
+                                      unsigned long long *version, int file_flag, int fd);
+
+/**
+ * @brief Binary protocol counterpart of process_message(): runs one
+ * wire_funcs.h frame against the warehouse and encodes the reply, no
+ * text is parsed or formatted. Thread safe, like process_message().
+ *
+ * @param buf one complete frame (starts with WIRE_MAGIC)
+ * @param size_buf its length
+ * @param sock_handle TCP_HANDLE for stream transports, UDP_HANDLE for datagrams
+ * @param response where the reply frame is written
+ * @param response_size at least WIRE_REPLY_SIZE
+ * @param file_flag file flag for updating the storage file in parallel
+ * @param fd file descriptor of the storage file
+ * @return length of the reply
+ */
+size_t process_wire_message(const char *buf, size_t size_buf, u_int8_t sock_handle, char *response, size_t response_size, int file_flag, int fd);
 
 /**
  * @brief Signal handler for cleaning up zombie child processes
@@ -128,9 +436,3 @@ unsigned long long get_alcohol_num(unsigned long long carbon, unsigned long long
  * @return Maximum number of glucose molecules that can be formed
  */
 unsigned long long get_glucose_num(unsigned long long carbon, unsigned long long oxygen, unsigned long long hydrogen);
-
-/**
- * @brief Alarm handle, handles the SIGALRM signal
- * 
- */
-void alarm_handler(int signum);
\ No newline at end of file
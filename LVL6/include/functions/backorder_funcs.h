@@ -0,0 +1,104 @@
+#pragma once
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "../const.h"
+#include "../elements.h"
+#include "atom_warehouse_funcs.h"
+#include "timer_wheel_funcs.h"
+
+/*
+ * Backorders. "DELIVER <molecule> <amount> BACKORDER" waits for supply
+ * instead of failing, so a requester no longer retries in a loop while
+ * the warehouse is short.
+ *
+ * A backorder that cannot be filled at once is queued behind the others
+ * of its molecule, one FIFO per priority. Every operation that took
+ * warehouse_mutex ends in warehouse_unlock(), which fills the queue heads
+ * the inventory now covers (nothing to do, and O(1), while no backorder
+ * waits). A backorder that is filled or whose deadline passes is answered
+ * with a second datagram to the requester once the lock is dropped.
+ *
+ * Datagram transports only, like DELIVER: the answer goes to the address
+ * the request came from.
+ */
+
+#define BACKORDERS_MAX 4096             // backorders waiting at once, the options are in parse_funcs.h
+
+// A waiting backorder, the id is 0 while the slot is free
+typedef struct Backorder {
+    unsigned long long id;
+    Element molecule;
+    unsigned long long amount;
+    int priority;
+    u_int8_t expired;                   // settled by its deadline, not by the inventory
+    int fd;                             // the datagram socket the request came in on
+    struct sockaddr_storage addr;       // and its sender, where the answer goes
+    socklen_t addr_len;
+    Timer deadline;
+    struct Backorder *prev, *next;      // its queue, then the settled list, then the free list
+} Backorder;
+
+/**
+ * @brief Builds the free list, before the reactors start
+ */
+void backorders_init(void);
+
+/**
+ * @brief Where a backorder queued by the next process_message() of this
+ * thread is answered: set by the datagram handlers before each request
+ *
+ * @param fd the datagram socket
+ * @param addr the sender
+ * @param addr_len bytes of addr
+ */
+void backorder_origin(int fd, const struct sockaddr_storage *addr, socklen_t addr_len);
+
+/**
+ * @brief The origin this thread set, so another thread can run its
+ * request (-I pipeline)
+ *
+ * @param fd receives the datagram socket, -1 if none was set
+ * @param addr receives the sender
+ * @param addr_len receives bytes of addr
+ */
+void backorder_origin_get(int *fd, struct sockaddr_storage *addr, socklen_t *addr_len);
+
+/**
+ * @brief Delivers amount of a molecule now, or queues the request until
+ * the inventory covers it. It is queued anyway while a backorder of the
+ * same molecule at the same or a higher priority waits, so it keeps its
+ * turn. Caller holds warehouse_mutex.
+ *
+ * @param molecule WATER, CARBON_DIOXIDE, GLUCOSE or ALCOHOL
+ * @param amount molecules to deliver
+ * @param priority 0 to BACKORDER_PRIORITIES - 1
+ * @param deadline seconds it may wait, 1 to BACKORDER_DEADLINE_MAX
+ * @param id receives the backorder id, 0 if it was delivered now
+ * @return WAREHOUSE_OK if delivered now, WAREHOUSE_BACKORDERED if queued,
+ * WAREHOUSE_BACKORDERS_FULL if BACKORDERS_MAX wait already
+ */
+WarehouseStatus warehouse_backorder(Element molecule, unsigned long long amount, int priority,
+                                    unsigned long long deadline, unsigned long long *id);
+
+/**
+ * @brief Backorders in the queues, without warehouse_mutex: a partitioned
+ * ADD that may fill one takes the lock instead
+ */
+int backorders_waiting(void);
+
+/**
+ * @brief Fills the waiting backorders the inventory covers: per molecule,
+ * the queue heads from the highest priority down, until a head does not
+ * fit. Caller holds warehouse_mutex, warehouse_unlock() calls it.
+ *
+ * @return backorders filled, their atoms left the warehouse
+ */
+int backorder_match(void);
+
+/**
+ * @brief Answers the backorders this thread filled or expired under the
+ * lock, then frees their slots. Called without warehouse_mutex.
+ *
+ * @param version warehouse_generation the answers carry
+ */
+void backorder_flush(unsigned long long version);
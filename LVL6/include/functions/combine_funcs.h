@@ -0,0 +1,65 @@
+#pragma once
+#include <sys/types.h>
+
+/*
+ * Flat combining. Instead of every thread taking the lock and touching
+ * the shared data in turn, a thread publishes its operation in its own
+ * publication slot and waits. Whoever finds the combiner free becomes the
+ * combiner: it collects every published operation and hands the whole
+ * batch to one apply callback, which runs it in a single pass while the
+ * data stays in its cache, then clears the slots to release the waiters.
+ * Under contention a lock and the data move between cores once per batch
+ * instead of once per operation.
+ *
+ * A thread gets a slot the first time it calls combine() and keeps it for
+ * the last Combiner it used. Past COMBINE_SLOTS threads, an operation is
+ * applied alone by its own thread once the combiner is free.
+ */
+
+#define COMBINE_SLOTS 64            // threads with a publication slot
+#define COMBINE_PASSES 4            // scans of the slots per turn as combiner
+
+struct Combiner;
+
+/**
+ * @brief Runs a batch of published operations, called by the combiner
+ * with no other combiner running
+ *
+ * @param c the combiner
+ * @param ops the operations, in slot order
+ * @param count 1 to COMBINE_SLOTS
+ */
+typedef void (*CombineApply)(struct Combiner *c, void **ops, int count);
+
+// One per thread, on its own cache line so waiting threads do not share one
+typedef struct CombineSlot {
+    void *op;                       // the published operation, NULL once applied
+} __attribute__((aligned(64))) CombineSlot;
+
+typedef struct Combiner {
+    CombineSlot slots[COMBINE_SLOTS];
+    unsigned int registered;        // slots handed out
+    u_int8_t busy;                  // a thread is combining
+    CombineApply apply;
+    void *data;                     // for the apply callback
+    unsigned long long batches;     // apply calls
+    unsigned long long combined;    // operations they ran
+} Combiner;
+
+/**
+ * @brief Sets up a combiner, before any thread uses it
+ *
+ * @param c the combiner
+ * @param apply runs the batches
+ * @param data left in c->data for apply
+ */
+void combiner_init(Combiner *c, CombineApply apply, void *data);
+
+/**
+ * @brief Publishes op and returns once a combiner, maybe this thread,
+ * applied it. Whatever apply wrote into op is visible on return.
+ *
+ * @param c the combiner
+ * @param op the operation, owned by the caller
+ */
+void combine(Combiner *c, void *op);
@@ -0,0 +1,147 @@
+#pragma once
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "../const.h"
+#include "event_loop_funcs.h"
+#include "timer_wheel_funcs.h"
+
+/**
+ * @brief Stream client counters of one reactor. Only the reactor writes
+ * them (plain stores, no locked instructions), CONNECTIONS reads them
+ * from the admin thread.
+ */
+typedef struct ConnStats {
+    unsigned long long accepted;
+    unsigned long long closed;
+    unsigned long long messages;
+    unsigned long long bytes_in;
+    unsigned long long bytes_out;
+} ConnStats;
+
+// Counters of the calling reactor, set with conn_stats_attach()
+extern __thread ConnStats *conn_stats;
+
+#define CONN_STAT_ADD(field, n) \
+    __atomic_store_n(&conn_stats->field, conn_stats->field + (n), __ATOMIC_RELAXED)
+
+/**
+ * @brief Makes the calling reactor count its clients in the given counters
+ */
+void conn_stats_attach(ConnStats *stats);
+
+/**
+ * @brief Copies a reactor's counters, safe from any thread
+ */
+void conn_stats_read(const ConnStats *stats, ConnStats *out);
+
+/**
+ * @brief A connected TCP/UNIX stream client. The socket is non-blocking,
+ * replies that the kernel does not take right away wait in the output
+ * buffer and LOOP_WRITE is armed only while something is pending.
+ *
+ * Connections are fixed-size and carved out of per-reactor slabs of
+ * CONN_SLAB_SIZE, a free list makes conn_new()/conn_close() O(1).
+ * Memory budget per idle connection: sizeof(Connection) (304 bytes on x86-64,
+ * printed by STATS) in the slab, plus 16 bytes of poll array with the
+ * poll backend. The output buffer is allocated only once a reply does
+ * not fit in the socket, and is capped at CONN_OUTBUF_MAX.
+ */
+typedef struct Connection {
+    Handler h;              // must stay first, the loop hands us &h
+    u_int8_t transport;     // HANDLER_TCP_LISTEN, HANDLER_UNIX_LISTEN or HANDLER_RESP_LISTEN, the listener it came from
+    struct Connection *next_free;   // pool free list, only while the slot is unused
+
+    // idle timeout (-i), last_active is checked when the timer fires
+    Timer idle;
+    unsigned long long last_active;     // monotonic_ms() of the last read
+
+    // counters
+    unsigned long long bytes_in;
+    unsigned long long bytes_out;
+    unsigned long long messages;
+
+    // input, in[0..in_len) is a request still missing bytes (stream_funcs.h)
+    u_int8_t framed;        // sent a newline, text commands are lines from now on
+    size_t in_len;
+    char in[MAXDATASIZE];
+
+    // output, pending reply bytes are out[out_off..out_len)
+    char *out;
+    size_t out_off;
+    size_t out_len;
+    size_t out_cap;
+} Connection;
+
+/**
+ * @brief Carves the calling reactor's first slab up front (--low-latency
+ * also locks and prefaults it), so the first clients do not page-fault
+ *
+ * @return 0 on success, -1 if the allocation failed
+ */
+int conn_pool_reserve(void);
+
+/**
+ * @brief Takes a place for a new client, counted over all reactors.
+ * Fails once max_clients (-C/--max-clients) are connected, 0 means no limit.
+ *
+ * @return 0 on success, -1 if the client must be rejected
+ */
+int conn_admit(void);
+
+/**
+ * @brief Gives back the place taken by conn_admit()
+ */
+void conn_release(void);
+
+/**
+ * @brief Takes the state of an accepted client from the calling reactor's
+ * pool. Does not register it in a loop. The caller already did conn_admit().
+ *
+ * @param fd the accepted socket, already O_NONBLOCK (accept4 SOCK_NONBLOCK)
+ * @param transport kind of the listener that accepted it
+ * @return the connection, NULL on failure (fd is left open)
+ */
+Connection *conn_new(int fd, u_int8_t transport);
+
+/**
+ * @brief Starts the idle timer of a connection registered in a loop,
+ * does nothing unless -i/--idle-timeout was given
+ */
+void conn_watch_idle(Connection *c);
+
+/**
+ * @brief Returns a connection that was never registered to the pool,
+ * without closing its fd or releasing its place
+ */
+void conn_free(Connection *c);
+
+/**
+ * @brief Unregisters and closes a client, returns it to the pool and
+ * releases its place
+ */
+void conn_close(Connection *c);
+
+/**
+ * @brief Sends a reply, queueing whatever the socket does not accept.
+ * A client whose backlog would grow past CONN_OUTBUF_MAX stopped reading
+ * and is disconnected.
+ *
+ * @return 0 on success, -1 if the connection was closed (c is freed)
+ */
+int conn_send(Connection *c, const char *data, size_t len);
+
+/**
+ * @brief Sends several replies with one gathering sendmsg() (writev() with
+ * MSG_NOSIGNAL), queueing whatever the socket does not accept, like conn_send()
+ *
+ * @return 0 on success, -1 if the connection was closed (c is freed)
+ */
+int conn_sendv(Connection *c, const struct iovec *iov, int count);
+
+/**
+ * @brief Writes the pending output until EAGAIN, disarms LOOP_WRITE once
+ * the buffer is empty
+ *
+ * @return 0 on success, -1 if the connection was closed (c is freed)
+ */
+int conn_flush(Connection *c);
@@ -0,0 +1,175 @@
+#pragma once
+#include <stdio.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <signal.h>
+#include "../const.h"
+#include "event_loop_funcs.h"
+#include "connection_funcs.h"
+#include "latency_funcs.h"
+
+// flag for storage file and its descriptor
+extern u_int8_t file_flag;
+extern int storage_fd;
+
+// event loop backend, -b/--backend
+extern LoopBackend loop_backend;
+
+// UNIX domain sockets, created once and shared by every reactor (-1 when not used)
+extern int unix_tcp_sockfd;
+extern int unix_udp_sockfd;
+
+// Number of accepted stream clients currently registered, over all reactors
+extern int connected_clients;
+
+// Upper bound for connected_clients, -C/--max-clients (0 = only limited by RLIMIT_NOFILE)
+extern int max_clients;
+
+// Connection slabs allocated by all the reactors, see connection_funcs.h
+extern int conn_slabs;
+
+// Seconds a stream client may stay silent before it is disconnected, -i/--idle-timeout (0 = never)
+extern int idle_timeout;
+
+// Why the server is stopping, set from a signal handler or a timer
+#define SHUTDOWN_SIGNAL   1     // SIGINT / SIGTERM
+#define SHUTDOWN_INACTIVE 2     // nothing happened for -t seconds
+extern volatile sig_atomic_t shutdown_requested;
+
+// monotonic_ms() of the last wakeup with real work, over all reactors (-t)
+extern unsigned long long server_last_activity;
+
+// Datagrams pulled by one recvmmsg() and flushed by one sendmmsg(), -m/--dgram-batch
+extern int dgram_batch;
+
+// listen() backlog of the stream listeners, -l/--backlog
+extern int listen_backlog;
+
+#define DGRAM_HIST_BUCKETS 8
+
+// Event loop and datagram batching counters, shown by the admin STATS command
+typedef struct ServerStats {
+    unsigned long long wakeups;         // returns from poll()/epoll_wait()
+    unsigned long long accepts;         // connections taken by accept4()
+    unsigned long long stream_reads;    // recv() calls that returned data
+    unsigned long long yields;          // handlers that used up IO_BUDGET before EAGAIN
+    unsigned long long batches;         // recvmmsg() calls that returned datagrams
+    unsigned long long datagrams;       // datagrams received
+    unsigned long long send_calls;      // sendmmsg() calls
+    unsigned long long replies;         // replies sent
+    unsigned long long spin_hits;       // --low-latency waits that found work while spinning
+    unsigned long long spin_blocks;     // --low-latency waits that ran out of spin budget and blocked
+    unsigned long long hist[DGRAM_HIST_BUCKETS];   // batch sizes 1, 2-3, 4-7, ..., 128+
+} ServerStats;
+
+extern ServerStats server_stats;
+
+/**
+ * @brief Prints the event loop and datagram batching counters and the
+ * request latency percentiles of all the reactors
+ *
+ * @param out stream to print to
+ */
+void print_server_stats(FILE *out);
+
+/**
+ * @brief One event loop thread. TCP and UDP are not shared: every reactor
+ * binds its own SO_REUSEPORT sockets and the kernel spreads the
+ * connections and datagrams between them. Aligned to a cache line, the
+ * counters of neighbouring reactors must not share one.
+ */
+typedef struct Reactor {
+    int id;                 // reactor 0 runs on the main thread and handles the shutdown
+    pthread_t thread;
+    int tcp_sockfd;         // own TCP listener
+    int udp_sockfd;         // own UDP socket
+    int resp_sockfd;        // own RESP listener, -1 without -R/--resp-port
+    ConnStats stats;        // written by this reactor only
+    LatencyHist latency;    // request latencies, written by this reactor only
+    unsigned long long spin_ns;     // current spin budget of --low-latency
+} __attribute__((aligned(64))) Reactor;
+
+// All the reactors, reactors[0] runs on the main thread (-n/--threads)
+extern Reactor *reactors;
+extern int reactor_count;
+
+/**
+ * @brief SIGINT/SIGTERM handler, only asks reactor 0 to shut down
+ */
+void on_shutdown_signal(int signum);
+
+/**
+ * @brief Clean shutdown, run by reactor 0: takes the warehouse through
+ * warehouse_call() so no other reactor can change it (with -I pipeline
+ * the apply thread exits), writes it to the storage file (-f) and exits
+ */
+void server_shutdown(void);
+
+/**
+ * @brief Creates, binds (and for TCP, starts listening on) an IPv4 socket
+ * on the given port. Exits the process on failure.
+ *
+ * @param port port number as a string
+ * @param socktype SOCK_STREAM or SOCK_DGRAM
+ * @param reuseport set SO_REUSEPORT so several reactors can bind the same port
+ * @return the socket fd
+ */
+int open_inet_socket(const char *port, int socktype, u_int8_t reuseport);
+
+/**
+ * @brief Thread body of a reactor: registers its sockets in its own loop
+ * for the selected backend and dispatches events forever.
+ *
+ * @param arg the Reactor
+ */
+void *reactor_main(void *arg);
+
+/**
+ * @brief Puts a file descriptor into O_NONBLOCK mode
+ *
+ * @param fd the file descriptor
+ * @return 0 on success, -1 on failure
+ */
+int set_nonblocking(int fd);
+
+/**
+ * @brief Allocates a handler for one of the server's own fds
+ * (listeners, datagram sockets, timerfd) and registers it in the loop.
+ * Exits the process if the registration fails.
+ *
+ * @param loop the event loop
+ * @param fd the file descriptor to watch
+ * @param kind HANDLER_* tag, selects the on_event callback
+ */
+void register_server_fd(EventLoop *loop, int fd, u_int8_t kind);
+
+/**
+ * @brief timerfd handler, runs the due timers of the loop's wheel
+ */
+void on_timer(Handler *h, u_int32_t events);
+
+/**
+ * @brief timerfd handler of warehouse_wheel, runs the due holds and backorders
+ */
+void on_warehouse_timer(Handler *h, u_int32_t events);
+
+/**
+ * @brief Accepts pending connections on a TCP or UNIX stream listener with
+ * accept4(), until EAGAIN or IO_BUDGET connections
+ */
+void on_stream_listen(Handler *h, u_int32_t events);
+
+/**
+ * @brief Receives commands from a connected TCP/UNIX stream client until
+ * EAGAIN or IO_BUDGET reads and replies, flushes its queued output when
+ * the socket becomes writable. Each reply records the time since the
+ * kernel received the request in the reactor's latency histogram.
+ */
+void on_stream_client(Handler *h, u_int32_t events);
+
+/**
+ * @brief Receives up to dgram_batch datagrams from the UDP or UNIX datagram
+ * socket with one recvmmsg(), answers the whole batch and sends all the
+ * replies with one sendmmsg()
+ */
+void on_dgram(Handler *h, u_int32_t events);
@@ -0,0 +1,124 @@
+#pragma once
+#include <sys/types.h>
+#include <poll.h>
+#include "../const.h"
+
+// Event loop backends, selected at startup with -b/--backend
+typedef enum {
+    LOOP_POLL,      // poll(), scans every registered fd on each wakeup
+    LOOP_EPOLL,     // edge-triggered epoll, dispatches only the ready fds
+    LOOP_URING      // io_uring completions, see uring_loop_funcs.h (built with HAVE_IO_URING)
+} LoopBackend;
+
+// Backend independent readiness flags handed to the handlers
+#define LOOP_READ  0x1
+#define LOOP_WRITE 0x2
+#define LOOP_ERROR 0x4
+#define LOOP_LEVEL 0x8  // registration flag, keep this fd level-triggered under epoll
+#define LOOP_SHARED 0x10 // registration flag, fd is watched by several loops, wake only one (EPOLLEXCLUSIVE)
+
+struct EventLoop;
+struct TimerWheel;
+
+/**
+ * @brief Every fd registered in the loop carries one of these.
+ * With epoll the pointer itself is stored in epoll_data, so dispatching
+ * an event is a single indirect call, no fd comparisons are needed.
+ */
+typedef struct Handler {
+    int fd;                         // The watched file descriptor
+    int slot;                       // Index in the poll array (poll backend only)
+    u_int8_t kind;                  // HANDLER_* tag, see const.h
+    struct EventLoop *loop;         // Loop the handler is registered in
+    void (*on_event)(struct Handler *h, u_int32_t events);
+
+    // Deferred list, handlers that used up their budget before EAGAIN
+    u_int8_t deferred;
+    struct Handler *defer_prev, *defer_next;
+} Handler;
+
+typedef struct EventLoop {
+    LoopBackend backend;
+    u_int8_t edge_triggered;        // handlers must drain their fd until EAGAIN
+
+    // LOOP_EPOLL
+    int epfd;
+
+    // LOOP_POLL, pfds[i] belongs to handlers[i]. The arrays double when
+    // full, removed handlers leave a hole (fd -1) that is reused first.
+    struct pollfd *pfds;
+    Handler **handlers;
+    int nfds;                       // slots in use or holes, what poll() scans
+    int capacity;
+    int *free_slots;                // stack of the holes
+    int free_count;
+
+    // Timers of this loop, fired through the timerfd handler (set by the owner)
+    struct TimerWheel *wheel;
+
+    // Handlers re-run with LOOP_READ on the next round, see loop_yield()
+    Handler *defer_head, *defer_tail;
+    int deferred_count;
+} EventLoop;
+
+/**
+ * @brief Parses the value given to -b/--backend
+ *
+ * @param str "poll", "epoll" or "uring"
+ * @param backend where to store the parsed backend
+ * @return 0 on success, -1 on an unknown name
+ */
+int loop_backend_from_str(const char *str, LoopBackend *backend);
+
+/**
+ * @brief Creates the loop for the selected backend
+ *
+ * @param loop the loop to initialize
+ * @param backend LOOP_POLL or LOOP_EPOLL
+ * @param capacity initial number of fds the poll array can hold
+ * @return 0 on success, -1 on failure (errno is set)
+ */
+int loop_init(EventLoop *loop, LoopBackend backend, int capacity);
+
+/**
+ * @brief Registers a handler for the given LOOP_READ/LOOP_WRITE events.
+ * O(1), the poll arrays grow as needed.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int loop_add(EventLoop *loop, Handler *h, u_int32_t events);
+
+/**
+ * @brief Changes the events a registered handler is waiting for
+ *
+ * @return 0 on success, -1 on failure
+ */
+int loop_mod(EventLoop *loop, Handler *h, u_int32_t events);
+
+/**
+ * @brief Unregisters a handler in O(1), safe to call from inside its own
+ * on_event. The caller still owns the fd and the handler memory.
+ */
+void loop_del(EventLoop *loop, Handler *h);
+
+/**
+ * @brief Called by a handler that stopped draining its fd because it used
+ * up its fairness budget. Edge-triggered loops will not report the fd
+ * again, so the handler is re-run with LOOP_READ on the next round (which
+ * then polls without blocking). Level-triggered loops need nothing.
+ */
+void loop_yield(EventLoop *loop, Handler *h);
+
+/**
+ * @brief Waits once for events and dispatches every ready handler,
+ * then the handlers deferred by loop_yield()
+ *
+ * @param timeout_ms -1 blocks indefinitely
+ * @return number of dispatched events, -1 on failure
+ */
+int loop_run_once(EventLoop *loop, int timeout_ms);
+
+/**
+ * @brief Releases the backend resources
+ */
+void loop_destroy(EventLoop *loop);
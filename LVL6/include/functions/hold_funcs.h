@@ -0,0 +1,92 @@
+#pragma once
+#include <sys/types.h>
+#include "../const.h"
+#include "../elements.h"
+#include "atom_warehouse_funcs.h"
+#include "timer_wheel_funcs.h"
+
+/*
+ * Time-limited reservations. HOLD takes the atoms of an amount of an atom
+ * or a molecule out of the warehouse into a hold, COMMIT delivers them
+ * (they stay out), RELEASE or the end of the TTL puts them back.
+ *
+ * The holds live in a fixed table with a free list, a hold id carries its
+ * slot so every lookup is O(1). Their TTLs sit on warehouse_wheel, touched
+ * only under warehouse_mutex, so any reactor can add or cancel a hold in
+ * O(1); reactor 0 runs the expiries. Nothing ever scans the table, but
+ * shutdown.
+ */
+
+#define HOLDS_MAX 16384         // open holds at once, a power of two
+#define HOLD_TTL_MAX 86400      // seconds
+
+// Every hold is in exactly one state, the id is 0 while the slot is free
+typedef struct Hold {
+    unsigned long long id;
+    Element element;
+    unsigned long long amount;
+    AtomStorage atoms;          // taken out of the warehouse
+    Timer ttl;
+    struct Hold *next_free;
+} Hold;
+
+/**
+ * @brief Builds the free list, before the reactors start
+ */
+void holds_init(void);
+
+/**
+ * @brief Holds amount of an atom or a molecule for ttl seconds.
+ * Caller holds warehouse_mutex.
+ *
+ * @param element CARBON, OXYGEN, HYDROGEN or a molecule
+ * @param amount atoms or molecules to hold
+ * @param ttl seconds until the hold is released on its own, 1 to HOLD_TTL_MAX
+ * @param id receives the hold id
+ * @return WAREHOUSE_NOT_ENOUGH if the inventory is short,
+ * WAREHOUSE_HOLDS_FULL if HOLDS_MAX holds are open
+ */
+WarehouseStatus warehouse_hold(Element element, unsigned long long amount, unsigned long long ttl, unsigned long long *id);
+
+/**
+ * @brief Delivers a hold, its atoms stay out of the warehouse.
+ * Caller holds warehouse_mutex.
+ *
+ * @param id the hold
+ * @param held if not NULL, receives the hold as it was
+ * @return WAREHOUSE_NO_HOLD if the hold expired or was settled already
+ */
+WarehouseStatus warehouse_commit(unsigned long long id, Hold *held);
+
+/**
+ * @brief Puts the atoms of a hold back. Caller holds warehouse_mutex.
+ *
+ * @param id the hold
+ * @param held if not NULL, receives the hold as it was
+ * @return WAREHOUSE_NO_HOLD if the hold expired or was settled already
+ */
+WarehouseStatus warehouse_release(unsigned long long id, Hold *held);
+
+/**
+ * @brief HOLD, COMMIT or RELEASE under warehouse_mutex, for the protocols
+ * that do not go through process_message(), like warehouse_apply()
+ *
+ * @param op WAREHOUSE_OP_HOLD, WAREHOUSE_OP_COMMIT or WAREHOUSE_OP_RELEASE
+ * @param element HOLD: the atom or molecule
+ * @param amount HOLD: how many
+ * @param ttl HOLD: seconds
+ * @param id HOLD: receives the new id, COMMIT and RELEASE: the hold
+ * @param if_version if not NULL, the version the operation is conditional on
+ * @param version receives warehouse_generation afterwards, may be NULL
+ * @param file_flag the storage file is used
+ * @param fd the storage file
+ */
+WarehouseStatus warehouse_apply_hold(WarehouseOp op, Element element, unsigned long long amount, unsigned long long ttl,
+                                     unsigned long long *id, const unsigned long long *if_version,
+                                     unsigned long long *version, int file_flag, int fd);
+
+/**
+ * @brief Puts back the atoms of every open hold, so the final save at
+ * shutdown keeps them. Caller holds warehouse_mutex.
+ */
+void holds_release_all(void);
@@ -0,0 +1,95 @@
+#pragma once
+#include <sys/types.h>
+
+/*
+ * Lock-free atom counters. Every count is a 64-bit value changed only
+ * with atomic read-modify-writes, so threads can take and add atoms
+ * without warehouse_mutex.
+ *
+ * A molecule takes up to three counters at once (GLUCOSE is C6H12O6).
+ * inventory_reserve() takes them one at a time in a fixed order, carbon,
+ * oxygen, hydrogen, each with a compare-and-swap loop that refuses to go
+ * below zero. If one is short, the counters already taken are given back
+ * with atomic adds. So a reservation is all or nothing, a count never goes
+ * negative and nothing is ever oversold, and no thread waits for another.
+ * The price: while a failed reservation rolls back, a concurrent one may
+ * find that counter short and fail too, a shortage that lasts as long as
+ * the rollback.
+ */
+
+// Warehouse supply, (unsigned long long = 10^18)
+// Atom Storage Structure
+typedef struct AtomStorage {
+    unsigned long long carbon;    // Carbon atoms count
+    unsigned long long oxygen;    // Oxygen atoms count
+    unsigned long long hydrogen;  // Hydrogen atoms count
+} AtomStorage;
+
+/**
+ * @brief Takes need out of inv, all or nothing, lock-free
+ *
+ * @param inv the counters
+ * @param need atoms of each kind to take
+ * @return 0 if taken, -1 if a counter was short (inv is as it was)
+ */
+int inventory_reserve(AtomStorage *inv, const AtomStorage *need);
+
+/**
+ * @brief Adds atoms to inv with atomic adds
+ */
+void inventory_add(AtomStorage *inv, const AtomStorage *amount);
+
+/**
+ * @brief Reads the three counters, each atomically. The set is only
+ * consistent if nothing changes inv meanwhile.
+ */
+void inventory_load(const AtomStorage *inv, AtomStorage *out);
+
+/**
+ * @brief Overwrites the three counters, each atomically (storage file reloads)
+ */
+void inventory_store(AtomStorage *inv, const AtomStorage *value);
+
+/*
+ * Consistent reads. A change that spans several counters runs in a write
+ * section of an InventorySeq: begun is bumped before it and ended after
+ * it. Write sections may overlap (the writers still use the atomics above
+ * or a lock). A reader copies the counters between inventory_read_begin()
+ * and inventory_read_retry(). If begun still equals the ended it started
+ * from, no write section overlapped the copy. This is a sequence lock
+ * for several writers: readers never block a writer, they retry.
+ */
+typedef struct InventorySeq {
+    unsigned long long begun;       // write sections started
+    unsigned long long ended;       // write sections finished
+} InventorySeq;
+
+/**
+ * @brief Starts a write section, before the first counter changes
+ */
+void inventory_write_begin(InventorySeq *s);
+
+/**
+ * @brief Ends a write section, after the last counter changed
+ */
+void inventory_write_end(InventorySeq *s);
+
+/**
+ * @brief Whether no write section is open (ended is read before begun)
+ */
+int inventory_seq_idle(const InventorySeq *s);
+
+/**
+ * @brief Starts a read, the counters are copied after it
+ *
+ * @return what inventory_read_retry() compares with
+ */
+unsigned long long inventory_read_begin(const InventorySeq *s);
+
+/**
+ * @brief Ends a read
+ *
+ * @param start what inventory_read_begin() returned
+ * @return 1 if a write section overlapped the copy and it must be redone
+ */
+int inventory_read_retry(const InventorySeq *s, unsigned long long start);
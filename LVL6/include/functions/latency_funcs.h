@@ -0,0 +1,152 @@
+#pragma once
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "../const.h"
+
+#define LAT_SUB_BITS 4
+#define LAT_SUB_BUCKETS (1 << LAT_SUB_BITS)     // buckets per power of two, at most 1/16 error
+#define LAT_BUCKETS (40 * LAT_SUB_BUCKETS)      // nanoseconds up to 2^42 (over an hour)
+
+#define SPIN_MIN_NS   10000ULL      // adaptive spin budget of --low-latency, 10us ..
+#define SPIN_MAX_NS 1000000ULL      // .. 1ms
+#define BUSY_POLL_DEFAULT_US 50     // SO_BUSY_POLL of the inet sockets, -B/--busy-poll
+#define STACK_PREFAULT (64 * 1024)  // reactor stack touched up front in --low-latency
+
+// --low-latency: spin before blocking, pin the reactors, lock and prefault memory
+extern u_int8_t low_latency;
+
+// SO_BUSY_POLL microseconds for the reactors' TCP/UDP sockets (--low-latency only)
+extern int busy_poll_usec;
+
+// CPUs the reactors are pinned to, -P/--cpus (reactor i gets pin_cpus[i % pin_cpu_count])
+extern int *pin_cpus;
+extern int pin_cpu_count;
+
+/**
+ * @brief Log-linear histogram of request latencies in nanoseconds: exact
+ * below 16ns, then 16 buckets per power of two. One per reactor, only the
+ * reactor writes it (plain stores), STATS and LATENCY merge them.
+ */
+typedef struct LatencyHist {
+    unsigned long long count;
+    unsigned long long max_ns;
+    unsigned long long buckets[LAT_BUCKETS];
+} LatencyHist;
+
+// Histogram of the calling reactor, set with latency_attach()
+extern __thread LatencyHist *latency_hist;
+
+/**
+ * @brief Makes the calling reactor record its latencies in the given histogram
+ */
+void latency_attach(LatencyHist *hist);
+
+/**
+ * @brief CLOCK_REALTIME in nanoseconds, the clock of the kernel receive timestamps
+ */
+unsigned long long realtime_ns(void);
+
+/**
+ * @brief CLOCK_MONOTONIC in nanoseconds
+ */
+unsigned long long monotonic_ns(void);
+
+/**
+ * @brief Asks the kernel to stamp every received packet (SO_TIMESTAMPNS),
+ * so the latency also covers the time the request waited for the reactor
+ * to wake up. A failure only costs precision.
+ */
+void enable_rx_timestamps(int fd);
+
+/**
+ * @brief When a received message arrived: the SO_TIMESTAMPNS control
+ * message of a recvmsg()/recvmmsg() if there is one, else now
+ *
+ * @param msg the received message header, msg_control may be NULL
+ * @return realtime_ns() of the arrival
+ */
+unsigned long long latency_rx_ns(const struct msghdr *msg);
+
+/**
+ * @brief Adds one request that took ns nanoseconds to the calling reactor's histogram
+ */
+void latency_record(unsigned long long ns);
+
+// Requests dropped by request_expired(), for STATS
+extern unsigned long long expired_requests;
+
+/**
+ * @brief Whether a request waited in the server longer than its client
+ * allows, checked before it is parsed or applied. The limit is the
+ * TIMEOUT_MS of a text command (cut off here) or the timeout_ms of a
+ * binary header, counted from the kernel receive time, so the client's
+ * clock does not matter. 0 or no limit never expires.
+ *
+ * @param buf the request, text or a complete binary frame
+ * @param len bytes in buf, a text command is shortened to before TIMEOUT_MS
+ * @param arrived realtime_ns() of the arrival, latency_rx_ns()
+ * @return 1 if the request is to be dropped (counted in expired_requests), 0 to serve it
+ */
+int request_expired(const char *buf, size_t *len, unsigned long long arrived);
+
+/**
+ * @brief Merges a set of histograms and prints count, p50, p99, p999 and max
+ *
+ * @param out stream to print to
+ * @param label first word of the line
+ * @param hists histograms to merge
+ * @param stride distance in bytes between two histograms
+ * @param n number of histograms
+ */
+void print_latency(FILE *out, const char *label, const LatencyHist *hists, size_t stride, int n);
+
+/**
+ * @brief Parses the value given to -P/--cpus: "2,3,6-9"
+ *
+ * @return 0 on success (pin_cpus is set), -1 on a malformed list
+ */
+int parse_cpu_list(const char *str);
+
+/**
+ * @brief Fills pin_cpus with the CPUs the process may run on (taskset),
+ * the --low-latency default when -P/--cpus is not given. Must run before
+ * the first reactor pins itself, the threads inherit the affinity.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int allowed_cpu_list(void);
+
+/**
+ * @brief Pins the calling reactor to pin_cpus[id % pin_cpu_count],
+ * does nothing when the list is empty
+ *
+ * @param id reactor id
+ */
+void pin_reactor(int id);
+
+/**
+ * @brief Sets SO_BUSY_POLL on an inet socket, sockets accepted from a
+ * listener inherit it. Raising it above net.core.busy_read needs
+ * CAP_NET_ADMIN, a refusal is reported once and ignored.
+ */
+void set_busy_poll(int fd);
+
+/**
+ * @brief mlockall() of the current and future mappings, which also
+ * faults them in. Without the privilege or RLIMIT_MEMLOCK for it, warns
+ * and leaves the reactors to prefault their own buffers.
+ */
+void lock_memory(void);
+
+/**
+ * @brief Locks (best effort) and touches every page of a buffer, without
+ * changing its contents, so its first use does not page-fault. Only for
+ * memory no other thread writes yet.
+ */
+void prefault(void *addr, size_t len);
+
+/**
+ * @brief Touches STACK_PREFAULT bytes of the calling thread's stack
+ */
+void prefault_stack(void);
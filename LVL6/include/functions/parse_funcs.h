@@ -0,0 +1,134 @@
+#pragma once
+#include <sys/types.h>
+#include "../const.h"
+#include "../elements.h"
+
+// Text commands
+typedef enum {
+    CMD_UNKNOWN,
+    CMD_ADD,        // ADD <atom> <amount>, stream transports
+    CMD_DELIVER,    // DELIVER <molecule> <amount>, datagram transports
+    CMD_GEN,        // GEN <drink>, the server console
+    CMD_ORDER,      // ORDER <molecule> <amount> [<molecule> <amount> ...], datagram transports
+    CMD_HOLD,       // HOLD <atom|molecule> <amount> <ttl seconds>, any transport
+    CMD_COMMIT,     // COMMIT <hold id>
+    CMD_RELEASE     // RELEASE <hold id>
+} Command;
+
+/*
+ * Perfect hash of the command names, NAME_HASH with the length weighted
+ * three times: the plain NAME_HASH puts COMMIT and DELIVER together.
+ */
+#define COMMAND_HASH(first, last, len) NAME_HASH(first, last, 3 * (len))
+
+#define ORDER_ITEMS_MAX 8       // molecule kinds of one ORDER, more is malformed
+
+#define BACKORDER_PRIORITIES 4          // PRIORITY 0 (the default) to 3, higher is filled first
+#define BACKORDER_DEADLINE_DEFAULT 60   // seconds
+#define BACKORDER_DEADLINE_MAX 86400
+
+/**
+ * @brief One line of an ORDER
+ */
+typedef struct OrderItem {
+    Element molecule;           // UNKNOWN if not an element
+    unsigned long long amount;
+} OrderItem;
+
+/**
+ * @brief A parsed text command. The tokens are not copied, only looked up.
+ */
+typedef struct Request {
+    Command cmd;
+    Element element;            // UNKNOWN if missing or not an element
+    unsigned long long amount;
+    u_int8_t has_amount;        // the <cmd> <element> <amount> form, a decimal that fits
+} Request;
+
+/**
+ * @brief Command of a name that is not NUL terminated, one COMMAND_HASH
+ * and one compare
+ */
+Command command_from_name(const char *name, size_t len);
+
+/**
+ * @brief Splits a command on blanks in place, without copying or
+ * sscanf(), and looks its words up.
+ *
+ * "<cmd> <element> <amount>" sets has_amount. Otherwise the command is
+ * GEN-like: its element may be two words ("GEN SOFT DRINK"), a second
+ * word of one letter is ignored.
+ *
+ * @param buf the command, need not be NUL terminated
+ * @param len bytes in buf
+ * @param req the parsed command
+ */
+void parse_request(const char *buf, size_t len, Request *req);
+
+/**
+ * @brief Reads the <molecule> <amount> pairs after the command word of
+ * an ORDER, in place like parse_request(). A molecule may appear twice,
+ * the warehouse adds the amounts up.
+ *
+ * @param buf the command, need not be NUL terminated
+ * @param len bytes in buf
+ * @param items receives up to ORDER_ITEMS_MAX items
+ * @return number of items, -1 if there is none, too many, a pair is
+ * missing its amount or an amount is not a decimal that fits
+ */
+int parse_order(const char *buf, size_t len, OrderItem *items);
+
+/**
+ * @brief Finds the "IF_VERSION <version>" a conditional command ends
+ * with ("DELIVER WATER 5 IF_VERSION 1234") and cuts it off, so the rest
+ * parses like an unconditional command.
+ *
+ * @param buf the command, need not be NUL terminated
+ * @param len bytes in buf, shortened to the command before IF_VERSION
+ * @param version receives the version the client expects
+ * @return 1 if the command is conditional, 0 if not, -1 if IF_VERSION is
+ * not followed by a decimal that fits
+ */
+int parse_if_version(const char *buf, size_t *len, unsigned long long *version);
+
+/**
+ * @brief Finds the "TIMEOUT_MS <ms>" a command ends with, after its
+ * IF_VERSION if it has both ("DELIVER WATER 5 TIMEOUT_MS 50"), and cuts
+ * it off like parse_if_version()
+ *
+ * @param buf the command, need not be NUL terminated
+ * @param len bytes in buf, shortened to the command before TIMEOUT_MS
+ * @param timeout_ms receives the milliseconds the request may wait in the server
+ * @return 1 if the command has a timeout, 0 if not, -1 if TIMEOUT_MS is
+ * not followed by a decimal that fits
+ */
+int parse_timeout(const char *buf, size_t *len, unsigned long long *timeout_ms);
+
+/**
+ * @brief Reads the options of "DELIVER <molecule> <amount> BACKORDER
+ * [PRIORITY <p>] [DEADLINE <seconds>]", in either order. Words after the
+ * amount other than BACKORDER are ignored, as before backorders.
+ *
+ * @param priority receives the priority, 0 if not given
+ * @param deadline receives the deadline, BACKORDER_DEADLINE_DEFAULT if not given
+ * @return 1 for a backorder, 0 for a plain DELIVER, -1 if an option is
+ * repeated, unknown or not followed by a decimal that fits
+ */
+int parse_backorder(const char *buf, size_t len, unsigned long long *priority, unsigned long long *deadline);
+
+/**
+ * @brief Reads "HOLD <element> <amount> <ttl>", in place like parse_request()
+ *
+ * @param element receives the atom or molecule, UNKNOWN if it is neither
+ * @param amount receives the amount
+ * @param ttl receives the seconds the hold lasts
+ * @return 0, -1 if a word is missing or a number is not a decimal that fits
+ */
+int parse_hold(const char *buf, size_t len, Element *element, unsigned long long *amount, unsigned long long *ttl);
+
+/**
+ * @brief Reads the hold id of "COMMIT <id>" or "RELEASE <id>"
+ *
+ * @return 0, -1 if the id is missing or not a decimal that fits
+ */
+int parse_hold_id(const char *buf, size_t len, unsigned long long *id);
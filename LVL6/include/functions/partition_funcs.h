@@ -0,0 +1,121 @@
+#pragma once
+#include <sys/types.h>
+#include "inventory_funcs.h"
+
+/*
+ * Partitioned inventory, shared-nothing per core. Every reactor owns a
+ * slice of the atoms on its own cache line: a plain ADD adds to the slice
+ * of the reactor that got it, a plain DELIVER takes from it, and neither
+ * touches a line another core writes. Only a DELIVER its slice cannot
+ * cover rebalances: it pulls atoms from the central pool (the warehouse
+ * the lock holders work on) and then from the other slices, more than it
+ * needs so the next ones stay local, and tries once more.
+ *
+ * The slices are not visible under warehouse_mutex. The lock holder
+ * closes the gate, waits for the partition operations in flight and
+ * gathers every slice back into the central pool, so whatever runs under
+ * the lock (HOLD, ORDER, IF_VERSION, GEN ...) sees the whole inventory.
+ * The slices refill from it on their next shortage.
+ *
+ * Every slice operation, rebalancing included, is a write section of its
+ * own slice's InventorySeq. A reader that finds every slice idle before
+ * and after its copy has summed a consistent inventory.
+ */
+
+#define PARTITIONS_MAX 64           // slices, reactors past it share them
+
+typedef struct Partition {
+    AtomStorage stock;              // the slice, others take from it only to rebalance
+    InventorySeq seq;               // each operation of its threads is a write section
+    unsigned long long changes;     // ADDs and DELIVERs that changed the slice
+    unsigned long long folded;      // changes already gathered, lock holder only
+    unsigned long long rebalances;  // DELIVERs that pulled atoms from elsewhere
+} __attribute__((aligned(64))) Partition;
+
+extern Partition partitions[PARTITIONS_MAX];
+extern int partition_count;
+
+/**
+ * @brief Empties count slices, before any thread uses them
+ *
+ * @param count 1 to PARTITIONS_MAX, larger counts are capped
+ */
+void partitions_init(int count);
+
+/**
+ * @brief Gives this thread its slice, id modulo partition_count. A thread
+ * that never attaches uses slice 0.
+ *
+ * @param id the reactor id
+ */
+void partition_attach(int id);
+
+/**
+ * @brief Starts an operation on this thread's slice
+ *
+ * @return 1 if it may run, 0 if a lock holder closed the gate and the
+ * caller takes the lock instead
+ */
+int partition_enter(void);
+
+/**
+ * @brief Ends what partition_enter() started
+ */
+void partition_leave(void);
+
+/**
+ * @brief Adds atoms to this thread's slice, between enter and leave
+ *
+ * @param atoms what comes in
+ */
+void partition_add(const AtomStorage *atoms);
+
+/**
+ * @brief Takes need from this thread's slice, all or nothing, between
+ * enter and leave. If the slice is short it rebalances first: from the
+ * central pool a share of what is there, from each other slice half of
+ * what it holds, at least the shortfall.
+ *
+ * @param need the atoms
+ * @param central the central pool, only taken from with compare-and-swap
+ * @return 0 if taken, -1 if the whole inventory did not cover it
+ */
+int partition_take(const AtomStorage *need, AtomStorage *central);
+
+/**
+ * @brief Closes the gate and waits for the partition operations in
+ * flight, then moves every slice into into. Called with warehouse_mutex
+ * held, partition_open() reopens the gate.
+ *
+ * @param into the central pool
+ * @return slice changes since the last gather
+ */
+unsigned long long partition_gather(AtomStorage *into);
+
+/**
+ * @brief Reopens the gate partition_gather() closed
+ */
+void partition_open(void);
+
+/**
+ * @brief Adds what the slices hold now to out, without stopping them:
+ * a lazy read for the replies and the console
+ *
+ * @param out receives the sum, on top of what it holds
+ */
+void partition_sum(AtomStorage *out);
+
+/**
+ * @brief inventory_read_begin() over every slice
+ *
+ * @return what partition_read_retry() compares with
+ */
+unsigned long long partition_read_begin(void);
+
+/**
+ * @brief inventory_read_retry() over every slice
+ *
+ * @param start what partition_read_begin() returned
+ * @return 1 if a slice operation overlapped the copy
+ */
+int partition_read_retry(unsigned long long start);
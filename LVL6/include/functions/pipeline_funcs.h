@@ -0,0 +1,78 @@
+#pragma once
+#include <sys/types.h>
+#include <pthread.h>
+
+/*
+ * Single-writer pipeline. The reactor threads do not touch the warehouse,
+ * they publish each operation as an event in one pre-allocated ring and a
+ * single apply thread runs the events in the order of their sequence
+ * numbers, which is the total order of every change to the inventory.
+ *
+ * The ring is a disruptor: a producer claims the next sequence with one
+ * atomic add, fills the slot it maps to and publishes it by storing the
+ * sequence in the slot. The apply thread runs every published event in a
+ * row as one batch, calls the batch end hook (where the storage file is
+ * written once for the batch), and only then releases the producers that
+ * wait for the batch's events. A producer that finds the ring full, or
+ * the apply thread with nothing to do, spins briefly and then sleeps.
+ *
+ * Each producer thread has its own completion sequence: pipeline_wait()
+ * returns once every event it submitted ran, so a reactor may submit a
+ * whole datagram batch, or the requests of one stream read, and wait once.
+ */
+
+#define PIPELINE_RING_SIZE 1024     // events in flight, a power of two
+#define PIPELINE_SPINS 200          // checks before a waiting thread sleeps
+
+/**
+ * @brief An event, run on the apply thread
+ *
+ * @param arg what the producer passed to pipeline_submit()
+ */
+typedef void (*PipelineFn)(void *arg);
+
+struct PipelineWaiter;
+
+typedef struct PipelineEvent {
+    unsigned long long sequence;    // published once it holds the claimed sequence
+    PipelineFn fn;
+    void *arg;
+    struct PipelineWaiter *waiter;  // the producer's completions
+} PipelineEvent;
+
+// Events run and batches, for STATS
+extern unsigned long long pipeline_events;
+extern unsigned long long pipeline_batches;
+
+/**
+ * @brief Starts the apply thread, before the reactors start
+ *
+ * @param batch_end called by the apply thread after each batch, before
+ * its producers are released, may be NULL
+ * @return 0 on success, -1 if the thread could not start
+ */
+int pipeline_start(void (*batch_end)(void));
+
+/**
+ * @brief Whether an operation of this thread must go through the ring:
+ * the pipeline runs and this is not the apply thread
+ */
+int pipeline_active(void);
+
+/**
+ * @brief Publishes an event, fn(arg) runs later on the apply thread.
+ * arg must stay valid until pipeline_wait() returns.
+ */
+void pipeline_submit(PipelineFn fn, void *arg);
+
+/**
+ * @brief Waits until every event this thread submitted ran, and whatever
+ * they wrote into their args is visible
+ */
+void pipeline_wait(void);
+
+/**
+ * @brief pipeline_submit() then pipeline_wait(), fn(arg) runs on the
+ * apply thread as if it were called here
+ */
+void pipeline_call(PipelineFn fn, void *arg);
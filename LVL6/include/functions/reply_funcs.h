@@ -0,0 +1,77 @@
+#pragma once
+#include <sys/types.h>
+#include "../const.h"
+
+// Constant replies, copied with their compile-time length
+#define REPLY_UNKNOWN_ATOM      "ERROR: Unkown atom type\n"
+#define REPLY_UNKNOWN_MOLECULE  "ERROR: Unkown mulecule type\n"
+#define REPLY_UNKNOWN_DRINK     "ERROR: Unkown drink type\n"
+#define REPLY_UNKNOWN_COMMAND   "ERROR: Unknown command\n"
+#define REPLY_TOO_LONG          "ERROR: Command too long\n"
+#define REPLY_BAD_ORDER         "ERROR: Usage: ORDER <molecule> <amount> [<molecule> <amount> ...]\n"
+#define REPLY_UNKNOWN_ELEMENT   "ERROR: Unkown atom or molecule type\n"
+#define REPLY_BAD_HOLD          "ERROR: Usage: HOLD <atom|molecule> <amount> <ttl seconds, 1 to 86400>\n"
+#define REPLY_BAD_HOLD_ID       "ERROR: Usage: COMMIT <hold id> or RELEASE <hold id>\n"
+#define REPLY_NO_HOLD           "ERROR: No such hold, it expired or was settled\n"
+#define REPLY_HOLDS_FULL        "ERROR: Too many open holds\n"
+#define REPLY_BAD_BACKORDER     "ERROR: Usage: DELIVER <molecule> <amount> BACKORDER [PRIORITY <0 to 3>] [DEADLINE <seconds, 1 to 86400>]\n"
+#define REPLY_BACKORDERS_FULL   "ERROR: Too many backorders waiting\n"
+#define REPLY_BAD_VERSION       "ERROR: IF_VERSION needs a version number\n"
+#define REPLY_BAD_TIMEOUT       "ERROR: TIMEOUT_MS needs a number of milliseconds\n"
+#define REPLY_TIMED_OUT         "ERROR: Timed out waiting in the server, nothing done\n"
+#define REPLY_VERSION_MISMATCH  "ERROR: Version mismatch, nothing done\n"
+#define REPLY_ORDER_NOT_ENOUGH  "ERROR: Not enough atoms for the whole order, nothing delivered\n"
+
+#define U64_DIGITS_MAX 20       // digits of ~0ULL
+
+/**
+ * @brief Builds a reply in the caller's buffer (a batch slot that is sent
+ * as it is), without snprintf() or allocations. What does not fit is cut
+ * off, the result is always NUL terminated.
+ */
+typedef struct ReplyWriter {
+    char *out;
+    size_t size;        // bytes of out, the NUL included
+    size_t len;
+} ReplyWriter;
+
+/**
+ * @brief Starts an empty reply in out
+ */
+void reply_init(ReplyWriter *w, char *out, size_t size);
+
+/**
+ * @brief Goes on with the first len bytes of a reply already in out
+ */
+void reply_resume(ReplyWriter *w, char *out, size_t size, size_t len);
+
+/**
+ * @brief Appends len bytes of s
+ */
+void reply_append(ReplyWriter *w, const char *s, size_t len);
+
+// Appends a string literal, its length is known at compile time
+#define reply_literal(w, lit) reply_append((w), (lit), sizeof(lit) - 1)
+
+/**
+ * @brief Appends a NUL terminated string
+ */
+void reply_str(ReplyWriter *w, const char *s);
+
+/**
+ * @brief Appends a count in decimal
+ */
+void reply_u64(ReplyWriter *w, unsigned long long v);
+
+/**
+ * @brief Length of the reply, out[len] is its NUL
+ */
+size_t reply_len(const ReplyWriter *w);
+
+/**
+ * @brief Writes v in decimal, two digits per step, no NUL
+ *
+ * @param out room for U64_DIGITS_MAX bytes
+ * @return digits written
+ */
+size_t u64_to_ascii(unsigned long long v, char *out);
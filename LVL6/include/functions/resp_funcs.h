@@ -0,0 +1,49 @@
+#pragma once
+#include <sys/types.h>
+#include "../const.h"
+#include "stream_funcs.h"
+#include "parse_funcs.h"
+
+/*
+ * RESP (the Redis protocol) front-end on its own TCP port, -R/--resp-port,
+ * so redis-cli, redis-benchmark and the Redis client libraries can drive
+ * the bar. Requests are arrays of bulk strings, inline commands (one line
+ * of words) are accepted too, and any number of them may be pipelined.
+ *
+ *   ADD <atom> <amount>         :<atoms of that kind now>
+ *   DELIVER <molecule> <amount> :<amount>, or -ERR not enough atoms ...
+ *   ORDER <molecule> <amount> [<molecule> <amount> ...]
+ *                               :<molecules delivered>, all or nothing
+ *   GEN <drink>                 :<drinks the inventory makes>
+ *   HOLD <element> <amount> <ttl>
+ *                               :<hold id>, see hold_funcs.h
+ *   COMMIT <hold id>            +OK, or -ERR no such hold
+ *   RELEASE <hold id>           +OK, or -ERR no such hold
+ *   VERSION                     :<inventory version>
+ *   PING                        +PONG
+ *   COMMAND, CONFIG             *0 (what redis-cli and redis-benchmark ask first)
+ *
+ * Command and element names are case-insensitive ("GEN SOFT DRINK" may be
+ * one or two arguments). The text protocol ties ADD to streams and DELIVER
+ * (and ORDER) to datagrams, RESP is stream only, so here all are allowed.
+ *
+ * Any command but VERSION, PING and the introspection ones may end with
+ * IF_VERSION <version>:
+ * it runs only if the inventory is still at that version, otherwise the
+ * reply is -ERR version mismatch with the current one. RESP replies are
+ * typed, so the version is not appended to them, VERSION reads it.
+ */
+
+#define RESP_ARGS_MAX (3 + 2 * ORDER_ITEMS_MAX)    // a full conditional ORDER, more is malformed
+
+/**
+ * @brief Answers every complete RESP request at the start of buf, in
+ * order, with the same batching as stream_serve()
+ *
+ * @param batch settings and reply batch
+ * @param buf bytes received
+ * @param len bytes in buf
+ * @return bytes consumed (the rest is an incomplete request, less than
+ * MAXDATASIZE), STREAM_CLOSED or STREAM_MALFORMED
+ */
+ssize_t resp_serve(StreamBatch *batch, char *buf, size_t len);
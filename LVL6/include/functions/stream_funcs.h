@@ -0,0 +1,121 @@
+#pragma once
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "../const.h"
+#include "atom_warehouse_funcs.h"
+
+/*
+ * Framing of the TCP/UNIX stream clients, shared by every backend.
+ *
+ * Text commands end with '\n' ("\r\n" is accepted too), so a client can
+ * pipeline as many as it likes in one write and the server answers them
+ * in order. Binary frames (wire_funcs.h) carry their own length and can
+ * be mixed with the lines. A connection that never sent a newline keeps
+ * the old framing, one read is one text command, so clients written
+ * before the line framing still work.
+ *
+ * The replies of one read are gathered and leave with one writev()
+ * instead of one send() per command. With -I pipeline the commands of
+ * one read are all submitted to the apply thread, stream_settle() waits
+ * for them once before the replies leave.
+ */
+
+#define STREAM_REPLY_SIZE 256   // one text reply, the size process_message() gets
+#define STREAM_BATCH_MAX 64     // replies gathered into one writev(), below IOV_MAX
+
+// stream_serve() results besides the bytes it consumed
+#define STREAM_CLOSED    -1     // the flush callback closed the connection
+#define STREAM_MALFORMED -2     // bad binary header or a line of MAXDATASIZE bytes or more
+
+// What stream_settle() still does to a reply added with stream_add_pending()
+#define STREAM_REPLY_READY  0   // nothing, a reply added with stream_add_reply()
+#define STREAM_REPLY_LINE   1   // process_message() reply of a text line
+#define STREAM_REPLY_FRAMED 2   // the same on a line-framed connection
+#define STREAM_REPLY_RAW    3   // binary or RESP, calls[].len as it is
+
+struct StreamBatch;
+
+/**
+ * @brief Sends batch->count replies described by batch->iov
+ *
+ * @return 0 on success, -1 if the connection was closed
+ */
+typedef int (*StreamFlush)(struct StreamBatch *batch);
+
+/**
+ * @brief Replies waiting to be sent to one stream client, per reactor.
+ * The caller fills in the settings before stream_serve().
+ */
+typedef struct StreamBatch {
+    // settings of the current call
+    int fd;                         // the client, for the console messages
+    u_int8_t file_flag;             // passed on to process_message()
+    int storage_fd;
+    unsigned long long arrived;     // realtime_ns() arrival of the bytes being served
+    StreamFlush flush;
+    void *ctx;                      // the connection, for flush
+
+    // gathered replies
+    int count;
+    unsigned long long served;      // requests answered by stream_serve(), for the counters
+    struct iovec iov[STREAM_BATCH_MAX];
+    char replies[STREAM_BATCH_MAX][STREAM_REPLY_SIZE];
+
+    // replies still being written, by the apply thread with -I pipeline
+    u_int8_t waiting;
+    u_int8_t pending[STREAM_BATCH_MAX];     // STREAM_REPLY_*
+    MessageCall calls[STREAM_BATCH_MAX];
+} StreamBatch;
+
+/**
+ * @brief Answers every complete request at the start of buf, in order.
+ * Replies are flushed STREAM_BATCH_MAX at a time, the caller sends the
+ * rest with stream_flush() once it is done reading.
+ *
+ * @param batch settings and reply batch
+ * @param buf bytes received, buf[len] must be writable
+ * @param len bytes in buf
+ * @param framed the connection's line mode, set by its first newline
+ * @return bytes consumed (the rest is an incomplete request to keep for
+ * the next read, less than MAXDATASIZE), STREAM_CLOSED or STREAM_MALFORMED
+ */
+ssize_t stream_serve(StreamBatch *batch, char *buf, size_t len, u_int8_t *framed);
+
+/**
+ * @brief The slot the next reply is written to, flushes a full batch first
+ *
+ * @return the slot (STREAM_REPLY_SIZE bytes), NULL if the connection was closed
+ */
+char *stream_reply_slot(StreamBatch *batch);
+
+/**
+ * @brief Adds the reply written to the slot to the batch
+ *
+ * @param len bytes of the reply
+ */
+void stream_add_reply(StreamBatch *batch, size_t len);
+
+/**
+ * @brief Adds a reply that is still being written to the next slot,
+ * flushes a full batch first. The caller hands the returned call to
+ * message_submit() (or sets its len itself), stream_settle() takes the
+ * length once it ran.
+ *
+ * @param how STREAM_REPLY_LINE, STREAM_REPLY_FRAMED or STREAM_REPLY_RAW
+ * @return the call of the slot, whose reply is batch->replies[call - batch->calls],
+ * NULL if the connection was closed
+ */
+MessageCall *stream_add_pending(StreamBatch *batch, u_int8_t how);
+
+/**
+ * @brief Waits once for every pending reply of the batch (pipeline_wait())
+ * and completes them. stream_serve() and stream_flush() call it.
+ */
+void stream_settle(StreamBatch *batch);
+
+/**
+ * @brief Sends the gathered replies and records their latency
+ *
+ * @return 0 on success, -1 if the connection was closed
+ */
+int stream_flush(StreamBatch *batch);
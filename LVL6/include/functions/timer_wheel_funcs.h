@@ -0,0 +1,90 @@
+#pragma once
+#include <sys/types.h>
+#include "../const.h"
+
+#define WHEEL_TICK_MS 10                        // resolution of every timer
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)           // slots per level, one bit each in 'occupied'
+#define WHEEL_LEVELS 4                          // 64^4 ticks, about 46 hours, longer timers are re-cascaded
+
+struct Timer;
+struct TimerWheel;
+
+/**
+ * @brief A timer, embedded in whatever it times out. Armed timers sit in
+ * one slot list of the wheel, so adding and removing one is O(1).
+ */
+typedef struct Timer {
+    unsigned long long expires;     // tick the timer fires at
+    struct Timer *prev, *next;      // slot list
+    u_int8_t armed;
+    u_int8_t level, slot;
+    void (*on_expire)(struct TimerWheel *w, struct Timer *t);
+    void *data;                     // owner of the timer
+} Timer;
+
+/**
+ * @brief Hierarchical timer wheel of one reactor, driven by a single timerfd.
+ * Level 0 holds the timers of the next 64 ticks one slot per tick, every
+ * level above covers 64 times the span of the one below and is cascaded
+ * down whenever the lower level wraps. The timerfd is armed for the next
+ * non-empty slot (or cascade), an idle wheel does not wake the reactor.
+ */
+typedef struct TimerWheel {
+    int fd;                                         // timerfd, CLOCK_MONOTONIC
+    unsigned long long now;                         // last processed tick
+    Timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    unsigned long long occupied[WHEEL_LEVELS];      // bit s set while slots[level][s] is not empty
+    int count;                                      // armed timers
+    unsigned long long armed_tick;                  // tick the timerfd fires at, 0 when disarmed
+    u_int8_t running;                               // inside wheel_expire(), it re-arms the timerfd itself
+    u_int8_t fired;                                 // the timerfd expired, reset by the reactor
+} TimerWheel;
+
+/**
+ * @brief Milliseconds of CLOCK_MONOTONIC, the clock of every wheel
+ */
+unsigned long long monotonic_ms(void);
+
+/**
+ * @brief Creates the timerfd of a wheel
+ *
+ * @param w the wheel to initialize
+ * @return 0 on success, -1 on failure (errno is set)
+ */
+int wheel_init(TimerWheel *w);
+
+/**
+ * @brief Prepares a timer, does not arm it
+ *
+ * @param t the timer
+ * @param on_expire called from wheel_expire() once the timer is due, it is
+ * already disarmed and may re-add itself to the wheel it gets
+ * @param data owner, for the callback
+ */
+void timer_init(Timer *t, void (*on_expire)(struct TimerWheel *w, Timer *t), void *data);
+
+/**
+ * @brief Arms (or re-arms) a timer to fire in the given number of milliseconds
+ *
+ * @param w the wheel of the calling reactor
+ * @param t the timer
+ * @param ms delay, rounded up to WHEEL_TICK_MS
+ */
+void timer_add(TimerWheel *w, Timer *t, unsigned long long ms);
+
+/**
+ * @brief Disarms a timer, nothing happens if it is not armed
+ */
+void timer_del(TimerWheel *w, Timer *t);
+
+/**
+ * @brief Called when the timerfd is readable: runs every timer that is due
+ * and re-arms the timerfd for the next one
+ */
+void wheel_expire(TimerWheel *w);
+
+/**
+ * @brief Closes the timerfd, armed timers are forgotten
+ */
+void wheel_destroy(TimerWheel *w);
@@ -0,0 +1,140 @@
+#pragma once
+#ifdef HAVE_IO_URING
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "../const.h"
+#include "atom_warehouse_funcs.h"
+#include "timer_wheel_funcs.h"
+
+#define URING_ENTRIES   256     // submission queue size
+#define URING_BUF_COUNT 512     // provided buffers, must be a power of 2
+#define URING_BUF_SIZE  512     // recvmsg header + peer address + control + payload fit in one buffer
+#define URING_BGID      1       // buffer group id of the provided buffer ring
+#define URING_CONTROL_SIZE 32   // recvmsg control space, CMSG_SPACE() of the SO_TIMESTAMPNS timespec
+#define URING_PARTIAL_MAX MAXDATASIZE    // RECV data[], holds a request split over completions
+
+// What a submission is for, stored in the op that user_data points to
+#define URING_OP_ACCEPT   0     // multishot accept on a stream listener
+#define URING_OP_RECV     1     // multishot recv on a connected stream client
+#define URING_OP_RECVMSG  2     // multishot recvmsg on a datagram socket
+#define URING_OP_SEND     3     // reply to a stream client
+#define URING_OP_SENDMSG  4     // reply to a datagram peer
+#define URING_OP_TIMER    5     // timerfd readiness
+#define URING_OP_WRITE    6     // storage file snapshot
+#define URING_OP_WAREHOUSE_TIMER 7  // readiness of warehouse_wheel's timerfd
+
+/**
+ * @brief State of one in-flight (or persistent multishot) submission.
+ * Replies carry their payload in data[] so it outlives the handler
+ * that produced it, until the kernel reports the send as complete.
+ * A stream client has at most one SEND in flight, so its replies reach
+ * the socket in order; what it answers meanwhile waits in out.
+ */
+typedef struct UringOp {
+    u_int8_t type;                  // URING_OP_*
+    u_int8_t kind;                  // HANDLER_* of the fd
+    int fd;
+    struct msghdr msg;              // RECVMSG / SENDMSG
+    struct iovec iov;               // SENDMSG
+    struct sockaddr_storage addr;   // SENDMSG destination
+    Timer idle;                     // RECV, -i/--idle-timeout
+    unsigned long long last_active; // RECV, monotonic_ms() of the last request
+    u_int8_t transport;             // RECV, HANDLER_*_LISTEN the client came from
+    u_int8_t framed;                // RECV, the client sent a newline (stream_funcs.h)
+    u_int8_t closing;               // RECV, the recv ended, closed once its SEND completes
+    u_int8_t dropped;               // RECV, passed CONN_OUTBUF_MAX, later replies are discarded
+    struct UringOp *sending;        // RECV: its one SEND in flight. SEND: the client it answers
+    char *out;                      // RECV, replies waiting for the SEND in flight
+    size_t out_len, out_cap;        // RECV, at most CONN_OUTBUF_MAX
+    size_t len;                     // bytes in data[] (RECV: of an incomplete request)
+    char data[];
+} UringOp;
+
+typedef struct UringLoop {
+    int ring_fd;
+
+    // submission queue, shared with the kernel
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_entries;
+    unsigned to_submit;             // queued but not yet handed to io_uring_enter()
+
+    // completion queue, shared with the kernel
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+
+    // provided buffer ring used by the multishot receives
+    struct io_uring_buf_ring *buf_ring;
+    char *bufs;
+    u_int16_t buf_tail;
+
+    // storage persistence, one snapshot write in flight over all the rings
+    int storage_fd;
+    u_int8_t persist;               // -f was given
+    AtomStorage snapshot;
+    unsigned long long snapshot_generation;
+    u_int8_t write_pending;         // the in-flight snapshot write is this ring's
+
+    TimerWheel *wheel;              // timers of this reactor, set by the owner
+} UringLoop;
+
+/**
+ * @brief Sets up the rings and registers the provided buffer ring
+ *
+ * @param ring the loop to initialize
+ * @param storage_fd storage file written through the ring, -1 for none
+ * @param persist whether the storage file is in use (-f)
+ * @return 0 on success, -1 on failure (errno is set)
+ */
+int uring_init(UringLoop *ring, int storage_fd, u_int8_t persist);
+
+/**
+ * @brief Arms the submission that watches one of the server's own fds:
+ * multishot accept for listeners, multishot recvmsg for datagram sockets
+ * and a poll for the timerfd. Exits the process on allocation failure.
+ *
+ * @param ring the loop
+ * @param fd the file descriptor
+ * @param kind HANDLER_* tag
+ */
+void uring_register_server_fd(UringLoop *ring, int fd, u_int8_t kind);
+
+/**
+ * @brief Submits every queued request, waits for at least one completion
+ * and handles all the available completions in one pass.
+ *
+ * @param wait 0 only reaps what is already there (--low-latency spinning)
+ * @return number of handled completions, -1 on failure
+ */
+int uring_run_once(UringLoop *ring, u_int8_t wait);
+
+/**
+ * @brief Stops issuing storage writes from every ring and waits until the
+ * one in flight completed, so a synchronous write made afterwards is the
+ * last one to land. Called by the shutdown path.
+ */
+void uring_quiesce(UringLoop *ring);
+
+/**
+ * @brief Writes the warehouse to the storage file from outside the rings
+ * (admin FLUSH): waits for the rings' write in flight, then writes and
+ * marks the generation written as that one write, under warehouse_call().
+ * The file lock the server holds stays as it is.
+ *
+ * @param fd the storage file
+ * @param generation receives the generation written
+ * @return 0 once synced, -1 on failure or during shutdown (errno is set)
+ */
+int uring_flush_storage(int fd, unsigned long long *generation);
+
+/**
+ * @brief Unmaps the rings and closes the ring fd
+ */
+void uring_destroy(UringLoop *ring);
+
+#endif
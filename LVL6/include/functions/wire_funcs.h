@@ -0,0 +1,104 @@
+#pragma once
+#include <sys/types.h>
+#include "../const.h"
+
+/*
+ * Binary wire protocol, spoken on the same TCP/UDP/UNIX ports as the text
+ * commands. A binary message starts with WIRE_MAGIC, which no text command
+ * starts with, so the server tells them apart by the first byte.
+ *
+ * Every field is in network byte order:
+ *
+ *   offset size
+ *        0    1  magic       WIRE_MAGIC
+ *        1    1  version     WIRE_VERSION
+ *        2    2  length      bytes in the whole frame, header included
+ *        4    1  opcode      WIRE_OP_*, replies have WIRE_OP_REPLY set
+ *        5    1  element     Element code (elements.h)
+ *        6    2  status      WIRE_* status, 0 in requests
+ *        8    4  request_id  chosen by the client, echoed in the reply
+ *       12    4  timeout_ms  requests: milliseconds the request may wait in the server, 0 for no limit
+ *       16    8  amount      atoms to add, molecules to deliver, drinks GEN can make
+ *
+ * A request is the header alone, or the header and the 8-byte inventory
+ * version it is conditional on (IF_VERSION, WIRE_ERR_VERSION when the
+ * inventory moved on). A reply adds the inventory after the operation,
+ * three 8-byte counts: carbon, oxygen, hydrogen, then its version.
+ */
+
+#define WIRE_MAGIC 0xB1             // not ASCII, never the first byte of a text command
+#define WIRE_VERSION 2             // 2: replies carry the inventory version
+#define WIRE_HEADER_SIZE 24
+#define WIRE_IF_VERSION_SIZE (WIRE_HEADER_SIZE + 8)
+#define WIRE_REPLY_SIZE (WIRE_HEADER_SIZE + 4 * 8)
+#define WIRE_FRAME_MAX WIRE_REPLY_SIZE
+
+// Opcodes
+#define WIRE_OP_ADD      1          // stream transports only, like the text ADD
+#define WIRE_OP_DELIVER  2          // datagram transports only, like the text DELIVER
+#define WIRE_OP_GEN      3          // how many of a drink the inventory makes, any transport
+#define WIRE_OP_REPLY    0x80
+
+// Reply status
+#define WIRE_OK              0
+#define WIRE_ERR_FORMAT      1      // bad version, length or opcode
+#define WIRE_ERR_ELEMENT     2      // element not valid for the opcode
+#define WIRE_ERR_NOT_ENOUGH  3      // DELIVER, the inventory is short
+#define WIRE_ERR_TRANSPORT   4      // ADD over a datagram socket, DELIVER over a stream
+#define WIRE_ERR_VERSION     5      // IF_VERSION request, the inventory has another version
+
+/**
+ * @brief A decoded binary request or reply, in host byte order
+ */
+typedef struct WireMessage {
+    u_int8_t opcode;
+    u_int8_t element;
+    u_int16_t status;
+    u_int32_t request_id;
+    u_int32_t timeout_ms;                           // requests only, 0 for no limit
+    unsigned long long amount;
+    u_int8_t has_if_version;                        // requests only, conditional on if_version
+    unsigned long long if_version;
+    unsigned long long carbon, oxygen, hydrogen;    // replies only
+    unsigned long long version;                     // replies only, the inventory version
+} WireMessage;
+
+/**
+ * @brief Whether a message is binary, decided by its first byte
+ */
+int wire_is_binary(const char *buf, size_t len);
+
+/**
+ * @brief Length of the frame at the start of a stream buffer
+ *
+ * @return the frame length, 0 if the header is not complete yet,
+ * -1 if the header is malformed (the stream cannot be resynchronized)
+ */
+ssize_t wire_frame_length(const char *buf, size_t len);
+
+/**
+ * @brief The timeout_ms of a request, read straight from its header
+ *
+ * @param buf a frame of at least WIRE_HEADER_SIZE bytes
+ */
+u_int32_t wire_request_timeout(const char *buf);
+
+/**
+ * @brief Encodes a request (header, and the IF_VERSION if has_if_version)
+ * or, when opcode has WIRE_OP_REPLY, a reply with the inventory
+ *
+ * @return bytes written, 0 if out_size is too small
+ */
+size_t wire_encode(const WireMessage *msg, char *out, size_t out_size);
+
+/**
+ * @brief Decodes one complete frame
+ *
+ * @return 0 on success, -1 on a malformed frame
+ */
+int wire_decode(const char *buf, size_t len, WireMessage *msg);
+
+/**
+ * @brief Human readable WIRE_* status
+ */
+const char *wire_status_str(u_int16_t status);
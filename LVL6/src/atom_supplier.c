@@ -18,6 +18,7 @@
 #include <arpa/inet.h>  // Functions for manipulating IP addresses (inet_ntop, etc.)
 #include "../include/const.h"
 #include "../include/functions/atom_supplier_funcs.h"
+#include "../include/functions/wire_funcs.h"
 #include <unistd.h>
 #include <getopt.h>
 #include <sys/un.h>
@@ -34,6 +35,8 @@ const char* PATH; // Path for the AF_UNIX prot
 int flag_f = 0;
 int flag_h = 0;
 int flag_p = 0;
+int flag_b = 0;     // -b, speak the binary protocol
+u_int32_t timeout_ms = 0;   // -t, the server drops the request after this many ms, 0 for never
 
 int main(int argc, char *argv[])
 {
@@ -48,13 +51,13 @@ int main(int argc, char *argv[])
 
     // Check if all the needed args was provided as a command-line argument
     if (argc < 3) {
-        fprintf(stderr,"usage: ./atom_supplier.out -h <IP/hostname> -p <port> OR -f <UDS socket file path>\n");
+        fprintf(stderr,"usage: ./atom_supplier.out -h <IP/hostname> -p <port> OR -f <UDS socket file path> (OPTIONAL: -b binary protocol, -t <ms> timeout)\n");
         exit(1);
     }
 
 
     // check then option you got from the user:
-    int ret = getopt(argc, argv, ":p:h:f:");
+    int ret = getopt(argc, argv, ":p:h:f:bt:");
     char *endptr; // for checking if the value is digit
     long val = 0;
 
@@ -104,8 +107,16 @@ int main(int argc, char *argv[])
                 PATH = optarg;
                 break;
             }
+            case 'b': {
+                flag_b = 1;
+                break;
+            }
+            case 't': {
+                timeout_ms = parse_timeout_arg(optarg);
+                break;
+            }
         }
-        ret = getopt(argc, argv, ":p:h:f:");
+        ret = getopt(argc, argv, ":p:h:f:bt:");
     }
 
     if((flag_p !=1 && flag_h ==1) || (flag_h != 1 && flag_p ==1)){
@@ -195,50 +206,80 @@ int main(int argc, char *argv[])
         char atom[10];
         ask_supplier(&amount, atom, sizeof(atom));
 
-        // Format the message to send to server: ADD {atom} {amount}
+        // Format the message to send to server: ADD {atom} {amount}, or its binary frame
         char send_buf[MAXDATASIZE];
-        snprintf(send_buf, MAXDATASIZE, "ADD %s %llu", atom, amount);
+        size_t send_len;
+        if (timeout_ms) {
+            snprintf(send_buf, MAXDATASIZE, "ADD %s %llu TIMEOUT_MS %u", atom, amount, timeout_ms);
+            set_reply_timeout(sockfd, timeout_ms);
+        } else {
+            snprintf(send_buf, MAXDATASIZE, "ADD %s %llu", atom, amount);
+        }
+        char request[MAXDATASIZE];
+        strcpy(request, send_buf);
+        if (flag_b) {
+            send_len = encode_wire_request(WIRE_OP_ADD, atom, amount, timeout_ms, send_buf, sizeof(send_buf));
+        } else {
+            send_len = strlen(send_buf);
+        }
+        // a binary reply has a fixed size, wait for all of it
+        int recv_flags = flag_b ? MSG_WAITALL : 0;
+        size_t recv_len = flag_b ? WIRE_REPLY_SIZE : MAXDATASIZE-1;
 
     
 
         if(flag_h && flag_p){
         // Send the formatted request to server
-        if (send(sockfd, send_buf, strlen(send_buf), 0) == -1) {
+        if (send(sockfd, send_buf, send_len, 0) == -1) {
             perror("send");
             close(sockfd);
             exit(1);
         }
 
-        printf("client: sent request --> '%s'\n", send_buf);
+        printf("client: sent %srequest --> '%s'\n", flag_b ? "binary " : "", request);
 
         // Receive data from the server
-        if ((numbytes = recv(sockfd, buf, MAXDATASIZE-1, 0)) == -1) {
+        if ((numbytes = recv(sockfd, buf, recv_len, recv_flags)) == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                printf("client: no reply within %u ms, giving up\n", timeout_ms);
+                exit(1);
+            }
             perror("recv");
             exit(1);
         }
 
         // Null-terminate the received data to make it a valid string
     } else if(flag_f){
-        if (write(sockfd, send_buf, strlen(send_buf)) == -1) {
+        if (write(sockfd, send_buf, send_len) == -1) {
             perror("write");
             close(sockfd);
             exit(1);
         }
 
-        printf("client: sent request --> '%s'\n", send_buf);
+        printf("client: sent %srequest --> '%s'\n", flag_b ? "binary " : "", request);
 
         // Signal EOF to the server (no more data will be sent)
         shutdown(sockfd, SHUT_WR);
 
         // Receive data from the server
-        if ((numbytes = read(sockfd, buf, MAXDATASIZE-1)) == -1) {
+        if ((numbytes = recv(sockfd, buf, recv_len, recv_flags)) == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                printf("client: no reply within %u ms, giving up\n", timeout_ms);
+                exit(1);
+            }
             perror("read");
             exit(1);
         }
     }
     buf[numbytes] = '\0';
+    if (flag_b) {
+        char text[MAXDATASIZE * 2];
+        format_wire_reply(buf, numbytes, text, sizeof(text));
+        printf("client: received '%s'\n", text);
+    } else {
     // Print the message received from the server
     printf("client: received '%s'\n", buf);
+    }
 
     // Clean up by closing the socket
     close(sockfd);
@@ -33,6 +33,13 @@
 #include <ctype.h>
 #include "../include/const.h"
 #include "../include/functions/atom_warehouse_funcs.h"
+#include "../include/functions/event_loop_funcs.h"
+#include "../include/functions/drinks_bar_funcs.h"
+#include "../include/functions/uring_loop_funcs.h"
+#include "../include/functions/admin_funcs.h"
+#include "../include/functions/latency_funcs.h"
+#include "../include/functions/hold_funcs.h"
+#include "../include/functions/backorder_funcs.h"
 #include <poll.h>
 #include <unistd.h>
 #include <getopt.h>
@@ -40,6 +47,9 @@
 #include <fcntl.h>   // open
 #include <sys/stat.h>  // level of access to files
 #include <sys/file.h>  // flock
+#include <pthread.h>
+#include <limits.h>
+#include <sys/resource.h>  // RLIMIT_NOFILE
 
 // for get opt
 extern char *optarg;
@@ -52,23 +62,31 @@ char* UNIX_TCP_SOCKET_PATH = NULL;
 char* UNIX_UDP_SOCKET_PATH = NULL;
 char* STORAGE_FILE = 0;
 
-// alarm value
+// inactivity timeout of the whole server in seconds, -t (0 = never)
 extern int alarm_timeout;
 
-// flag for storage file
-u_int8_t file_flag = 0;
+// admin control socket, -a/--admin-path
+char* ADMIN_SOCKET_PATH = NULL;
+
+// RESP listener, -R/--resp-port (NULL = none)
+char* RESP_PORT = NULL;
 
 // flags for -o -h -c
 unsigned long long oxygen_input = 0;
 unsigned long long hydrogen_input = 0;
 unsigned long long carbon_input = 0;
 
+// Both the missing-arguments check and getopt print this one
+static void print_usage(void){
+    fprintf(stderr,"usage: ./drinks_bar.out -T/--tcp-port <int> -U/--udp-port <int> -s/--stream-path <UDS stream file path> -d/--datagram-path <UDS datagram filepath> (OPTIONAL: -o/--oxygen <int=0> -c/--carbon <int=0> -h/--hydrogen <int=0> -t/--timeout <int=0> -f/--save-file <storage file path> -b/--backend <poll|epoll|uring> -n/--threads <int=cores> -m/--dgram-batch <int=32> -l/--backlog <int=SOMAXCONN> -C/--max-clients <int=0 (no limit)> -i/--idle-timeout <int=0> -a/--admin-path <admin UDS stream file path> -L/--low-latency -P/--cpus <list e.g. 2,3,6-9> -B/--busy-poll <usec=50> -R/--resp-port <int> -I/--inventory <lock-free|combining|mutex|pipeline|partitioned>)\n");
+}
+
 int main(int argc, char*argv[])
 {
 
      // Check if port was provided as a command-line argument
      if (argc < 4) {
-        fprintf(stderr,"usage: ./drinks_bar.out -T/--tcp-port <int> -U/--udp-port <int> -s/--stream-path <UDS stream file path> -d/--datagram-path <UDS datagram filepath> (OPTIONAL: -o/--oxygen <int=0> -c/--carbon <int=0> -h/--hydrogen <int=0> -t/--timeout <int=0>\n");
+        print_usage();
         exit(1);
     }
 
@@ -82,11 +100,23 @@ int main(int argc, char*argv[])
         {"stream-path",optional_argument,NULL,'s'},
         {"datagram-path",optional_argument,NULL,'d'},
         {"save-file",optional_argument,NULL,'f'},
+        {"backend",required_argument,NULL,'b'},
+        {"threads",required_argument,NULL,'n'},
+        {"dgram-batch",required_argument,NULL,'m'},
+        {"backlog",required_argument,NULL,'l'},
+        {"max-clients",required_argument,NULL,'C'},
+        {"idle-timeout",required_argument,NULL,'i'},
+        {"admin-path",required_argument,NULL,'a'},
+        {"low-latency",no_argument,NULL,'L'},
+        {"cpus",required_argument,NULL,'P'},
+        {"busy-poll",required_argument,NULL,'B'},
+        {"resp-port",required_argument,NULL,'R'},
+        {"inventory",required_argument,NULL,'I'},
         {0,0,0,0}
     };
 
     // check then option you got from the user:
-    int ret = getopt_long(argc, argv, ":U:T:d:s:o:c:h:t:f:", longopts, NULL);
+    int ret = getopt_long(argc, argv, ":U:T:d:s:o:c:h:t:f:b:n:m:l:C:i:a:LP:B:R:I:", longopts, NULL);
     char *endptr; // for checking if the value is digit
     long val = 0;
 
@@ -196,11 +226,171 @@ int main(int argc, char*argv[])
                 alarm_timeout = (int)val;
                 break;
             }
+            case 'b': {
+                if (optarg == NULL) {
+                    fprintf(stderr, "ERROR: Missing argument for option -%c\n", ret);
+                    exit(1);
+                }
+                if (loop_backend_from_str(optarg, &loop_backend) == -1) {
+                    fprintf(stderr,"ERROR: Invalid argument for Backend (poll|epoll|uring)\n");
+                    exit(1);
+                }
+                break;
+            }
+            case 'n': {
+                if (optarg == NULL) {
+                    fprintf(stderr, "ERROR: Missing argument for option -%c\n", ret);
+                    exit(1);
+                }
+                val = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || val <= 0 || val > 1024) {
+                    fprintf(stderr,"ERROR: Invalid argument for Threads\n");
+                    exit(1);
+                }
+                reactor_count = (int)val;
+                break;
+            }
+            case 'm': {
+                if (optarg == NULL) {
+                    fprintf(stderr, "ERROR: Missing argument for option -%c\n", ret);
+                    exit(1);
+                }
+                val = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || val <= 0 || val > DGRAM_BATCH_MAX) {
+                    fprintf(stderr,"ERROR: Invalid argument for Datagram batch (1-%d)\n", DGRAM_BATCH_MAX);
+                    exit(1);
+                }
+                dgram_batch = (int)val;
+                break;
+            }
+            case 'l': {
+                if (optarg == NULL) {
+                    fprintf(stderr, "ERROR: Missing argument for option -%c\n", ret);
+                    exit(1);
+                }
+                val = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || val <= 0 || val > 65535) {
+                    fprintf(stderr,"ERROR: Invalid argument for Backlog\n");
+                    exit(1);
+                }
+                listen_backlog = (int)val;
+                break;
+            }
+            case 'C': {
+                if (optarg == NULL) {
+                    fprintf(stderr, "ERROR: Missing argument for option -%c\n", ret);
+                    exit(1);
+                }
+                val = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || val < 0 || val > INT_MAX) {
+                    fprintf(stderr,"ERROR: Invalid argument for Max clients\n");
+                    exit(1);
+                }
+                max_clients = (int)val;
+                break;
+            }
+            case 'i': {
+                if (optarg == NULL) {
+                    fprintf(stderr, "ERROR: Missing argument for option -%c\n", ret);
+                    exit(1);
+                }
+                val = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || val < 0 || val > INT_MAX) {
+                    fprintf(stderr,"ERROR: Invalid argument for Idle timeout\n");
+                    exit(1);
+                }
+                idle_timeout = (int)val;
+                break;
+            }
+            case 'a': {
+                if (optarg == NULL) {
+                    fprintf(stderr, "ERROR: Missing argument for option -%c\n", ret);
+                    exit(1);
+                }
+                ADMIN_SOCKET_PATH = optarg;
+                break;
+            }
+            case 'L': {
+                low_latency = 1;
+                break;
+            }
+            case 'P': {
+                if (optarg == NULL) {
+                    fprintf(stderr, "ERROR: Missing argument for option -%c\n", ret);
+                    exit(1);
+                }
+                if (parse_cpu_list(optarg) == -1) {
+                    fprintf(stderr,"ERROR: Invalid argument for CPUs (e.g. 2,3,6-9)\n");
+                    exit(1);
+                }
+                break;
+            }
+            case 'B': {
+                if (optarg == NULL) {
+                    fprintf(stderr, "ERROR: Missing argument for option -%c\n", ret);
+                    exit(1);
+                }
+                val = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || val < 0 || val > INT_MAX) {
+                    fprintf(stderr,"ERROR: Invalid argument for Busy poll\n");
+                    exit(1);
+                }
+                busy_poll_usec = (int)val;
+                break;
+            }
+            case 'R': {
+                if (optarg == NULL) {
+                    fprintf(stderr, "ERROR: Missing argument for option -%c\n", ret);
+                    exit(1);
+                }
+                val = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || val <= 0 || val > 65535) {
+                    fprintf(stderr,"ERROR: Invalid argument for RESP PORT\n");
+                    exit(1);
+                }
+                RESP_PORT = optarg;
+                break;
+            }
+            case 'I': {
+                if (optarg == NULL) {
+                    fprintf(stderr, "ERROR: Missing argument for option -%c\n", ret);
+                    exit(1);
+                }
+                if (inventory_mode_from_str(optarg, &warehouse_inventory) == -1) {
+                    fprintf(stderr,"ERROR: Invalid argument for Inventory (lock-free|combining|mutex|pipeline|partitioned)\n");
+                    exit(1);
+                }
+                break;
+            }
             default:
-                fprintf(stderr,"ERROR: usage: ./drinks_bar.out -T/--tcp-port <int> -U/--udp-port <int> (OPTIONAL: -o/--oxygen <int=0> -c/--carbon <int=0> -h/--hydrogen <int=0> -t/--timeout <int=0>\n");
+                fprintf(stderr,"ERROR: ");
+                print_usage();
                 exit(1);
         }
-        ret = getopt_long(argc, argv, ":U:T:d:s:o:c:h:t:f:", longopts, NULL);
+        ret = getopt_long(argc, argv, ":U:T:d:s:o:c:h:t:f:b:n:m:l:C:i:a:LP:B:R:I:", longopts, NULL);
+    }
+
+    // Every client costs an fd, allow as many as the hard limit permits
+    struct rlimit nofile;
+    if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur < nofile.rlim_max) {
+        nofile.rlim_cur = nofile.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &nofile) == -1) {
+            perror("setrlimit");
+        }
+    }
+
+    // --low-latency without -P pins to the CPUs the process may use
+    if (low_latency && pin_cpu_count == 0 && allowed_cpu_list() == -1) {
+        perror("sched_getaffinity");
+    }
+
+    // one reactor per pinned CPU (-P) or per core unless told otherwise
+    if (reactor_count == 0 && pin_cpu_count > 0) {
+        reactor_count = pin_cpu_count;
+    }
+    if (reactor_count == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        reactor_count = cores > 0 ? (int)cores : 1;
     }
 
     // if file flag is on, chec if file exists
@@ -212,28 +402,28 @@ int main(int argc, char*argv[])
     // * <CARBON> <OXYGEN> <HYDROGEN>  *
     // *                               *
     // *********************************
-    int fd = open(STORAGE_FILE, O_RDWR, S_IRUSR | S_IWUSR);
+    storage_fd = open(STORAGE_FILE, O_RDWR, S_IRUSR | S_IWUSR);
     if(file_flag){
-        if(fd != -1){ // IF FILE EXISTS
-            int reader = read(fd, &warehouse, sizeof(AtomStorage));
+        if(storage_fd != -1){ // IF FILE EXISTS
+            int reader = read(storage_fd, &warehouse, sizeof(AtomStorage));
 
             // FILE EXISTS BUT NO INPUT
             if( reader <= 0){
                 fprintf(stderr,"ERROR: FILE EXISTS, NO INPUT\n");
-                close(fd);
+                close(storage_fd);
                 exit(1);
             }
 
             // IF NO STRUCT SIZE, WRONG FORMAT, ERROR
             if (reader != sizeof(AtomStorage)) {
                 fprintf(stderr,"ERROR: WRONG FORMAT\n");
-                close(fd);
+                close(storage_fd);
                 return 0;
             }
 
         }else{ // FILE DOESNT EXISTS, CREATE IT AND UPDATE ITS FIELD
             fprintf(stdout,"WARNING: File: %s, creating file and storing storage predefined input",STORAGE_FILE);
-            fd = open(STORAGE_FILE, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+            storage_fd = open(STORAGE_FILE, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
 
             // UPDATE THE CURRENT STORAGE FROM USER INPUT
             warehouse.carbon = carbon_input;
@@ -241,21 +431,21 @@ int main(int argc, char*argv[])
             warehouse.hydrogen =  hydrogen_input;
 
             // LOCK THE FILE, IF ERROR, END PROCCESS
-            if (flock(fd, LOCK_EX) == -1){
+            if (flock(storage_fd, LOCK_EX) == -1){
                 perror("server flock");
-                close(fd);
+                close(storage_fd);
                 exit(1);
             }
 
             // CHECK FOR WRITE ISSUES
-            if(write(fd, &warehouse, sizeof(AtomStorage)) == -1){
+            if(write(storage_fd, &warehouse, sizeof(AtomStorage)) == -1){
                 perror("server write");
-                close(fd);
+                close(storage_fd);
                 exit(1);
             }
 
             // UNLOCK THE LOCK
-            flock(fd, LOCK_UN);
+            flock(storage_fd, LOCK_UN);
         }
     }else{
         // No file flag, only user input
@@ -264,97 +454,12 @@ int main(int argc, char*argv[])
         warehouse.hydrogen =  hydrogen_input;
     }
 
-    // Socket file descriptors
-    int tcp_sockfd, new_fd;  // sockfd = listening socket, new_fd = client connection socket
-    
-    // Network address structures for server setup
-    struct addrinfo tcp_hints, *tcp_servinfo, *tcp_p;  // hints = criteria, servinfo = results list, p = iterator
-    struct sockaddr_storage their_addr;    // Storage for client's address information
-    socklen_t sin_size;                    // Size of client address structure
-    
-    
-    // Socket options and utility variables
-    char s[INET6_ADDRSTRLEN];    // Buffer to store client IP address as string
-    int rv;                      // Return value for getaddrinfo()
-
-    // STEP 1: Configure server address criteria
-    memset(&tcp_hints, 0, sizeof tcp_hints);
-    tcp_hints.ai_family = AF_INET;      // Use IPv4
-    tcp_hints.ai_socktype = SOCK_STREAM; // Use TCP (reliable, connection-oriented)
-    tcp_hints.ai_flags = AI_PASSIVE;    // Use local machine's IP address
-
-    // STEP 2: Get list of possible addresses to bind to
-    if ((rv = getaddrinfo(NULL, TCP_PORT, &tcp_hints, &tcp_servinfo)) != 0) {
-        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
-        return 1;
-    }
-
-
-    // STEP 3: Try to create socket and bind to first available address
-    for(tcp_p = tcp_servinfo; tcp_p != NULL; tcp_p = tcp_p->ai_next) {
-        // Create socket with the address family, type, and protocol
-        if ((tcp_sockfd = socket(tcp_p->ai_family, tcp_p->ai_socktype, tcp_p->ai_protocol)) == -1) {
-            perror("server: socket");
-            continue;  // Try next address if socket creation fails
-        }
-
-        // Bind socket to the address and port
-        if (bind(tcp_sockfd, tcp_p->ai_addr, tcp_p->ai_addrlen) == -1) {
-            close(tcp_sockfd);
-            perror("server: bind");
-            continue;  // Try next address if bind fails
-        }
-
-        break;  // Success! Exit the loop
-    }
-
-    freeaddrinfo(tcp_servinfo); // Clean up the address list
-
-    // Check if we successfully bound to an address
-    if (tcp_p == NULL)  {
-        fprintf(stderr, "server: failed to bind\n");
-        exit(1);
-    }
-
-    // STEP 4: Start listening for client connections
-    if (listen(tcp_sockfd, BACKLOG) == -1) {
-        perror("listen");
-        exit(1);
-    }
-
-    // Create UDP socket, same as above TCP configuration
-    int udp_sockfd;
-    struct addrinfo udp_hints, *udp_servinfo, *udp_p;
-    memset(&udp_hints, 0, sizeof udp_hints);
-    udp_hints.ai_family = AF_INET;
-    udp_hints.ai_socktype = SOCK_DGRAM;
-    udp_hints.ai_flags = AI_PASSIVE;
-
-    if ((rv = getaddrinfo(NULL, UDP_PORT, &udp_hints, &udp_servinfo)) != 0) {
-        fprintf(stderr, "getaddrinfo (UDP): %s\n", gai_strerror(rv));
+    // The rings persist their own batches (-b uring), the apply thread the others
+    if (warehouse_inventory_init(loop_backend == LOOP_URING ? 0 : file_flag, storage_fd, reactor_count) == -1) {
+        perror("pipeline apply thread");
         exit(1);
     }
 
-    for(udp_p = udp_servinfo; udp_p != NULL; udp_p = udp_p->ai_next) {
-        if ((udp_sockfd = socket(udp_p->ai_family, udp_p->ai_socktype, udp_p->ai_protocol)) == -1) {
-            perror("server: udp socket");
-            continue;
-        }
-        if (bind(udp_sockfd, udp_p->ai_addr, udp_p->ai_addrlen) == -1) {
-            close(udp_sockfd);
-            perror("server: udp bind");
-            continue;
-        }
-        break;
-    }
-    freeaddrinfo(udp_servinfo);
-
-    if (udp_p == NULL) {
-        fprintf(stderr, "server: failed to bind UDP socket\n");
-        exit(1);
-    }
-
-    int unix_tcp_sockfd;
     // UNIX DOMAIN SOCKETS CREATION
     if(UNIX_TCP_SOCKET_PATH != NULL){
     // START TCP UNIX DS
@@ -380,15 +485,17 @@ int main(int argc, char*argv[])
     }
 
     // now listen for any connection
-    if(listen(unix_tcp_sockfd, BACKLOG) == -1){
+    if(listen(unix_tcp_sockfd, listen_backlog) == -1){
         perror("listen unix tcp");
         exit(1);
     }
 
+    // arrival timestamps for the latency histogram
+    enable_rx_timestamps(unix_tcp_sockfd);
+
     // END TCP UNIX DS
     }
 
-    int unix_udp_sockfd;
     if(UNIX_UDP_SOCKET_PATH != NULL){
     // START UDP UNIX DS
     struct sockaddr_un unix_udp_addr;
@@ -413,268 +520,82 @@ int main(int argc, char*argv[])
         exit(1);
     }
     
+    enable_rx_timestamps(unix_udp_sockfd);
+
     // END UDP UNIX DS
     }
     
-    // Array of pollfd structures to track file descriptors
-    struct pollfd fds[MAX_CLIENTS + 5];
-
-    int nfds = 0;
-
-    // Initialize the first pollfd to watch for incoming connections on the listener socket
-    fds[0].fd = tcp_sockfd;
-    fds[0].events = POLLIN;  // Watch for incoming data
-    nfds++;
-
-    fds[1].fd = udp_sockfd;
-    fds[1].events = POLLIN;
-    nfds++;
+    if (ADMIN_SOCKET_PATH != NULL) {
+        admin_sockfd = open_admin_socket(ADMIN_SOCKET_PATH);
+    }
 
-    fds[2].fd = STDIN_FILENO;
-    fds[2].events = POLLIN;
-    nfds++;
+    // HOLD TTLs and backorder deadlines, run by reactor 0
+    if (warehouse_timers_init() == -1) {
+        perror("timerfd_create");
+        exit(1);
+    }
+    holds_init();
+    backorders_init();
 
-    if(UNIX_UDP_SOCKET_PATH != NULL){
-    fds[3].fd = unix_udp_sockfd;
-    fds[3].events = POLLIN;
-    printf("DEBUG: GOT UDP UNIX FD");
-    nfds++;
+    // TCP and UDP sockets, one SO_REUSEPORT pair per reactor
+    reactors = aligned_alloc(64, reactor_count * sizeof(Reactor));
+    if (reactors == NULL) {
+        perror("aligned_alloc");
+        exit(1);
     }
-    if(UNIX_TCP_SOCKET_PATH != NULL){
-    fds[4].fd = unix_tcp_sockfd;
-    fds[4].events = POLLIN;
-    printf("DEBUG: GOT TCP UNIX FD");
-    nfds++;
+    memset(reactors, 0, reactor_count * sizeof(Reactor));
+    for (int i = 0; i < reactor_count; i++) {
+        reactors[i].id = i;
+        reactors[i].tcp_sockfd = open_inet_socket(TCP_PORT, SOCK_STREAM, reactor_count > 1);
+        reactors[i].udp_sockfd = open_inet_socket(UDP_PORT, SOCK_DGRAM, reactor_count > 1);
+        reactors[i].resp_sockfd = RESP_PORT != NULL ? open_inet_socket(RESP_PORT, SOCK_STREAM, reactor_count > 1) : -1;
     }
-    
-
-
-    printf("server: waiting for connections...\n");
-
-    signal(SIGALRM,alarm_handler);
-
-    // STEP 6: Main server loop - accept and handle client connections
-    while(1) {
 
-            // START alarm
-            alarm(alarm_timeout);
-
-        sin_size = sizeof their_addr;
-        
-        // Wait for activity on the sockets (blocks until activity occurs)
-        int poll_count = poll(fds, nfds, -1);  // -1 means wait indefinitely
-
-        if (poll_count == -1) {
-            perror("poll");
+#ifdef HAVE_IO_URING
+    // The rings write the storage file on their own schedule, so no other
+    // drinks_bar may share the file while this one runs
+    if (loop_backend == LOOP_URING && file_flag) {
+        if (flock(storage_fd, LOCK_EX | LOCK_NB) == -1) {
+            perror("uring: storage file is in use");
             exit(1);
         }
+        storage_owned = 1;
+    }
+#endif
 
+    printf("server: waiting for connections (%s, %d reactors%s)...\n",
+           loop_backend == LOOP_URING ? "uring" : loop_backend == LOOP_EPOLL ? "epoll" : "poll", reactor_count,
+           low_latency ? ", low latency" : "");
 
-        // Loop through all file descriptors to check for events
-        for (int i = 0; i < nfds; i++) {
-
-            // Skip if this fd has no events
-            if (fds[i].revents == 0) {continue;}
-
-            // Handle errors on this file descriptor
-            if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
-               // Only close and remove if this is NOT the listening socket or UDP socket
-                if (fds[i].fd != tcp_sockfd && fds[i].fd != udp_sockfd) {
-                    close(fds[i].fd);
-                    fds[i] = fds[nfds - 1];
-                    nfds--;
-                    i--;
-                } else {
-                    // For listening/UDP sockets, just print error and continue
-                    fprintf(stderr, "Critical error on listening or UDP socket (fd %d). Server should exit or restart!\n", fds[i].fd);
-                    // Optionally: exit(1);
-                }
-                continue;
-            }
-
-        // KEYBOARD listening socket
-        if (fds[i].fd == STDIN_FILENO && (fds[i].revents & POLLIN)) {
-
-                    alarm(0); // RESET ALARM
-
-                    char server_input[256] = {0}; // setting a new buffer for user input
-                    char response[100] = {0};
-                    
-                    printf("KEYBOARD: ");
-
-                    // chec if no error occured
-                    if(fgets(server_input,sizeof(server_input),stdin) != NULL){
-                        process_message(server_input,strlen(server_input)+1,KEYBOARD_HANDLE,response,sizeof(response), file_flag, fd);
-                        printf("%s\n", response);
-
-                    }
-
-            continue;
-        }
-        
-        // Handle UDP socket
-        if (fds[i].fd == udp_sockfd && (fds[i].revents & POLLIN)) {
-
-            alarm(0); // RESET ALARM
-
-            char udp_buf[MAXDATASIZE];
-            struct sockaddr_storage udp_client_addr;
-            socklen_t udp_addr_len = sizeof udp_client_addr;
-            int udp_numbytes = recvfrom(udp_sockfd, udp_buf, sizeof(udp_buf) - 1, 0,
-                                        (struct sockaddr *)&udp_client_addr, &udp_addr_len);
-            if (udp_numbytes > 0) {
-                udp_buf[udp_numbytes] = '\0';
-
-                // Process the message
-                char response[256];
-                process_message(udp_buf, udp_numbytes, UDP_HANDLE, response, sizeof(response), file_flag, fd);
-
-                // Send response back to UDP client
-                if (sendto(udp_sockfd, response, strlen(response), 0,
-                        (struct sockaddr *)&udp_client_addr, udp_addr_len) == -1) {
-                    perror("sendto");
-                }
-            }
-            continue; // Done with UDP, continue to next fd
-        }
+    // Locked before the threads start, MCL_FUTURE then covers their stacks too
+    if (low_latency) {
+        lock_memory();
+        prefault(&warehouse, sizeof(warehouse));
+    }
 
-        // TCP listening socket, handles connection establishments
-        if (fds[i].fd == tcp_sockfd && (fds[i].revents & POLLIN)) {
-
-            alarm(0); // RESET ALARM
-
-            // Accept new connection
-            sin_size = sizeof their_addr;
-            // Accept incoming client connection (blocks until client connects)
-            new_fd = accept(tcp_sockfd, (struct sockaddr *)&their_addr, &sin_size);
-            if (new_fd == -1) {
-                perror("accept");
-            } else {
-                // Make sure we have room for a new client
-                if (nfds < MAX_CLIENTS + 5) {
-                    // Add the new connection to our array
-                    fds[nfds].fd = new_fd;
-                    fds[nfds].events = POLLIN;
-                    nfds++;
-                    
-                    // Print connection info
-                    inet_ntop(their_addr.ss_family, get_in_addr((struct sockaddr*)&their_addr),
-                              s, sizeof s);
-                    printf("server: new connection from %s on socket %d\n", s, new_fd);
-                } else {
-                    // We're at capacity, reject this client
-                    printf("server: too many clients, rejecting new connection\n");
-                    close(new_fd);
-                }
-            }
-            continue;
-        }
+    // No SA_RESTART, the interrupted wait returns and reactor 0 shuts down cleanly
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_shutdown_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // Keyboard and admin socket commands run on their own thread
+    pthread_t admin_thread;
+    if (pthread_create(&admin_thread, NULL, admin_main, NULL) != 0) {
+        perror("pthread_create");
+        exit(1);
+    }
 
-        // UNIX TCP listening socket, handles connection establishments
-        if (fds[i].fd == unix_tcp_sockfd && (fds[i].revents & POLLIN)) {
-            alarm(0); // RESET ALARM
-
-            // Accept new connection
-            sin_size = sizeof(their_addr);
-            // Accept incoming client connection (blocks until client connects)
-            new_fd = accept(unix_tcp_sockfd, NULL, NULL);
-            if (new_fd == -1) {
-                perror("accept");
-            } else if (nfds < MAX_CLIENTS + 5) {
-                fds[nfds].fd     = new_fd;
-                fds[nfds].events = POLLIN;
-                nfds++;
-                printf("server: new UNIX TCP connection on socket %d\n", new_fd);
-            } else {
-                printf("server: too many clients, rejecting new connection\n");
-                close(new_fd);
-            }
-            continue; 
+    // Reactor 0 runs here, the others get their own thread
+    for (int i = 1; i < reactor_count; i++) {
+        if (pthread_create(&reactors[i].thread, NULL, reactor_main, &reactors[i]) != 0) {
+            perror("pthread_create");
+            exit(1);
         }
-
-        // Handle data from existing TCP client
-        if ((fds[i].revents & POLLIN)      && 
-            fds[i].fd != tcp_sockfd        && 
-            fds[i].fd != unix_tcp_sockfd   &&
-            fds[i].fd != udp_sockfd        && 
-            fds[i].fd != unix_udp_sockfd   && 
-            fds[i].fd != STDIN_FILENO) {
-
-            alarm(0); // RESET ALARM
-
-            // This is a client socket with data to read
-            char buf[MAXDATASIZE];
-            int numbytes;
-
-            // Receive data
-            numbytes = recv(fds[i].fd, buf, sizeof(buf) - 1, 0);
-
-            if (numbytes < 1) {
-                // Error or connection closed
-                if (numbytes == 0) {
-                    // Connection closed normally
-                    // printf("server: socket %d hung up\n", fds[i].fd);
-                } else {
-                    perror("recv");
-                }
-                
-                // Remove this fd from the array (by replacing him with the last fd)
-                // Only remove if this is NOT the listening socket or UDP socket
-                if (fds[i].fd != tcp_sockfd       &&
-                    fds[i].fd != unix_tcp_sockfd  &&
-                    fds[i].fd != udp_sockfd       &&
-                    fds[i].fd != unix_udp_sockfd  &&
-                    fds[i].fd != STDIN_FILENO) {
-                        close(fds[i].fd);
-                        fds[i] = fds[nfds - 1];
-                        nfds--;
-                        i--;
-                    }
-            } else {
-                // We have data from a client
-                buf[numbytes] = '\0';
-                printf("server: received '%s' on socket %d\n", buf, fds[i].fd);
-                
-                // Process the message
-                char response[256];
-                process_message(buf, numbytes, TCP_HANDLE,response, sizeof(response), file_flag, fd);
-                
-                // send message to client
-                if (send(fds[i].fd, response, strlen(response), 0) == -1) {
-                    perror("send");
-                    }else {
-                        printf("server: sent response to socket %d\n", fds[i].fd);  // Add this
-                    }
-                }
-        }       
-
-        // Handle UNIX UDP socket
-        if (fds[i].fd == unix_udp_sockfd && (fds[i].revents & POLLIN)) {
-            alarm(0); // RESET ALARM
-
-            char udp_buf[MAXDATASIZE];
-            struct sockaddr_un unix_udp_client_addr;
-            socklen_t unix_udp_addr_len = sizeof unix_udp_client_addr;
-            int unix_udp_numbytes = recvfrom(unix_udp_sockfd, udp_buf, sizeof(udp_buf) - 1, 0,
-                                        (struct sockaddr *)&unix_udp_client_addr, &unix_udp_addr_len);
-            if (unix_udp_numbytes > 0) {
-                udp_buf[unix_udp_numbytes] = '\0';
-
-                // Process the message
-                char response[256];
-                process_message(udp_buf, unix_udp_numbytes, UDP_HANDLE, response, sizeof(response), file_flag, fd);
-
-                // Send response back to UDP client
-                if (sendto(unix_udp_sockfd, response, strlen(response), 0,
-                        (struct sockaddr *)&unix_udp_client_addr, unix_udp_addr_len) == -1) {
-                    perror("sendto");
-                    }
-                }
-            continue; // Done with UNIX_UDP, continue to next fd
-            }
-        // END OF ALARM
-        }   
-
     }
-    close(fd);
-}
\ No newline at end of file
+    reactor_main(&reactors[0]);
+
+    close(storage_fd);
+}
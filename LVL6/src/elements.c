@@ -2,16 +2,33 @@
 #include "../include/elements.h"
 #include <string.h>
 
+// The name of the hash slot, compared once
+static Element match(const char *name, size_t len, const char *expected, size_t expected_len, Element element) {
+    return len == expected_len && memcmp(name, expected, len) == 0 ? element : UNKNOWN;
+}
+
+// first and last are spelled out, a case label cannot index the string
+#define ELEMENT_CASE(first, last, str, element) \
+    case NAME_HASH(first, last, sizeof(str) - 1): \
+        return match(name, len, str, sizeof(str) - 1, element)
+
+Element element_from_name(const char *name, size_t len) {
+    if (len == 0) return UNKNOWN;
+    switch (NAME_HASH(name[0], name[len - 1], len)) {
+        ELEMENT_CASE('C', 'N', "CARBON", CARBON);
+        ELEMENT_CASE('O', 'N', "OXYGEN", OXYGEN);
+        ELEMENT_CASE('H', 'N', "HYDROGEN", HYDROGEN);
+        ELEMENT_CASE('W', 'R', "WATER", WATER);
+        ELEMENT_CASE('C', 'E', "CARBONDIOXIDE", CARBON_DIOXIDE);
+        ELEMENT_CASE('G', 'E', "GLUCOSE", GLUCOSE);
+        ELEMENT_CASE('A', 'L', "ALCOHOL", ALCOHOL);
+        ELEMENT_CASE('S', 'K', "SOFT DRINK", SOFT_DRINK);
+        ELEMENT_CASE('V', 'A', "VODKA", VODKA);
+        ELEMENT_CASE('C', 'E', "CHAMPAGNE", CHAMPAGNE);
+        default: return UNKNOWN;
+    }
+}
+
 Element element_type_from_str(const char *str) {
-    if (strcmp(str, "CARBON") == 0) return CARBON;
-    if (strcmp(str, "OXYGEN") == 0) return OXYGEN;
-    if (strcmp(str, "HYDROGEN") == 0) return HYDROGEN;
-    if (strcmp(str, "WATER") == 0) return WATER;
-    if (strcmp(str, "CARBONDIOXIDE") == 0) return CARBON_DIOXIDE;
-    if (strcmp(str, "GLUCOSE") == 0) return GLUCOSE;
-    if (strcmp(str, "ALCOHOL") == 0) return ALCOHOL;
-    if (strcmp(str, "SOFT DRINK") == 0) return SOFT_DRINK;
-    if (strcmp(str, "VODKA") == 0) return VODKA;
-    if (strcmp(str, "CHAMPAGNE") == 0) return CHAMPAGNE;
-    return UNKNOWN;
-}
\ No newline at end of file
+    return element_from_name(str, strlen(str));
+}
@@ -0,0 +1,344 @@
+#define _GNU_SOURCE     // accept4
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/un.h>
+#include "../../include/const.h"
+#include "../../include/functions/atom_warehouse_funcs.h"
+#include "../../include/functions/event_loop_funcs.h"
+#include "../../include/functions/drinks_bar_funcs.h"
+#include "../../include/functions/connection_funcs.h"
+#include "../../include/functions/timer_wheel_funcs.h"
+#include "../../include/functions/admin_funcs.h"
+#include "../../include/functions/reply_funcs.h"
+#include "../../include/functions/uring_loop_funcs.h"
+
+int admin_sockfd = -1;
+
+int open_admin_socket(const char *path){
+    struct sockaddr_un addr;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1){
+        perror("admin socket");
+        exit(1);
+    }
+    unlink(path);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1){
+        perror("bind admin");
+        exit(1);
+    }
+
+    // Operators only, the admin commands can flush and dump the storage
+    if (chmod(path, S_IRUSR | S_IWUSR) == -1){
+        perror("chmod admin");
+        exit(1);
+    }
+    if (listen(fd, listen_backlog) == -1){
+        perror("listen admin");
+        exit(1);
+    }
+    return fd;
+}
+
+// Writes a warehouse copy to fd until no request changed it in between,
+// so the last write always holds the newest generation. No lock is held
+// during the I/O, the data path never waits for a slow disk.
+static int write_snapshot(int fd, AtomStorage *copy, unsigned long long *generation){
+    do {
+        warehouse_snapshot(copy, generation);
+        if (pwrite(fd, copy, sizeof(AtomStorage), 0) != sizeof(AtomStorage)){
+            return -1;
+        }
+    } while (__atomic_load_n(&warehouse_generation, __ATOMIC_SEQ_CST) != *generation);
+    return fsync(fd);
+}
+
+// A FLUSH write, see flush_storage()
+typedef struct FlushCall {
+    int fd;
+    unsigned long long generation;
+    int rc;
+} FlushCall;
+
+static void flush_call(void *arg){
+    FlushCall *c = arg;
+    AtomStorage copy = warehouse;
+    c->generation = warehouse_generation;
+    c->rc = flock(c->fd, LOCK_EX);
+    if (c->rc == 0){
+        c->rc = pwrite(c->fd, &copy, sizeof(AtomStorage), 0) == sizeof(AtomStorage) ? 0 : -1;
+        int saved = errno;
+        flock(c->fd, LOCK_UN);
+        errno = saved;
+    }
+}
+
+// The data path saves under the lock, a copy taken outside it could
+// overwrite a newer save and the next reload would bring it back
+static int flush_storage(int fd, unsigned long long *generation){
+    FlushCall call = {fd, 0, 0};
+    warehouse_call(flush_call, &call);
+    *generation = call.generation;
+    return call.rc == -1 ? -1 : fsync(fd);
+}
+
+static void admin_flush(FILE *out){
+    if (!file_flag || storage_fd == -1){
+        fprintf(out, "ERROR: no storage file, start the server with -f\n");
+        return;
+    }
+    unsigned long long generation;
+    int rc;
+#ifdef HAVE_IO_URING
+    if (loop_backend == LOOP_URING){
+        // The rings hold the file lock and write it themselves, FLUSH takes their turn
+        rc = uring_flush_storage(storage_fd, &generation);
+    } else {
+        rc = flush_storage(storage_fd, &generation);
+    }
+#else
+    rc = flush_storage(storage_fd, &generation);
+#endif
+    if (rc == -1){
+        fprintf(out, "ERROR: flush failed: %s\n", strerror(errno));
+        return;
+    }
+    fprintf(out, "FLUSHED generation %llu to the storage file\n", generation);
+}
+
+static void admin_snapshot(const char *path, FILE *out){
+    AtomStorage copy;
+    unsigned long long generation;
+
+    if (path == NULL){
+        warehouse_snapshot(&copy, &generation);
+    } else {
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if (fd == -1){
+            fprintf(out, "ERROR: %s: %s\n", path, strerror(errno));
+            return;
+        }
+        int rc = write_snapshot(fd, &copy, &generation);
+        close(fd);
+        if (rc == -1){
+            fprintf(out, "ERROR: %s: %s\n", path, strerror(errno));
+            return;
+        }
+    }
+
+    fprintf(out, "SNAPSHOT generation %llu%s%s\n", generation, path ? " written to " : "", path ? path : "");
+    fprintf(out, "CARBON: %lld\nOXYGEN: %lld\nHYDROGEN: %lld\n", copy.carbon, copy.oxygen, copy.hydrogen);
+}
+
+static void admin_connections(FILE *out){
+    ConnStats total;
+    memset(&total, 0, sizeof(total));
+
+    for (int i = 0; i < reactor_count; i++){
+        ConnStats st;
+        conn_stats_read(&reactors[i].stats, &st);
+        fprintf(out, "reactor %d: open=%llu accepted=%llu closed=%llu messages=%llu bytes_in=%llu bytes_out=%llu\n",
+                i, st.accepted - st.closed, st.accepted, st.closed, st.messages, st.bytes_in, st.bytes_out);
+        total.accepted += st.accepted;
+        total.closed += st.closed;
+        total.messages += st.messages;
+        total.bytes_in += st.bytes_in;
+        total.bytes_out += st.bytes_out;
+    }
+    fprintf(out, "total: open=%llu accepted=%llu closed=%llu messages=%llu bytes_in=%llu bytes_out=%llu limit=%d\n",
+            total.accepted - total.closed, total.accepted, total.closed, total.messages,
+            total.bytes_in, total.bytes_out, max_clients);
+}
+
+// GEN goes through process_message() like it always did from the keyboard
+static void admin_gen(const char *line, FILE *out){
+    char buf[ADMIN_LINE_MAX];
+    char response[100] = {0};
+
+    snprintf(buf, sizeof(buf), "%s", line);
+    // Under io_uring the rings own the storage file, nobody else reloads it
+    u_int8_t flag = loop_backend == LOOP_URING ? 0 : file_flag;
+    size_t len = process_message(buf, strlen(buf) + 1, KEYBOARD_HANDLE, response, sizeof(response), flag, storage_fd);
+    fputs(len > 0 ? response : REPLY_UNKNOWN_COMMAND, out);
+}
+
+void admin_command(const char *line, FILE *out){
+    char cmd[16] = {0}, arg[ADMIN_LINE_MAX] = {0};
+    sscanf(line, "%15s %255[^\n]", cmd, arg);
+
+    if (strcmp(cmd, "STATS") == 0){
+        print_server_stats(out);
+    } else if (strcmp(cmd, "CONNECTIONS") == 0){
+        admin_connections(out);
+    } else if (strcmp(cmd, "GEN") == 0 && strcmp(arg, "ALL") == 0){
+        admin_gen("GEN SOFT DRINK", out);
+        admin_gen("GEN VODKA", out);
+        admin_gen("GEN CHAMPAGNE", out);
+    } else if (strcmp(cmd, "FLUSH") == 0){
+        admin_flush(out);
+    } else if (strcmp(cmd, "SNAPSHOT") == 0){
+        admin_snapshot(arg[0] ? arg : NULL, out);
+    } else if (strcmp(cmd, "HELP") == 0){
+        fprintf(out, "STATS | CONNECTIONS | GEN ALL | GEN <SOFT DRINK|VODKA|CHAMPAGNE> | FLUSH | SNAPSHOT [path]\n");
+    } else if (cmd[0] != '\0'){
+        admin_gen(line, out);
+    }
+}
+
+// Answers one command line of an admin client
+static int admin_reply(AdminClient *a, const char *line){
+    if (a->h.fd == STDIN_FILENO){
+        admin_command(line, stdout);
+        printf("KEYBOARD: ");
+        fflush(stdout);
+        return 0;
+    }
+
+    char *reply = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&reply, &len);
+    if (out == NULL){
+        perror("open_memstream");
+        return -1;
+    }
+    admin_command(line, out);
+    fclose(out);
+
+    // Admin replies are small, a client that cannot take one is dropped
+    ssize_t n = send(a->h.fd, reply, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    free(reply);
+    return n == (ssize_t)len ? 0 : -1;
+}
+
+static void admin_close(AdminClient *a){
+    loop_del(a->h.loop, &a->h);
+    if (a->h.fd != STDIN_FILENO){
+        close(a->h.fd);
+    }
+    free(a);
+}
+
+// Reads what is available, runs every complete line and keeps the rest
+static void on_admin_client(Handler *h, u_int32_t events){
+    AdminClient *a = (AdminClient *)h;
+
+    ssize_t n = read(h->fd, a->in + a->in_len, sizeof(a->in) - a->in_len);
+    if (n <= 0){
+        if (n == -1 && (errno == EAGAIN || errno == EINTR)){
+            return;
+        }
+        admin_close(a);     // EOF, for stdin too: stop watching it
+        return;
+    }
+    a->in_len += n;
+    __atomic_store_n(&server_last_activity, monotonic_ms(), __ATOMIC_RELAXED);
+
+    char *line = a->in;
+    char *nl;
+    while ((nl = memchr(line, '\n', a->in + a->in_len - line)) != NULL){
+        *nl = '\0';
+        if (nl > line && nl[-1] == '\r'){
+            nl[-1] = '\0';
+        }
+        if (admin_reply(a, line) == -1){
+            admin_close(a);
+            return;
+        }
+        line = nl + 1;
+    }
+
+    a->in_len -= line - a->in;
+    memmove(a->in, line, a->in_len);
+    if (a->in_len == sizeof(a->in)){
+        fprintf(stderr, "admin: command longer than %d bytes, dropped\n", ADMIN_LINE_MAX);
+        a->in_len = 0;
+    }
+}
+
+static AdminClient *admin_watch(EventLoop *loop, int fd){
+    AdminClient *a = calloc(1, sizeof(AdminClient));
+    if (a == NULL){
+        perror("calloc");
+        return NULL;
+    }
+    a->h.fd = fd;
+    a->h.kind = HANDLER_ADMIN;
+    a->h.on_event = on_admin_client;
+    if (loop_add(loop, &a->h, LOOP_READ) == -1){
+        perror("loop_add");
+        free(a);
+        return NULL;
+    }
+    return a;
+}
+
+static void on_admin_listen(Handler *h, u_int32_t events){
+    int fd = accept4(h->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1){
+        if (errno != EAGAIN && errno != EWOULDBLOCK){
+            perror("admin accept");
+        }
+        return;
+    }
+    if (admin_watch(h->loop, fd) == NULL){
+        close(fd);
+    }
+}
+
+void *admin_main(void *arg){
+    // Signals are reactor 0's business
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    // Level-triggered poll, admin traffic is tiny
+    EventLoop loop;
+    if (loop_init(&loop, LOOP_POLL, LOOP_INITIAL_CAPACITY) == -1){
+        perror("loop_init");
+        exit(1);
+    }
+
+    // stdin stays blocking (it is shared with the shell), it is only read once poll() reports it
+    printf("KEYBOARD: ");
+    fflush(stdout);
+    admin_watch(&loop, STDIN_FILENO);
+
+    if (admin_sockfd != -1){
+        Handler *h = calloc(1, sizeof(Handler));
+        if (h == NULL || set_nonblocking(admin_sockfd) == -1){
+            perror("admin listener");
+            exit(1);
+        }
+        h->fd = admin_sockfd;
+        h->kind = HANDLER_ADMIN_LISTEN;
+        h->on_event = on_admin_listen;
+        if (loop_add(&loop, h, LOOP_READ) == -1){
+            perror("loop_add");
+            exit(1);
+        }
+    }
+
+    while (1){
+        if (loop_run_once(&loop, -1) == -1){
+            perror("admin poll");
+            exit(1);
+        }
+    }
+    return NULL;
+}
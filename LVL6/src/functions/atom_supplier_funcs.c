@@ -7,11 +7,13 @@
 #include <sys/types.h>  // Various data type definitions 
 #include <netinet/in.h> // Internet address family structures and constants
 #include <sys/socket.h> // Socket API definitions
+#include <sys/time.h>   // struct timeval
 #include <ctype.h>
 #include <arpa/inet.h>  // Functions for manipulating IP addresses (inet_ntop, etc.)
 #include "../../include/const.h"
 #include "../../include/functions/atom_supplier_funcs.h"
 #include "../../include/elements.h"
+#include "../../include/functions/wire_funcs.h"
 
 void ask_supplier(unsigned long long* amount, char* atom, size_t atom_size) {
     int index = 0;
@@ -70,6 +72,49 @@ void ask_requester(unsigned long long* amount, char* element, size_t element_siz
     element[element_size-1] = '\0';  // Ensure null-termination
 }
 
+size_t encode_wire_request(u_int8_t opcode, const char *element, unsigned long long amount, u_int32_t timeout_ms,
+                           char *out, size_t out_size){
+    WireMessage req;
+    memset(&req, 0, sizeof(req));
+    req.opcode = opcode;
+    req.element = element_type_from_str(element);
+    req.request_id = getpid();
+    req.timeout_ms = timeout_ms;
+    req.amount = amount;
+    return wire_encode(&req, out, out_size);
+}
+
+u_int32_t parse_timeout_arg(const char *arg){
+    char *endptr;
+    unsigned long long val = strtoull(arg, &endptr, 10);
+    if (*arg == '\0' || *endptr != '\0' || !isdigit((unsigned char)*arg) || val == 0 || val > 0xFFFFFFFFULL) {
+        fprintf(stderr, "ERROR: Invalid argument for -t, milliseconds expected\n");
+        exit(1);
+    }
+    return (u_int32_t)val;
+}
+
+void set_reply_timeout(int sockfd, u_int32_t timeout_ms){
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1) {
+        perror("setsockopt SO_RCVTIMEO");
+        exit(1);
+    }
+}
+
+void format_wire_reply(const char *buf, size_t len, char *out, size_t out_size){
+    WireMessage reply;
+    if (wire_decode(buf, len, &reply) == -1 || !(reply.opcode & WIRE_OP_REPLY)) {
+        snprintf(out, out_size, "ERROR: malformed binary reply");
+        return;
+    }
+    snprintf(out, out_size, "#%u %s amount=%llu CARBON: %llu OXYGEN: %llu HYDROGEN: %llu version=%llu",
+             reply.request_id, wire_status_str(reply.status), reply.amount,
+             reply.carbon, reply.oxygen, reply.hydrogen, reply.version);
+}
+
 void *get_in_addr(struct sockaddr *sa)
 {
     // Check if the address is IPv4
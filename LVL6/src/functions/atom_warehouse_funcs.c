@@ -15,18 +15,297 @@
 #include "../../include/const.h"
 #include "../../include/functions/atom_warehouse_funcs.h"
 #include "../../include/elements.h"
+#include "../../include/functions/wire_funcs.h"
+#include "../../include/functions/parse_funcs.h"
+#include "../../include/functions/reply_funcs.h"
+#include "../../include/functions/latency_funcs.h"
+#include "../../include/functions/hold_funcs.h"
+#include "../../include/functions/backorder_funcs.h"
+#include "../../include/functions/timer_wheel_funcs.h"
 #include <sys/file.h>  // flock
+#include <pthread.h>
+#include <sched.h>
 
 int alarm_timeout = 0;
 
 // Global warehouse instance
 AtomStorage warehouse = {0};
 
+// Serializes the reactor threads on the warehouse and the storage file
+pthread_mutex_t warehouse_mutex = PTHREAD_MUTEX_INITIALIZER;
+unsigned long long warehouse_generation = 0;
+TimerWheel warehouse_wheel;
+
+InventoryMode warehouse_inventory = INVENTORY_LOCK_FREE;
+u_int8_t warehouse_combining = 0;
+Combiner warehouse_combiner;
+u_int8_t warehouse_partitioned = 0;
+u_int8_t warehouse_pipelined = 0;
+u_int8_t storage_owned = 0;
+
+// The lock-free DELIVER path, see warehouse_lock()
+u_int8_t warehouse_lock_free = 0;
+static u_int8_t lock_free_gate = 0;             // closed by the holder of warehouse_mutex
+
+// Every change of the warehouse is a write section: each lock-free DELIVER
+// between enter and leave, and the lock holder from warehouse_lock() to
+// warehouse_lock_drop(). inventory_read() copies it without the lock.
+static InventorySeq warehouse_seq;
+
+#define READ_SPINS 64       // copies redone before a reader yields the CPU
+
+void warehouse_lock(void){
+    // -I pipeline: only the apply thread gets here, the write section is
+    // all the readers need
+    if (!warehouse_pipelined){
+        pthread_mutex_lock(&warehouse_mutex);
+    }
+    if (warehouse_lock_free){
+        __atomic_store_n(&lock_free_gate, 1, __ATOMIC_SEQ_CST);
+        while (!inventory_seq_idle(&warehouse_seq)){
+            sched_yield();      // a reservation is a few compare-and-swaps
+        }
+    }
+    inventory_write_begin(&warehouse_seq);
+    if (warehouse_partitioned){
+        __atomic_add_fetch(&warehouse_generation, partition_gather(&warehouse), __ATOMIC_SEQ_CST);
+    }
+}
+
+void warehouse_lock_drop(void){
+    inventory_write_end(&warehouse_seq);
+    if (warehouse_lock_free){
+        __atomic_store_n(&lock_free_gate, 0, __ATOMIC_SEQ_CST);
+    }
+    if (warehouse_partitioned){
+        partition_open();
+    }
+    if (!warehouse_pipelined){
+        pthread_mutex_unlock(&warehouse_mutex);
+    }
+}
+
+void warehouse_call(PipelineFn fn, void *arg){
+    if (pipeline_active()){
+        pipeline_call(fn, arg);
+    } else if (warehouse_pipelined){
+        fn(arg);            // already the apply thread
+    } else {
+        warehouse_lock();
+        fn(arg);
+        warehouse_lock_drop();
+    }
+}
+
+// Enters the lock-free path, 0 if the gate is closed and the caller takes the lock
+static int lock_free_enter(void){
+    if (!warehouse_lock_free){
+        return 0;
+    }
+    inventory_write_begin(&warehouse_seq);
+    if (__atomic_load_n(&lock_free_gate, __ATOMIC_SEQ_CST)){
+        inventory_write_end(&warehouse_seq);
+        return 0;
+    }
+    return 1;
+}
+
+static void lock_free_leave(void){
+    inventory_write_end(&warehouse_seq);
+}
+
+// A consistent copy of the inventory and its generation without the lock,
+// redone while a change runs. Never called inside a write section.
+static void inventory_read(AtomStorage *out, unsigned long long *generation){
+    for (int spins = 0; ; spins++){
+        unsigned long long start = inventory_read_begin(&warehouse_seq);
+        unsigned long long slices = warehouse_partitioned ? partition_read_begin() : 0;
+        inventory_load(&warehouse, out);
+        unsigned long long now = __atomic_load_n(&warehouse_generation, __ATOMIC_RELAXED);
+        if (warehouse_partitioned){
+            partition_sum(out);
+        }
+        if (!inventory_read_retry(&warehouse_seq, start) && (!warehouse_partitioned || !partition_read_retry(slices))){
+            if (generation != NULL){
+                *generation = now;
+            }
+            return;
+        }
+        if (spins >= READ_SPINS){
+            sched_yield();      // a lock holder may be saving the storage file
+            spins = 0;
+        }
+    }
+}
+
+// A plain ADD or DELIVER handed to warehouse_combiner
+typedef struct CombinedOp {
+    WarehouseOp op;                 // WAREHOUSE_OP_ADD or WAREHOUSE_OP_DELIVER
+    Element element;
+    unsigned long long amount;
+    int file_flag, fd;
+    WarehouseStatus status;         // the rest is filled in by the combiner
+    AtomStorage after;
+    unsigned long long version;
+} CombinedOp;
+
+// A batch of warehouse_combiner: one lock, one reload and one save for all of it
+static void apply_combined(Combiner *c, void **ops, int count){
+    int file_flag = 0, fd = -1;
+    for (int i = 0; i < count; i++){
+        CombinedOp *op = ops[i];
+        if (op->file_flag){
+            file_flag = 1;
+            fd = op->fd;
+        }
+    }
+
+    warehouse_lock();
+    if(file_flag){
+        reload_from_file(fd);
+    }
+    AtomStorage start = warehouse;
+    for (int i = 0; i < count; i++){
+        CombinedOp *op = ops[i];
+        AtomStorage before = warehouse;
+        if (op->op == WAREHOUSE_OP_ADD){
+            op->status = warehouse_add(op->element, op->amount);
+            backorder_match();      // the reply shows what the filled backorders left
+        } else {
+            op->status = warehouse_deliver(op->element, op->amount);
+        }
+        // Every operation still gets its own version
+        if (memcmp(&before, &warehouse, sizeof(AtomStorage)) != 0){
+            __atomic_add_fetch(&warehouse_generation, 1, __ATOMIC_SEQ_CST);
+        }
+        op->after = warehouse;
+        op->version = warehouse_generation;
+    }
+    if (file_flag && memcmp(&start, &warehouse, sizeof(AtomStorage)) != 0){
+        save_to_file(fd);
+    }
+    unsigned long long version = warehouse_generation;
+    warehouse_lock_drop();
+    backorder_flush(version);
+}
+
+int inventory_mode_from_str(const char *str, InventoryMode *mode){
+    if (strcmp(str, "lock-free") == 0){
+        *mode = INVENTORY_LOCK_FREE;
+        return 0;
+    }
+    if (strcmp(str, "combining") == 0){
+        *mode = INVENTORY_COMBINING;
+        return 0;
+    }
+    if (strcmp(str, "mutex") == 0){
+        *mode = INVENTORY_MUTEX;
+        return 0;
+    }
+    if (strcmp(str, "pipeline") == 0){
+        *mode = INVENTORY_PIPELINE;
+        return 0;
+    }
+    if (strcmp(str, "partitioned") == 0){
+        *mode = INVENTORY_PARTITIONED;
+        return 0;
+    }
+    return -1;
+}
+
+// -I pipeline: the storage file the apply thread saves, -1 for none
+static int pipeline_fd = -1;
+static unsigned long long pipeline_saved = 0;     // warehouse_generation in the file
+
+// End of a pipeline batch, one save for all of it, before any of it is
+// answered. Nothing else changes the warehouse, the save needs no lock.
+static void pipeline_persist(void){
+    if (pipeline_fd == -1 || warehouse_generation == pipeline_saved){
+        return;
+    }
+    save_to_file(pipeline_fd);
+    pipeline_saved = warehouse_generation;
+}
+
+int warehouse_inventory_init(int file_flag, int fd, int reactors){
+    // The storage file is reloaded and saved under the lock by every
+    // operation, only an inventory in memory can take lock-free DELIVERs
+    warehouse_lock_free = warehouse_inventory == INVENTORY_LOCK_FREE && !file_flag;
+    warehouse_combining = warehouse_inventory == INVENTORY_COMBINING;
+    combiner_init(&warehouse_combiner, apply_combined, NULL);
+    // The rings save when warehouse_generation moves, the slices only
+    // move it under the lock: no file at all
+    warehouse_partitioned = warehouse_inventory == INVENTORY_PARTITIONED && fd == -1;
+    partitions_init(reactors);
+    warehouse_pipelined = warehouse_inventory == INVENTORY_PIPELINE;
+    if (!warehouse_pipelined){
+        return 0;
+    }
+    pipeline_fd = file_flag ? fd : -1;
+    pipeline_saved = warehouse_generation;
+    return pipeline_start(pipeline_persist);
+}
+
+// A MessageCall on the apply thread, which owns the storage file
+static void run_message_call(void *arg){
+    MessageCall *c = arg;
+    backorder_origin(c->origin_fd, &c->origin_addr, c->origin_len);
+    c->len = c->wire ? process_wire_message(c->buf, c->size_buf, c->sock_handle, c->response, c->response_size, 0, c->fd)
+                     : process_message(c->buf, c->size_buf, c->sock_handle, c->response, c->response_size, 0, c->fd);
+}
+
+void message_submit(MessageCall *call, u_int8_t wire, char *buf, size_t size_buf, u_int8_t sock_handle,
+                    char *response, size_t response_size, int file_flag, int fd){
+    if (!pipeline_active()){
+        call->len = wire ? process_wire_message(buf, size_buf, sock_handle, response, response_size, file_flag, fd)
+                         : process_message(buf, size_buf, sock_handle, response, response_size, file_flag, fd);
+        return;
+    }
+    call->wire = wire;
+    call->buf = buf;
+    call->size_buf = size_buf;
+    call->sock_handle = sock_handle;
+    call->response = response;
+    call->response_size = response_size;
+    call->file_flag = file_flag;
+    call->fd = fd;
+    backorder_origin_get(&call->origin_fd, &call->origin_addr, &call->origin_len);
+    pipeline_submit(run_message_call, call);
+}
+
+// The warehouse_apply() family on the apply thread
+typedef struct ApplyCall {
+    WarehouseOp op;
+    Element element;
+    unsigned long long amount;
+    const unsigned long long *if_version;
+    unsigned long long *count;
+    AtomStorage *after;
+    unsigned long long *version;
+    const OrderItem *items;         // warehouse_apply_order()
+    int item_count;
+    WarehouseStatus status;
+} ApplyCall;
+
+static void run_apply_call(void *arg){
+    ApplyCall *c = arg;
+    c->status = warehouse_apply(c->op, c->element, c->amount, c->if_version, c->count, c->after, c->version, 0, -1);
+}
+
+static void run_order_call(void *arg){
+    ApplyCall *c = arg;
+    c->status = warehouse_apply_order(c->items, c->item_count, c->if_version, c->version, 0, -1);
+}
+
+static void run_timers_call(void *arg){
+    warehouse_timers_expire(0, -1);
+}
+
 
 void save_to_file(int fd){
 
     // LOCK THE FILE, IF ERROR, END PROCCESS
-    if (flock(fd, LOCK_EX) == -1){
+    if (!storage_owned && flock(fd, LOCK_EX) == -1){
         perror("function flock");
         close(fd);
         exit(1);
@@ -46,12 +325,19 @@ void save_to_file(int fd){
         exit(1);
     }
 
-    // UNLOCK THE LOCK
-    flock(fd, LOCK_UN);
+    // UNLOCK THE LOCK, UNLESS IT IS HELD FOR THE WHOLE RUN
+    if (!storage_owned){
+        flock(fd, LOCK_UN);
+    }
 }
 
 void reload_from_file(int fd){
 
+    // Nobody else writes an owned file, the inventory in memory is the newest
+    if (storage_owned){
+        return;
+    }
+
     // LOCK THE FILE, IF ERROR, END PROCCESS
     if (flock(fd, LOCK_EX) == -1){
         perror("function flock");
@@ -126,198 +412,957 @@ unsigned long long get_glucose_num(unsigned long long carbon, unsigned long long
 }
 
 
+// The inventory without the lock: lock-free DELIVERs may run meanwhile,
+// the partitioned slices are summed as they are. Unlike inventory_read()
+// it may run under the lock, for the console echo.
+static void inventory_now(AtomStorage *out){
+    inventory_load(&warehouse, out);
+    if (warehouse_partitioned){
+        partition_sum(out);
+    }
+}
+
 void print_storage(){
-    printf("\nCARBON #:%lld \nOXYGEN #:%lld \nHYDROGEN #:%lld\n",warehouse.carbon, warehouse.oxygen, warehouse.hydrogen);
+    char out[128];
+    AtomStorage now;
+    inventory_now(&now);
+    ReplyWriter w;
+    reply_init(&w, out, sizeof(out));
+    reply_literal(&w, "\nCARBON #:");
+    reply_u64(&w, now.carbon);
+    reply_literal(&w, " \nOXYGEN #:");
+    reply_u64(&w, now.oxygen);
+    reply_literal(&w, " \nHYDROGEN #:");
+    reply_u64(&w, now.hydrogen);
+    reply_literal(&w, "\n");
+    fwrite(out, 1, reply_len(&w), stdout);
     return;
 }
 
-void format_storage(char *out, size_t out_size) {
-    snprintf(out, out_size, "CARBON: %lld\nOXYGEN: %lld\nHYDROGEN: %lld\n", warehouse.carbon, warehouse.oxygen, warehouse.hydrogen);
+size_t format_storage(const AtomStorage *inv, char *out, size_t out_size) {
+    ReplyWriter w;
+    reply_init(&w, out, out_size);
+    reply_literal(&w, "CARBON: ");
+    reply_u64(&w, inv->carbon);
+    reply_literal(&w, "\nOXYGEN: ");
+    reply_u64(&w, inv->oxygen);
+    reply_literal(&w, "\nHYDROGEN: ");
+    reply_u64(&w, inv->hydrogen);
+    reply_literal(&w, "\n");
+    return reply_len(&w);
+}
+
+
+void warehouse_snapshot(AtomStorage *out, unsigned long long *generation){
+    inventory_read(out, generation);
+}
+
+// Atoms one atom or molecule takes, indexed by Element
+static const struct Recipe {
+    unsigned long long carbon, oxygen, hydrogen;
+    const char *name;
+} recipes[] = {
+    [CARBON]         = {1, 0, 0, "CARBON"},
+    [OXYGEN]         = {0, 1, 0, "OXYGEN"},
+    [HYDROGEN]       = {0, 0, 1, "HYDROGEN"},
+    [WATER]          = {0, 1, 2, "WATER"},
+    [CARBON_DIOXIDE] = {1, 2, 0, "CARBON DIOXIDE"},
+    [GLUCOSE]        = {6, 6, 12, "GLUCOSE"},
+    [ALCOHOL]        = {2, 1, 6, "ALCOHOL"},
+};
+
+const char *warehouse_element_name(Element element){
+    return recipes[element].name;
+}
+
+// amount * per <= have, without overflowing
+static int enough(unsigned long long have, unsigned long long per, unsigned long long amount){
+    return per == 0 || (amount <= have / per);
+}
+
+WarehouseStatus warehouse_add(Element atom, unsigned long long amount){
+    switch(atom){
+        case CARBON:
+            warehouse.carbon += amount;
+            return WAREHOUSE_OK;
+        case OXYGEN:
+            warehouse.oxygen += amount;
+            return WAREHOUSE_OK;
+        case HYDROGEN:
+            warehouse.hydrogen += amount;
+            return WAREHOUSE_OK;
+        default:
+            return WAREHOUSE_UNKNOWN_ELEMENT;
+    }
+}
+
+WarehouseStatus warehouse_deliver(Element molecule, unsigned long long amount){
+    if (molecule < WATER || molecule > ALCOHOL){
+        return WAREHOUSE_UNKNOWN_ELEMENT;
+    }
+    return warehouse_take(molecule, amount, NULL);
+}
+
+WarehouseStatus warehouse_take(Element element, unsigned long long amount, AtomStorage *taken){
+    if (element > ALCOHOL){
+        return WAREHOUSE_UNKNOWN_ELEMENT;
+    }
+    const struct Recipe *r = &recipes[element];
+    if (!enough(warehouse.carbon, r->carbon, amount) || !enough(warehouse.oxygen, r->oxygen, amount) ||
+        !enough(warehouse.hydrogen, r->hydrogen, amount)){
+        return WAREHOUSE_NOT_ENOUGH;
+    }
+    warehouse.carbon -= r->carbon * amount;
+    warehouse.oxygen -= r->oxygen * amount;
+    warehouse.hydrogen -= r->hydrogen * amount;
+    if (taken != NULL){
+        taken->carbon = r->carbon * amount;
+        taken->oxygen = r->oxygen * amount;
+        taken->hydrogen = r->hydrogen * amount;
+    }
+    return WAREHOUSE_OK;
+}
+
+// The atoms of amount of an element, 0 past ULLONG_MAX atoms (no inventory covers it)
+static int element_need(Element element, unsigned long long amount, AtomStorage *need){
+    const struct Recipe *r = &recipes[element];
+    if ((r->carbon && amount > ULLONG_MAX / r->carbon) || (r->oxygen && amount > ULLONG_MAX / r->oxygen) ||
+        (r->hydrogen && amount > ULLONG_MAX / r->hydrogen)){
+        return 0;
+    }
+    need->carbon = r->carbon * amount;
+    need->oxygen = r->oxygen * amount;
+    need->hydrogen = r->hydrogen * amount;
+    return 1;
+}
+
+// DELIVER without warehouse_mutex, 0 if the gate was closed and nothing ran
+static int deliver_lock_free(Element molecule, unsigned long long amount, WarehouseStatus *status, unsigned long long *version){
+    if (!lock_free_enter()){
+        return 0;
+    }
+    AtomStorage need;
+    if (molecule < WATER || molecule > ALCOHOL){
+        *status = WAREHOUSE_UNKNOWN_ELEMENT;
+    } else {
+        *status = element_need(molecule, amount, &need) && inventory_reserve(&warehouse, &need) == 0 ? WAREHOUSE_OK : WAREHOUSE_NOT_ENOUGH;
+    }
+    if (*status == WAREHOUSE_OK && amount > 0){
+        *version = __atomic_add_fetch(&warehouse_generation, 1, __ATOMIC_SEQ_CST);
+    } else {
+        *version = __atomic_load_n(&warehouse_generation, __ATOMIC_SEQ_CST);
+    }
+    lock_free_leave();
+    return 1;
+}
+
+// DELIVER on this reactor's slice, 0 if the gate was closed and nothing ran
+static int deliver_partitioned(Element molecule, unsigned long long amount, WarehouseStatus *status, unsigned long long *version){
+    if (!partition_enter()){
+        return 0;
+    }
+    AtomStorage need;
+    if (molecule < WATER || molecule > ALCOHOL){
+        *status = WAREHOUSE_UNKNOWN_ELEMENT;
+    } else {
+        *status = element_need(molecule, amount, &need) && (amount == 0 || partition_take(&need, &warehouse) == 0)
+                  ? WAREHOUSE_OK : WAREHOUSE_NOT_ENOUGH;
+    }
+    *version = __atomic_load_n(&warehouse_generation, __ATOMIC_SEQ_CST);
+    partition_leave();
+    return 1;
+}
+
+// ADD to this reactor's slice, 0 if the gate was closed or a backorder
+// waits for supply: then the ADD takes the lock and fills it
+static int add_partitioned(Element atom, unsigned long long amount, WarehouseStatus *status, AtomStorage *after, unsigned long long *version){
+    if (!partition_enter()){
+        return 0;
+    }
+    if (backorders_waiting()){
+        partition_leave();
+        return 0;
+    }
+    AtomStorage atoms;
+    if (atom > HYDROGEN){
+        *status = WAREHOUSE_UNKNOWN_ELEMENT;
+    } else {
+        element_need(atom, amount, &atoms);
+        if (amount > 0){
+            partition_add(&atoms);
+        }
+        *status = WAREHOUSE_OK;
+    }
+    *version = __atomic_load_n(&warehouse_generation, __ATOMIC_SEQ_CST);
+    partition_leave();
+    if (after != NULL){
+        inventory_now(after);
+    }
+    return 1;
+}
+
+// need += per * amount, 0 on overflow (no inventory holds that many)
+static int add_need(unsigned long long *need, unsigned long long per, unsigned long long amount){
+    if (per != 0 && amount > (ULLONG_MAX - *need) / per){
+        return 0;
+    }
+    *need += per * amount;
+    return 1;
+}
+
+WarehouseStatus warehouse_order(const OrderItem *items, int count){
+    unsigned long long carbon = 0, oxygen = 0, hydrogen = 0;
+    for (int i = 0; i < count; i++){
+        if (items[i].molecule < WATER || items[i].molecule > ALCOHOL){
+            return WAREHOUSE_UNKNOWN_ELEMENT;
+        }
+    }
+    for (int i = 0; i < count; i++){
+        const struct Recipe *r = &recipes[items[i].molecule];
+        if (!add_need(&carbon, r->carbon, items[i].amount) || !add_need(&oxygen, r->oxygen, items[i].amount) ||
+            !add_need(&hydrogen, r->hydrogen, items[i].amount)){
+            return WAREHOUSE_NOT_ENOUGH;
+        }
+    }
+    if (carbon > warehouse.carbon || oxygen > warehouse.oxygen || hydrogen > warehouse.hydrogen){
+        return WAREHOUSE_NOT_ENOUGH;
+    }
+    warehouse.carbon -= carbon;
+    warehouse.oxygen -= oxygen;
+    warehouse.hydrogen -= hydrogen;
+    return WAREHOUSE_OK;
+}
+
+// GEN of the inventory inv
+static WarehouseStatus gen_count(const AtomStorage *inv, Element drink, unsigned long long *count){
+    unsigned long long min = INT_MAX ;
+    unsigned long long temp_water = get_water_num(inv->oxygen,inv->hydrogen);
+    unsigned long long temp_alcohol = get_alcohol_num(inv->carbon,inv->oxygen,inv->hydrogen);
+    unsigned long long temp_carbonDio = get_carbonDio_num(inv->carbon,inv->oxygen);
+    unsigned long long temp_glucose = get_glucose_num(inv->carbon,inv->oxygen,inv->hydrogen);
+    switch(drink){
+        case SOFT_DRINK:
+            if(min > temp_water){
+                min = temp_water;
+            }
+            else if(min > temp_carbonDio){
+                min = temp_carbonDio;
+            }
+            else if(min > temp_glucose){
+                min = temp_alcohol;
+            }
+            break;
+        case VODKA:
+            if(min > temp_water){
+                min = temp_water;
+            }
+            else if(min > temp_glucose){
+                min = temp_glucose;
+            }
+            else if(min > temp_alcohol){
+                min = temp_alcohol;
+            }
+            break;
+        case CHAMPAGNE:
+            if(min > temp_water){
+                min = temp_water;
+            }
+            else if(min > temp_carbonDio){
+                min = temp_carbonDio;
+            }
+            else if(min > temp_alcohol){
+                min = temp_alcohol;
+            }
+            break;
+        default:
+            return WAREHOUSE_UNKNOWN_ELEMENT;
+    }
+    *count = min;
+    return WAREHOUSE_OK;
+}
+
+WarehouseStatus warehouse_gen(Element drink, unsigned long long *count){
+    return gen_count(&warehouse, drink, count);
+}
+
+static size_t process_message_locked(char* buf, size_t size_buf, u_int8_t sock_handle, char *response, size_t response_size, int file_flag, int fd);
+
+// " [version <n>]" at the end of the reply's last line
+static size_t add_version(char *response, size_t response_size, size_t len, unsigned long long version){
+    if (len == 0){
+        return 0;
+    }
+    u_int8_t newline = response[len - 1] == '\n';
+    ReplyWriter w;
+    reply_resume(&w, response, response_size, len - newline);
+    reply_literal(&w, " [version ");
+    reply_u64(&w, version);
+    reply_literal(&w, "]");
+    if (newline){
+        reply_literal(&w, "\n");
+    }
+    return reply_len(&w);
+}
+
+// Reply of a plain DELIVER, 1 if the console shows the update after it
+static int deliver_reply(ReplyWriter *w, WarehouseStatus status, Element element, unsigned long long amount, u_int8_t echo){
+    switch(status){
+        case WAREHOUSE_OK:
+            reply_literal(w, "#");
+            reply_u64(w, amount);
+            reply_literal(w, " ");
+            reply_str(w, recipes[element].name);
+            reply_literal(w, " DELIVERED");
+            return 1;
+        case WAREHOUSE_NOT_ENOUGH:
+            reply_literal(w, "ERROR: Not enough atoms to make ");
+            reply_str(w, recipes[element].name);
+            if (echo){
+                fputs("Not enough atoms to make ", stderr);
+                fputs(recipes[element].name, stderr);
+            }
+            reply_literal(w, "\n");
+            return 1;
+        default:
+            if (echo){
+                fputs(REPLY_UNKNOWN_MOLECULE, stdout);
+            }
+            reply_literal(w, REPLY_UNKNOWN_MOLECULE);
+            return 0;
+    }
+}
+
+// A plain ADD (stream) or DELIVER (datagram, no BACKORDER) that does not
+// take warehouse_mutex itself: a lock-free DELIVER, either one handed to
+// warehouse_combiner, or either one on the reactor's slice. Returns the reply length, 0 if the request takes
+// the lock after all.
+static size_t process_unlocked(char *buf, size_t size_buf, u_int8_t sock_handle, char *response, size_t response_size, int file_flag, int fd){
+    Request req;
+    unsigned long long priority, deadline;
+    if (size_buf < 9){
+        return 0;
+    }
+    parse_request(buf, size_buf, &req);
+    if (!req.has_amount){
+        return 0;
+    }
+    if (req.cmd == CMD_ADD && sock_handle == TCP_HANDLE){
+        if (!warehouse_combining && !warehouse_partitioned){
+            return 0;
+        }
+    } else if (req.cmd != CMD_DELIVER || sock_handle != UDP_HANDLE || parse_backorder(buf, size_buf, &priority, &deadline) != 0){
+        return 0;
+    }
+
+    CombinedOp op = {req.cmd == CMD_ADD ? WAREHOUSE_OP_ADD : WAREHOUSE_OP_DELIVER, req.element, req.amount, file_flag, fd};
+    if (warehouse_combining){
+        combine(&warehouse_combiner, &op);
+    } else if (warehouse_partitioned){
+        if (!(op.op == WAREHOUSE_OP_ADD ? add_partitioned(req.element, req.amount, &op.status, &op.after, &op.version)
+                                        : deliver_partitioned(req.element, req.amount, &op.status, &op.version))){
+            return 0;
+        }
+    } else if (!deliver_lock_free(req.element, req.amount, &op.status, &op.version)){
+        return 0;
+    }
+
+    u_int8_t echo = !low_latency;
+    ReplyWriter w;
+    reply_init(&w, response, response_size);
+    size_t len;
+    if (op.op == WAREHOUSE_OP_ADD){
+        if (op.status != WAREHOUSE_OK){
+            if (echo){
+                fputs(REPLY_UNKNOWN_ATOM, stdout);
+            }
+            reply_literal(&w, REPLY_UNKNOWN_ATOM);
+            len = reply_len(&w);
+        } else {
+            if (echo){
+                print_storage();
+            }
+            len = format_storage(&op.after, response, response_size);
+        }
+    } else {
+        if (deliver_reply(&w, op.status, req.element, req.amount, echo) && echo){
+            fputs("\n-- UPDATE --\n", stdout);
+            print_storage();
+        }
+        len = reply_len(&w);
+    }
+    return add_version(response, response_size, len, op.version);
+}
+
+static void gen_reply(ReplyWriter *w, Element drink, unsigned long long min);
+
+// GEN of the console from inventory_read(), 0 if the request is no GEN.
+// With -f the storage file is reloaded first, under the lock.
+static size_t process_gen(char *buf, size_t size_buf, u_int8_t sock_handle, char *response, size_t response_size){
+    Request req;
+    if (size_buf < 9 || sock_handle != KEYBOARD_HANDLE){
+        return 0;
+    }
+    parse_request(buf, size_buf, &req);
+    if (req.cmd != CMD_GEN || req.has_amount){
+        return 0;
+    }
+
+    AtomStorage inv;
+    unsigned long long version, min;
+    inventory_read(&inv, &version);
+    ReplyWriter w;
+    reply_init(&w, response, response_size);
+    if (gen_count(&inv, req.element, &min) != WAREHOUSE_OK){
+        fputs(REPLY_UNKNOWN_DRINK, stdout);
+        reply_literal(&w, REPLY_UNKNOWN_DRINK);
+    } else {
+        gen_reply(&w, req.element, min);
+    }
+    return add_version(response, response_size, reply_len(&w), version);
+}
+
+size_t process_message(char* buf, size_t size_buf, u_int8_t sock_handle, char *response, size_t response_size, int file_flag, int fd){
+    if (pipeline_active()){
+        MessageCall call;
+        message_submit(&call, 0, buf, size_buf, sock_handle, response, response_size, file_flag, fd);
+        pipeline_wait();
+        return call.len;
+    }
+
+    // The transports checked TIMEOUT_MS (request_expired()), what is left
+    // is malformed or came from the keyboard
+    unsigned long long timeout_ms;
+    int timed = parse_timeout(buf, &size_buf, &timeout_ms);
+
+    // IF_VERSION is checked before anything runs, a stale client fails fast
+    unsigned long long expected = 0;
+    int conditional = parse_if_version(buf, &size_buf, &expected);
+
+    // GEN only reads, a consistent copy without the lock
+    if (timed == 0 && conditional == 0 && !file_flag){
+        size_t len = process_gen(buf, size_buf, sock_handle, response, response_size);
+        if (len > 0){
+            return len;
+        }
+    }
+
+    if ((warehouse_lock_free || warehouse_combining || warehouse_partitioned) && timed == 0 && conditional == 0){
+        size_t len = process_unlocked(buf, size_buf, sock_handle, response, response_size, file_flag, fd);
+        if (len > 0){
+            return len;
+        }
+    }
+
+    warehouse_lock();
+    size_t len;
+    ReplyWriter w;
+    if (timed == -1){
+        reply_init(&w, response, response_size);
+        reply_literal(&w, REPLY_BAD_TIMEOUT);
+        len = reply_len(&w);
+    } else if (conditional == -1){
+        reply_init(&w, response, response_size);
+        reply_literal(&w, REPLY_BAD_VERSION);
+        len = reply_len(&w);
+    } else if (conditional == 1 && expected != warehouse_generation){
+        reply_init(&w, response, response_size);
+        reply_literal(&w, REPLY_VERSION_MISMATCH);
+        len = reply_len(&w);
+    } else {
+        AtomStorage before = warehouse;
+        len = process_message_locked(buf, size_buf, sock_handle, response, response_size, file_flag, fd);
+        // A RELEASE may cover waiting backorders too
+        if (backorder_match() > 0 && file_flag){
+            save_to_file(fd);
+        }
+        if (memcmp(&before, &warehouse, sizeof(AtomStorage)) != 0){
+            __atomic_add_fetch(&warehouse_generation, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+    unsigned long long version = warehouse_generation;
+    len = add_version(response, response_size, len, version);
+    warehouse_lock_drop();
+    backorder_flush(version);
+    return len;
+}
+
+// GEN reply of the server console
+static void gen_reply(ReplyWriter *w, Element drink, unsigned long long min){
+    reply_literal(w, "The Drink Bar is able to generate --> ");
+    reply_u64(w, min);
+    switch(drink){
+        case SOFT_DRINK:
+            reply_literal(w, " Soft Drink's\n");
+            break;
+        case VODKA:
+            reply_literal(w, " Vodka's\n");
+            break;
+        default:
+            reply_literal(w, " Champagne's\n");
+            break;
+    }
 }
 
+// Runs an ORDER, one save for the whole order
+static void order_reply(ReplyWriter *w, const char *buf, size_t size_buf, int file_flag, int fd, u_int8_t echo){
+    OrderItem items[ORDER_ITEMS_MAX];
+    int count = parse_order(buf, size_buf, items);
+    if (count == -1){
+        if (echo){
+            fputs(REPLY_BAD_ORDER, stdout);
+        }
+        reply_literal(w, REPLY_BAD_ORDER);
+        return;
+    }
+
+    switch(warehouse_order(items, count)){
+        case WAREHOUSE_OK:
+            for (int i = 0; i < count; i++){
+                if (i > 0){
+                    reply_literal(w, ", ");
+                }
+                reply_literal(w, "#");
+                reply_u64(w, items[i].amount);
+                reply_literal(w, " ");
+                reply_str(w, recipes[items[i].molecule].name);
+            }
+            reply_literal(w, " DELIVERED");
+            if(file_flag){
+                save_to_file(fd);
+            }
+            if (echo){
+                fputs("\n-- UPDATE --\n", stdout);
+                print_storage();
+            }
+            return;
+        case WAREHOUSE_NOT_ENOUGH:
+            if (echo){
+                fputs(REPLY_ORDER_NOT_ENOUGH, stderr);
+            }
+            reply_literal(w, REPLY_ORDER_NOT_ENOUGH);
+            return;
+        default:
+            if (echo){
+                fputs(REPLY_UNKNOWN_MOLECULE, stdout);
+            }
+            reply_literal(w, REPLY_UNKNOWN_MOLECULE);
+            return;
+    }
+}
+
+// Runs HOLD, COMMIT or RELEASE
+static void hold_reply(ReplyWriter *w, Command cmd, const char *buf, size_t size_buf, int file_flag, int fd, u_int8_t echo){
+    const char *error;
+    if (cmd == CMD_HOLD){
+        Element element;
+        unsigned long long amount, ttl, id;
+        if (parse_hold(buf, size_buf, &element, &amount, &ttl) == -1 || ttl == 0 || ttl > HOLD_TTL_MAX){
+            error = REPLY_BAD_HOLD;
+        } else {
+            switch(warehouse_hold(element, amount, ttl, &id)){
+                case WAREHOUSE_OK:
+                    reply_literal(w, "HOLD #");
+                    reply_u64(w, id);
+                    reply_literal(w, " ");
+                    reply_u64(w, amount);
+                    reply_literal(w, " ");
+                    reply_str(w, recipes[element].name);
+                    reply_literal(w, " for ");
+                    reply_u64(w, ttl);
+                    reply_literal(w, "s");
+                    if(file_flag){
+                        save_to_file(fd);
+                    }
+                    if (echo){
+                        fputs("\n-- UPDATE --\n", stdout);
+                        print_storage();
+                    }
+                    return;
+                case WAREHOUSE_NOT_ENOUGH:
+                    reply_literal(w, "ERROR: Not enough atoms to hold ");
+                    reply_str(w, recipes[element].name);
+                    reply_literal(w, "\n");
+                    return;
+                case WAREHOUSE_HOLDS_FULL:
+                    error = REPLY_HOLDS_FULL;
+                    break;
+                default:
+                    error = REPLY_UNKNOWN_ELEMENT;
+                    break;
+            }
+        }
+    } else {
+        unsigned long long id;
+        Hold held;
+        if (parse_hold_id(buf, size_buf, &id) == -1){
+            error = REPLY_BAD_HOLD_ID;
+        } else if ((cmd == CMD_COMMIT ? warehouse_commit(id, &held) : warehouse_release(id, &held)) != WAREHOUSE_OK){
+            error = REPLY_NO_HOLD;
+        } else {
+            reply_literal(w, "HOLD #");
+            reply_u64(w, id);
+            if (cmd == CMD_COMMIT){
+                reply_literal(w, " COMMITTED, #");
+                reply_u64(w, held.amount);
+                reply_literal(w, " ");
+                reply_str(w, recipes[held.element].name);
+                reply_literal(w, " DELIVERED");
+                return;     // the atoms left with the HOLD
+            }
+            reply_literal(w, " RELEASED");
+            if(file_flag){
+                save_to_file(fd);
+            }
+            if (echo){
+                fputs("\n-- UPDATE --\n", stdout);
+                print_storage();
+            }
+            return;
+        }
+    }
+    if (echo){
+        fputs(error, stdout);
+    }
+    reply_str(w, error);
+}
+
+static size_t process_message_locked(char* buf, size_t size_buf, u_int8_t sock_handle, char *response, size_t response_size, int file_flag, int fd){
+    // Replies are written straight into response, the console echo is skipped in --low-latency
+    ReplyWriter w;
+    reply_init(&w, response, response_size);
+    u_int8_t echo = !low_latency;
 
-void process_message(char* buf, size_t size_buf, u_int8_t sock_handle, char *response, size_t response_size, int file_flag, int fd){
     if(file_flag){
         reload_from_file(fd);
         }
-    // Parse the command
-    char cmd[10] = {0}, element_str[20] = {0}, element_str2[20] = {0};
-    Element element;
-    int amount;
+    // Parse the command in place, no copies
+    Request req;
 
     // already invalid if it shorter than 9
     if(size_buf < 9){
-        fprintf(stdout, "ERROR: Message too short, invalid");
-        return;
+        if (echo){
+            fputs("ERROR: Message too short, invalid", stdout);
+        }
+        return 0;
+    }
+
+    parse_request(buf, size_buf, &req);
+    Element element = req.element;
+    unsigned long long amount = req.amount;
+
+    // ORDER is a DELIVER of several molecules, datagrams only like DELIVER
+    if (req.cmd == CMD_ORDER){
+        if (sock_handle == UDP_HANDLE){
+            order_reply(&w, buf, size_buf, file_flag, fd, echo);
+        }
+        return reply_len(&w);
+    }
+
+    // Reservations, any transport
+    if (req.cmd == CMD_HOLD || req.cmd == CMD_COMMIT || req.cmd == CMD_RELEASE){
+        hold_reply(&w, req.cmd, buf, size_buf, file_flag, fd, echo);
+        return reply_len(&w);
     }
 
     // if  we got exactly three elements, continue
-    if (sscanf(buf, "%s %s %d",cmd,element_str,&amount) == 3){
-        element = element_type_from_str(element_str);
+    if (req.has_amount){
         // check if its ADD and TCP
-        if(!strcmp(cmd,"ADD") && sock_handle == TCP_HANDLE){
-            switch(element){
-                case 0:
-                warehouse.carbon += amount;
-                    break;
-                case 1:
-                warehouse.oxygen += amount;
-                    break;
-                case 2:
-                warehouse.hydrogen += amount;
-                    break;
-                default:
-                    fprintf(stdout,"ERROR: Unkown atom type\n");
-                    snprintf(response, response_size, 
-                        "ERROR: Unkown atom type\n");
-                    return;
+        if(req.cmd == CMD_ADD && sock_handle == TCP_HANDLE){
+            if (warehouse_add(element, amount) != WAREHOUSE_OK){
+                if (echo){
+                    fputs(REPLY_UNKNOWN_ATOM, stdout);
+                }
+                reply_literal(&w, REPLY_UNKNOWN_ATOM);
+                return reply_len(&w);
             }
+            backorder_match();      // the reply shows what the filled backorders left
             if(file_flag){
             save_to_file(fd);
             }
-            format_storage(response, response_size);
             // Print the storage to server console
-            print_storage();
+            if (echo){
+                print_storage();
+            }
+            return format_storage(&warehouse, response, response_size);
         }
         // check if its DELIVER and UDP
-        else if(!strcmp(cmd,"DELIVER") && sock_handle == UDP_HANDLE){
-            
-            switch(element){
-                case WATER:
-                if(warehouse.hydrogen>=2*amount && warehouse.oxygen >=1*amount){
-                    warehouse.hydrogen -= 2*amount;
-                    warehouse.oxygen -= 1*amount;
-                    snprintf(response, response_size, 
-                        "#%d WATER DELIVERED",amount);
-                }else{
-                    fprintf(stderr,"Not enough atoms to make WATER");
-                    snprintf(response, response_size, 
-                        "ERROR: Not enough atoms to make WATER\n");
-                }
-                    break;
-                case CARBON_DIOXIDE:
-                if(warehouse.carbon >=1*amount && warehouse.oxygen>=2*amount){
-                    warehouse.carbon -= 1*amount;
-                    warehouse.oxygen -= 2*amount;
-                    snprintf(response, response_size, 
-                        "#%d CARBON DIOXIDE DELIVERED",amount);
-                }else{
-                    fprintf(stderr,"Not enough atoms to make CARBON DIOXIDE");
-                    snprintf(response, response_size, 
-                        "ERROR: Not enough atoms to make CARBON DIOXIDE\n");
-                }
-                    break;
-                case GLUCOSE:
-                if(warehouse.carbon >= 6*amount && warehouse.hydrogen >= 12*amount && warehouse.oxygen >= 6*amount){
-                    warehouse.carbon -= 6*amount;
-                    warehouse.hydrogen -= 12*amount;
-                    warehouse.oxygen -= 6*amount;
-                    snprintf(response, response_size, 
-                        "#%d GLUCOSE DELIVERED", amount);
-                } else{
-                    fprintf(stderr,"Not enough atoms to make GLUCOSE");
-                    snprintf(response, response_size, 
-                        "ERROR: Not enough atoms to make GLUCOSE\n");
-                }
-                    break;
-                case ALCOHOL:
-                if(warehouse.carbon >= 2*amount && warehouse.hydrogen >= 6*amount && warehouse.oxygen >= 1*amount){
-                    warehouse.carbon -= 2*amount;
-                    warehouse.hydrogen -=6*amount;
-                    warehouse.oxygen -=1*amount;
-                    snprintf(response, response_size, 
-                        "#%d ALCOHOL DELIVERED",amount);
-                } else{
-                    fprintf(stderr,"Not enough atoms to make ALCOHOL");
-                    snprintf(response, response_size, 
-                        "ERROR: Not enough atoms to make ALCOHOL\n");
+        else if(req.cmd == CMD_DELIVER && sock_handle == UDP_HANDLE){
+            unsigned long long priority, deadline, id;
+            int backorder = parse_backorder(buf, size_buf, &priority, &deadline);
+            if (backorder == -1 || priority >= BACKORDER_PRIORITIES || deadline == 0 || deadline > BACKORDER_DEADLINE_MAX){
+                if (echo){
+                    fputs(REPLY_BAD_BACKORDER, stdout);
                 }
-                    break;
-                default:
-                    fprintf(stdout,"ERROR: Unkown mulecule type\n");
-                    snprintf(response, response_size, 
-                        "ERROR: Unkown mulecule type\n");
-                    return;
-                    }
-                    if(file_flag){
-                        save_to_file(fd);
-                    }
-                printf("\n-- UPDATE --\n");
-                print_storage();
+                reply_literal(&w, REPLY_BAD_BACKORDER);
+                return reply_len(&w);
             }
-    }else if(sscanf(buf, "%s %s %s",cmd,element_str, element_str2) && strcmp(cmd,"GEN") == 0){
-        // cjeck if we got anther word
-        if(strlen(element_str2) > 1){
-            strcat(element_str, " ");
-            strcat(element_str, element_str2);
-        }
-        element = element_type_from_str(element_str);
-        
-        if(sock_handle == KEYBOARD_HANDLE){
-            unsigned long long min = INT_MAX ;
-            unsigned long long temp_water = get_water_num(warehouse.oxygen,warehouse.hydrogen);
-            unsigned long long temp_alcohol = get_alcohol_num(warehouse.carbon,warehouse.oxygen,warehouse.hydrogen);
-            unsigned long long temp_carbonDio = get_carbonDio_num(warehouse.carbon,warehouse.oxygen);
-            unsigned long long temp_glucose = get_glucose_num(warehouse.carbon,warehouse.oxygen,warehouse.hydrogen);
-            switch(element){
-                case SOFT_DRINK:
-                    if(min > temp_water){
-                        min = temp_water;
-                    }
-                    else if(min > temp_carbonDio){
-                        min = temp_carbonDio;
+            WarehouseStatus status = backorder ? warehouse_backorder(element, amount, priority, deadline, &id)
+                                               : warehouse_deliver(element, amount);
+            switch(status){
+                case WAREHOUSE_BACKORDERED:
+                    reply_literal(&w, "BACKORDER #");
+                    reply_u64(&w, id);
+                    reply_literal(&w, " ");
+                    reply_u64(&w, amount);
+                    reply_literal(&w, " ");
+                    reply_str(&w, recipes[element].name);
+                    reply_literal(&w, " queued for ");
+                    reply_u64(&w, deadline);
+                    reply_literal(&w, "s");
+                    if (echo){
+                        printf("BACKORDER #%llu queued\n", id);
                     }
-                    else if(min > temp_glucose){
-                        min = temp_alcohol;
+                    return reply_len(&w);
+                case WAREHOUSE_BACKORDERS_FULL:
+                    if (echo){
+                        fputs(REPLY_BACKORDERS_FULL, stdout);
                     }
-                    snprintf(response, response_size, 
-                        "The Drink Bar is able to generate --> %lld Soft Drink's\n", min);
-                    break;
-                case VODKA:
-                    if(min > temp_water){
-                        min = temp_water;
-                    }
-                    else if(min > temp_glucose){
-                        min = temp_glucose;
-                    }
-                    else if(min > temp_alcohol){
-                        min = temp_alcohol;
+                    reply_literal(&w, REPLY_BACKORDERS_FULL);
+                    return reply_len(&w);
+                default:
+                    if (!deliver_reply(&w, status, element, amount, echo)){
+                        return reply_len(&w);
                     }
-                snprintf(response, response_size, 
-                    "The Drink Bar is able to generate --> %lld Vodka's\n", min);
                     break;
-                case CHAMPAGNE:
-                    if(min > temp_water){
-                        min = temp_water;
-                    }
-                    else if(min > temp_carbonDio){
-                        min = temp_carbonDio;
                     }
-                    else if(min > temp_alcohol){
-                        min = temp_alcohol;
+                    if(file_flag){
+                        save_to_file(fd);
                     }
-                    snprintf(response, response_size, 
-                        "The Drink Bar is able to generate --> %lld Champagne's\n", min);
-                    break;
-                default:
-                    fprintf(stdout,"ERROR: Unkown drink type\n");
-                    snprintf(response, response_size, 
-                        "ERROR: Unkown drink type\n");
-                    return;
+                if (echo){
+                    fputs("\n-- UPDATE --\n", stdout);
+                    print_storage();
+                }
             }
-            if (sock_handle != KEYBOARD_HANDLE){
-            format_storage(response, response_size);
-            print_storage();    // Print the storage to server console
+    }else if(req.cmd == CMD_GEN){
+        if(sock_handle == KEYBOARD_HANDLE){
+            unsigned long long min;
+            if (warehouse_gen(element, &min) != WAREHOUSE_OK){
+                fputs(REPLY_UNKNOWN_DRINK, stdout);
+                reply_literal(&w, REPLY_UNKNOWN_DRINK);
+                return reply_len(&w);
             }
-
+            gen_reply(&w, element, min);
         }
     }else {                // no ADD no DELIVER? unkown
-            fprintf(stdout,"ERROR: Unkown command\n");
-            snprintf(response, response_size, 
-                "ERROR: Unknown command\n");
+            if (echo){
+                fputs("ERROR: Unkown command\n", stdout);
+            }
+            reply_literal(&w, REPLY_UNKNOWN_COMMAND);
+        }
+    return reply_len(&w);
+    }
+
+static u_int16_t wire_status(WarehouseStatus status){
+    switch(status){
+        case WAREHOUSE_OK:              return WIRE_OK;
+        case WAREHOUSE_NOT_ENOUGH:      return WIRE_ERR_NOT_ENOUGH;
+        case WAREHOUSE_VERSION_MISMATCH: return WIRE_ERR_VERSION;
+        default:                        return WIRE_ERR_ELEMENT;
+    }
+}
+
+void warehouse_unlock(const AtomStorage *before, AtomStorage *after, unsigned long long *version, int file_flag, int fd){
+    backorder_match();
+    if (memcmp(before, &warehouse, sizeof(AtomStorage)) != 0){
+        // The version moves with the change, before the file shows it
+        __atomic_add_fetch(&warehouse_generation, 1, __ATOMIC_SEQ_CST);
+        if(file_flag){
+            save_to_file(fd);
+        }
+    }
+    if (after != NULL){
+        *after = warehouse;
+    }
+    unsigned long long now = warehouse_generation;
+    if (version != NULL){
+        *version = now;
+    }
+    warehouse_lock_drop();
+    backorder_flush(now);
+}
+
+int warehouse_timers_init(void){
+    return wheel_init(&warehouse_wheel);
+}
+
+void warehouse_timers_expire(int file_flag, int fd){
+    if (pipeline_active()){
+        pipeline_call(run_timers_call, NULL);
+        return;
+    }
+    warehouse_lock();
+    if(file_flag){
+        reload_from_file(fd);
+    }
+    AtomStorage before = warehouse;
+    wheel_expire(&warehouse_wheel);
+    warehouse_unlock(&before, NULL, NULL, file_flag, fd);
+}
+
+WarehouseStatus warehouse_apply(WarehouseOp op, Element element, unsigned long long amount,
+                                const unsigned long long *if_version, unsigned long long *count,
+                                AtomStorage *after, unsigned long long *version, int file_flag, int fd){
+    // GEN reads a consistent copy, no writer waits for it (with -f it
+    // reloads the storage file under the lock)
+    if (op == WAREHOUSE_OP_GEN && if_version == NULL && !file_flag){
+        AtomStorage inv;
+        unsigned long long now, drinks;
+        inventory_read(&inv, &now);
+        WarehouseStatus status = gen_count(&inv, element, count != NULL ? count : &drinks);
+        if (after != NULL){
+            *after = inv;
+        }
+        if (version != NULL){
+            *version = now;
+        }
+        return status;
+    }
+    if (pipeline_active()){
+        ApplyCall call = {op, element, amount, if_version, count, after, version};
+        pipeline_call(run_apply_call, &call);
+        return call.status;
+    }
+    WarehouseStatus status;
+    unsigned long long now;
+    if ((op == WAREHOUSE_OP_ADD || op == WAREHOUSE_OP_DELIVER) && if_version == NULL && warehouse_combining){
+        CombinedOp combined = {op, element, amount, file_flag, fd};
+        combine(&warehouse_combiner, &combined);
+        if (after != NULL){
+            *after = combined.after;
+        }
+        if (version != NULL){
+            *version = combined.version;
+        }
+        return combined.status;
+    }
+    if ((op == WAREHOUSE_OP_ADD || op == WAREHOUSE_OP_DELIVER) && if_version == NULL && warehouse_partitioned){
+        u_int8_t ran = op == WAREHOUSE_OP_ADD ? add_partitioned(element, amount, &status, after, &now)
+                                              : deliver_partitioned(element, amount, &status, &now);
+        if (ran){
+            if (after != NULL && op == WAREHOUSE_OP_DELIVER){
+                inventory_now(after);
+            }
+            if (version != NULL){
+                *version = now;
+            }
+            return status;
+        }
+    }
+    if (op == WAREHOUSE_OP_DELIVER && if_version == NULL && deliver_lock_free(element, amount, &status, &now)){
+        if (after != NULL){
+            inventory_now(after);
+        }
+        if (version != NULL){
+            *version = now;
         }
+        return status;
     }
 
+    warehouse_lock();
+    AtomStorage before = warehouse;
+    if (if_version != NULL && *if_version != warehouse_generation){
+        warehouse_unlock(&before, after, version, file_flag, fd);
+        return WAREHOUSE_VERSION_MISMATCH;
+    }
+    if(file_flag){
+        reload_from_file(fd);
+    }
+
+    before = warehouse;
+    switch(op){
+        case WAREHOUSE_OP_ADD:
+            status = warehouse_add(element, amount);
+            break;
+        case WAREHOUSE_OP_DELIVER:
+            status = warehouse_deliver(element, amount);
+            break;
+        default:
+            status = warehouse_gen(element, count);
+            break;
+    }
+    warehouse_unlock(&before, after, version, file_flag, fd);
+    return status;
+}
+
+WarehouseStatus warehouse_apply_order(const OrderItem *items, int count, const unsigned long long *if_version,
+                                      unsigned long long *version, int file_flag, int fd){
+    if (pipeline_active()){
+        ApplyCall call = {.if_version = if_version, .version = version, .items = items, .item_count = count};
+        pipeline_call(run_order_call, &call);
+        return call.status;
+    }
+    warehouse_lock();
+    AtomStorage before = warehouse;
+    if (if_version != NULL && *if_version != warehouse_generation){
+        warehouse_unlock(&before, NULL, version, file_flag, fd);
+        return WAREHOUSE_VERSION_MISMATCH;
+    }
+    if(file_flag){
+        reload_from_file(fd);
+    }
+    before = warehouse;
+    WarehouseStatus status = warehouse_order(items, count);
+    warehouse_unlock(&before, NULL, version, file_flag, fd);
+    return status;
+}
+
+size_t process_wire_message(const char *buf, size_t size_buf, u_int8_t sock_handle, char *response, size_t response_size, int file_flag, int fd){
+    if (pipeline_active()){
+        MessageCall call;
+        message_submit(&call, 1, (char *)buf, size_buf, sock_handle, response, response_size, file_flag, fd);
+        pipeline_wait();
+        return call.len;
+    }
+
+    WireMessage req, reply;
+    memset(&reply, 0, sizeof(reply));
+
+    if (wire_decode(buf, size_buf, &req) == -1){
+        reply.opcode = WIRE_OP_REPLY;
+        reply.status = WIRE_ERR_FORMAT;
+        return wire_encode(&reply, response, response_size);
+    }
+    reply.opcode = req.opcode | WIRE_OP_REPLY;
+    reply.element = req.element;
+    reply.request_id = req.request_id;
+    reply.amount = req.amount;
+
+    // The text protocol's transport rules, GEN only reads
+    WarehouseOp op;
+    switch(req.opcode){
+        case WIRE_OP_ADD:
+            op = WAREHOUSE_OP_ADD;
+            reply.status = sock_handle == TCP_HANDLE ? WIRE_OK : WIRE_ERR_TRANSPORT;
+            break;
+        case WIRE_OP_DELIVER:
+            op = WAREHOUSE_OP_DELIVER;
+            reply.status = sock_handle == UDP_HANDLE ? WIRE_OK : WIRE_ERR_TRANSPORT;
+            break;
+        case WIRE_OP_GEN:
+            op = WAREHOUSE_OP_GEN;
+            reply.status = WIRE_OK;
+            break;
+        default:
+            op = WAREHOUSE_OP_GEN;
+            reply.status = WIRE_ERR_FORMAT;
+            break;
+    }
+
+    AtomStorage after;
+    if (reply.status == WIRE_OK){
+        reply.status = wire_status(warehouse_apply(op, req.element, req.amount, req.has_if_version ? &req.if_version : NULL,
+                                                   &reply.amount, &after, &reply.version, file_flag, fd));
+    } else {
+        // Still reports the inventory, like every other reply
+        warehouse_snapshot(&after, &reply.version);
+    }
+    reply.carbon = after.carbon;
+    reply.oxygen = after.oxygen;
+    reply.hydrogen = after.hydrogen;
+
+    return wire_encode(&reply, response, response_size);
+}
+
 void sigchld_handler(int s)
 {
     (void)s; // quiet unused variable warning
@@ -339,7 +1384,3 @@ void *get_in_addr(struct sockaddr *sa)
     return &(((struct sockaddr_in6*)sa)->sin6_addr);
 }
 
-void alarm_handler(int signum){
-    fprintf(stdout,"Server didnt recieved any input in the past %d seconds\nTERMINATING!\n", alarm_timeout);
-    exit(0);
-}
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "../../include/const.h"
+#include "../../include/functions/backorder_funcs.h"
+#include "../../include/functions/atom_warehouse_funcs.h"
+#include "../../include/functions/timer_wheel_funcs.h"
+#include "../../include/functions/reply_funcs.h"
+#include "../../include/functions/latency_funcs.h"
+
+typedef struct BackorderQueue {
+    Backorder *head, *tail;
+} BackorderQueue;
+
+static Backorder backorders[BACKORDERS_MAX];
+static Backorder *free_backorders = NULL;
+static unsigned long long backorder_sequence = 0;
+static int waiting = 0;                                 // in the queues, backorder_match() returns at once on 0
+static BackorderQueue queues[ALCOHOL + 1][BACKORDER_PRIORITIES];   // indexed by molecule
+
+// Origin of the request this thread is running
+static __thread int origin_fd = -1;
+static __thread struct sockaddr_storage origin_addr;
+static __thread socklen_t origin_len = 0;
+
+// Settled under the lock by this thread, in order, answered by backorder_flush()
+static __thread Backorder *settled_head = NULL;
+static __thread Backorder *settled_tail = NULL;
+
+void backorders_init(void){
+    for (int i = BACKORDERS_MAX - 1; i >= 0; i--){
+        backorders[i].next = free_backorders;
+        free_backorders = &backorders[i];
+    }
+}
+
+void backorder_origin(int fd, const struct sockaddr_storage *addr, socklen_t addr_len){
+    origin_fd = fd;
+    origin_len = addr_len < sizeof(origin_addr) ? addr_len : sizeof(origin_addr);
+    memcpy(&origin_addr, addr, origin_len);
+}
+
+void backorder_origin_get(int *fd, struct sockaddr_storage *addr, socklen_t *addr_len){
+    *fd = origin_fd;
+    *addr_len = origin_len;
+    memcpy(addr, &origin_addr, origin_len);
+}
+
+// Out of its queue and onto this thread's settled list
+static void settle(Backorder *b, u_int8_t expired){
+    BackorderQueue *q = &queues[b->molecule][b->priority];
+    if (b->prev != NULL){
+        b->prev->next = b->next;
+    } else {
+        q->head = b->next;
+    }
+    if (b->next != NULL){
+        b->next->prev = b->prev;
+    } else {
+        q->tail = b->prev;
+    }
+    timer_del(&warehouse_wheel, &b->deadline);
+    __atomic_sub_fetch(&waiting, 1, __ATOMIC_SEQ_CST);
+
+    b->expired = expired;
+    b->next = NULL;
+    if (settled_tail != NULL){
+        settled_tail->next = b;
+    } else {
+        settled_head = b;
+    }
+    settled_tail = b;
+}
+
+// The deadline passed before the inventory covered the backorder
+static void on_backorder_deadline(TimerWheel *w, Timer *t){
+    Backorder *b = t->data;
+    if (!low_latency){
+        printf("BACKORDER #%llu expired\n", b->id);
+    }
+    settle(b, 1);
+}
+
+WarehouseStatus warehouse_backorder(Element molecule, unsigned long long amount, int priority,
+                                    unsigned long long deadline, unsigned long long *id){
+    if (molecule < WATER || molecule > ALCOHOL){
+        return WAREHOUSE_UNKNOWN_ELEMENT;
+    }
+    *id = 0;
+    if (origin_fd == -1){
+        return warehouse_deliver(molecule, amount);     // nowhere to answer later
+    }
+
+    // Nobody ahead of it: deliver now if the inventory covers it
+    int ahead = 0;
+    for (int p = priority; p < BACKORDER_PRIORITIES; p++){
+        ahead |= queues[molecule][p].head != NULL;
+    }
+    if (!ahead){
+        WarehouseStatus status = warehouse_deliver(molecule, amount);
+        if (status != WAREHOUSE_NOT_ENOUGH){
+            return status;
+        }
+    }
+    if (free_backorders == NULL){
+        return WAREHOUSE_BACKORDERS_FULL;
+    }
+
+    Backorder *b = free_backorders;
+    free_backorders = b->next;
+    b->id = ++backorder_sequence;
+    b->molecule = molecule;
+    b->amount = amount;
+    b->priority = priority;
+    b->fd = origin_fd;
+    memcpy(&b->addr, &origin_addr, origin_len);
+    b->addr_len = origin_len;
+
+    BackorderQueue *q = &queues[molecule][priority];
+    b->prev = q->tail;
+    b->next = NULL;
+    if (q->tail != NULL){
+        q->tail->next = b;
+    } else {
+        q->head = b;
+    }
+    q->tail = b;
+    __atomic_add_fetch(&waiting, 1, __ATOMIC_SEQ_CST);
+
+    timer_init(&b->deadline, on_backorder_deadline, b);
+    timer_add(&warehouse_wheel, &b->deadline, deadline * 1000ULL);
+    *id = b->id;
+    return WAREHOUSE_BACKORDERED;
+}
+
+int backorders_waiting(void){
+    return __atomic_load_n(&waiting, __ATOMIC_SEQ_CST);
+}
+
+int backorder_match(void){
+    if (waiting == 0){
+        return 0;
+    }
+    int filled = 0;
+    for (int m = WATER; m <= ALCOHOL; m++){
+        for (int p = BACKORDER_PRIORITIES - 1; p >= 0; p--){
+            Backorder *b;
+            while ((b = queues[m][p].head) != NULL && warehouse_deliver(m, b->amount) == WAREHOUSE_OK){
+                settle(b, 0);
+                filled++;
+            }
+            if (b != NULL){
+                break;      // the lower priorities wait behind this head
+            }
+        }
+    }
+    return filled;
+}
+
+void backorder_flush(unsigned long long version){
+    if (settled_head == NULL){
+        return;
+    }
+
+    char reply[256];
+    for (Backorder *b = settled_head; b != NULL; b = b->next){
+        ReplyWriter w;
+        reply_init(&w, reply, sizeof(reply));
+        if (b->expired){
+            reply_literal(&w, "ERROR: Backorder #");
+            reply_u64(&w, b->id);
+            reply_literal(&w, " expired, not enough atoms to make ");
+        } else {
+            reply_literal(&w, "#");
+            reply_u64(&w, b->amount);
+            reply_literal(&w, " ");
+        }
+        reply_str(&w, warehouse_element_name(b->molecule));
+        if (!b->expired){
+            reply_literal(&w, " DELIVERED (backorder #");
+            reply_u64(&w, b->id);
+            reply_literal(&w, ")");
+        }
+        reply_literal(&w, " [version ");
+        reply_u64(&w, version);
+        reply_literal(&w, "]");
+        if (b->expired){
+            reply_literal(&w, "\n");
+        }
+
+        // A requester that is gone only costs the datagram
+        if (sendto(b->fd, reply, reply_len(&w), MSG_DONTWAIT, (struct sockaddr *)&b->addr, b->addr_len) == -1 &&
+            errno != EAGAIN && errno != EWOULDBLOCK){
+            perror("sendto backorder");
+        }
+    }
+
+    // -I pipeline: this is the apply thread, the owner of the free list
+    if (!warehouse_pipelined){
+        pthread_mutex_lock(&warehouse_mutex);
+    }
+    for (Backorder *b = settled_head, *next; b != NULL; b = next){
+        next = b->next;
+        b->id = 0;
+        b->next = free_backorders;
+        free_backorders = b;
+    }
+    if (!warehouse_pipelined){
+        pthread_mutex_unlock(&warehouse_mutex);
+    }
+    settled_head = settled_tail = NULL;
+}
@@ -0,0 +1,85 @@
+#include <string.h>
+#include <sched.h>
+#include "../../include/functions/combine_funcs.h"
+
+#define COMBINE_SPINS 128           // looks at the slot before yielding the CPU
+
+// The slot of this thread and the combiner it belongs to
+static __thread Combiner *slot_owner = NULL;
+static __thread CombineSlot *own_slot = NULL;
+
+void combiner_init(Combiner *c, CombineApply apply, void *data){
+    memset(c, 0, sizeof(*c));
+    c->apply = apply;
+    c->data = data;
+}
+
+static CombineSlot *thread_slot(Combiner *c){
+    if (slot_owner != c){
+        unsigned int i = __atomic_fetch_add(&c->registered, 1, __ATOMIC_ACQ_REL);
+        slot_owner = c;
+        own_slot = i < COMBINE_SLOTS ? &c->slots[i] : NULL;
+    }
+    return own_slot;
+}
+
+static int try_combiner(Combiner *c){
+    return !__atomic_load_n(&c->busy, __ATOMIC_RELAXED) && !__atomic_exchange_n(&c->busy, 1, __ATOMIC_ACQUIRE);
+}
+
+// One turn as combiner, a few scans so the waiters that publish meanwhile ride along
+static void run_combiner(Combiner *c){
+    void *ops[COMBINE_SLOTS];
+    CombineSlot *taken[COMBINE_SLOTS];
+    for (int pass = 0; pass < COMBINE_PASSES; pass++){
+        unsigned int slots = __atomic_load_n(&c->registered, __ATOMIC_ACQUIRE);
+        if (slots > COMBINE_SLOTS){
+            slots = COMBINE_SLOTS;
+        }
+        int count = 0;
+        for (unsigned int i = 0; i < slots; i++){
+            void *op = __atomic_load_n(&c->slots[i].op, __ATOMIC_ACQUIRE);
+            if (op != NULL){
+                taken[count] = &c->slots[i];
+                ops[count++] = op;
+            }
+        }
+        if (count == 0){
+            break;
+        }
+        c->apply(c, ops, count);
+        __atomic_store_n(&c->batches, c->batches + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&c->combined, c->combined + count, __ATOMIC_RELAXED);
+        for (int i = 0; i < count; i++){
+            __atomic_store_n(&taken[i]->op, NULL, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+void combine(Combiner *c, void *op){
+    CombineSlot *slot = thread_slot(c);
+    if (slot == NULL){
+        // No slot left: wait for the combiner, then run it alone
+        while (!try_combiner(c)){
+            sched_yield();
+        }
+        c->apply(c, &op, 1);
+        __atomic_store_n(&c->batches, c->batches + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&c->combined, c->combined + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&c->busy, 0, __ATOMIC_RELEASE);
+        return;
+    }
+
+    __atomic_store_n(&slot->op, op, __ATOMIC_RELEASE);
+    for (int spins = 0; __atomic_load_n(&slot->op, __ATOMIC_ACQUIRE) != NULL; spins++){
+        if (try_combiner(c)){
+            run_combiner(c);
+            __atomic_store_n(&c->busy, 0, __ATOMIC_RELEASE);
+            break;      // op was published before the first scan, it ran
+        }
+        if (spins >= COMBINE_SPINS){
+            sched_yield();
+            spins = 0;
+        }
+    }
+}
@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "../../include/const.h"
+#include "../../include/functions/event_loop_funcs.h"
+#include "../../include/functions/drinks_bar_funcs.h"
+#include "../../include/functions/timer_wheel_funcs.h"
+#include "../../include/functions/connection_funcs.h"
+#include "../../include/functions/latency_funcs.h"
+
+static ConnStats unattached_stats;
+__thread ConnStats *conn_stats = &unattached_stats;
+
+void conn_stats_attach(ConnStats *stats){
+    conn_stats = stats;
+}
+
+void conn_stats_read(const ConnStats *stats, ConnStats *out){
+    out->accepted = __atomic_load_n(&stats->accepted, __ATOMIC_RELAXED);
+    out->closed = __atomic_load_n(&stats->closed, __ATOMIC_RELAXED);
+    out->messages = __atomic_load_n(&stats->messages, __ATOMIC_RELAXED);
+    out->bytes_in = __atomic_load_n(&stats->bytes_in, __ATOMIC_RELAXED);
+    out->bytes_out = __atomic_load_n(&stats->bytes_out, __ATOMIC_RELAXED);
+}
+
+// Free connections of this reactor, threaded through next_free
+static __thread Connection *conn_free_list = NULL;
+
+// Carves a new slab into CONN_SLAB_SIZE free connections. Slabs are
+// never returned to malloc, the pool keeps the peak number of clients.
+static int conn_pool_grow(void){
+    Connection *slab = malloc(CONN_SLAB_SIZE * sizeof(Connection));
+    if (slab == NULL){
+        return -1;
+    }
+    if (low_latency){
+        prefault(slab, CONN_SLAB_SIZE * sizeof(Connection));
+    }
+    for (int i = CONN_SLAB_SIZE - 1; i >= 0; i--){
+        slab[i].next_free = conn_free_list;
+        conn_free_list = &slab[i];
+    }
+    __atomic_add_fetch(&conn_slabs, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int conn_pool_reserve(void){
+    return conn_free_list == NULL ? conn_pool_grow() : 0;
+}
+
+int conn_admit(void){
+    int now = __atomic_add_fetch(&connected_clients, 1, __ATOMIC_RELAXED);
+    if (max_clients > 0 && now > max_clients){
+        __atomic_sub_fetch(&connected_clients, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    return 0;
+}
+
+void conn_release(void){
+    __atomic_sub_fetch(&connected_clients, 1, __ATOMIC_RELAXED);
+}
+
+// The client may have been active since the timer was set, only shut it
+// down once it really was silent for idle_timeout. Closing here could free
+// a connection that still has an event pending in this dispatch round, so
+// the socket is shut down and the read handler closes it on EOF.
+static void on_conn_idle(TimerWheel *w, Timer *t){
+    Connection *c = t->data;
+    unsigned long long idle_ms = monotonic_ms() - c->last_active;
+    if (idle_ms < idle_timeout * 1000ULL){
+        timer_add(w, t, idle_timeout * 1000ULL - idle_ms);
+        return;
+    }
+    printf("server: client on socket %d was idle for %d seconds, disconnecting\n", c->h.fd, idle_timeout);
+    shutdown(c->h.fd, SHUT_RDWR);
+}
+
+Connection *conn_new(int fd, u_int8_t transport){
+    if (conn_free_list == NULL && conn_pool_grow() == -1){
+        perror("malloc");
+        return NULL;
+    }
+    Connection *c = conn_free_list;
+    conn_free_list = c->next_free;
+
+    memset(c, 0, sizeof(*c));
+    c->h.fd = fd;
+    c->h.kind = HANDLER_CLIENT;
+    c->h.on_event = on_stream_client;
+    c->transport = transport;
+    timer_init(&c->idle, on_conn_idle, c);
+    CONN_STAT_ADD(accepted, 1);
+    return c;
+}
+
+void conn_watch_idle(Connection *c){
+    if (idle_timeout > 0){
+        c->last_active = monotonic_ms();
+        timer_add(c->h.loop->wheel, &c->idle, idle_timeout * 1000ULL);
+    }
+}
+
+void conn_free(Connection *c){
+    CONN_STAT_ADD(closed, 1);
+    free(c->out);
+    c->out = NULL;
+    c->next_free = conn_free_list;
+    conn_free_list = c;
+}
+
+void conn_close(Connection *c){
+    timer_del(c->h.loop->wheel, &c->idle);
+    loop_del(c->h.loop, &c->h);
+    close(c->h.fd);
+    conn_free(c);
+    conn_release();
+}
+
+// Appends to the output buffer, -1 if that would pass CONN_OUTBUF_MAX
+static int conn_buffer(Connection *c, const char *data, size_t len){
+    size_t pending = c->out_len - c->out_off;
+    if (pending + len > CONN_OUTBUF_MAX){
+        return -1;
+    }
+
+    // Reuse the space already flushed before growing
+    if (c->out_off > 0){
+        memmove(c->out, c->out + c->out_off, pending);
+        c->out_off = 0;
+        c->out_len = pending;
+    }
+
+    if (c->out_len + len > c->out_cap){
+        size_t cap = c->out_cap ? c->out_cap : 256;
+        while (cap < c->out_len + len){
+            cap *= 2;
+        }
+        if (cap > CONN_OUTBUF_MAX){
+            cap = CONN_OUTBUF_MAX;
+        }
+        char *out = realloc(c->out, cap);
+        if (out == NULL){
+            return -1;
+        }
+        c->out = out;
+        c->out_cap = cap;
+    }
+
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+    return 0;
+}
+
+int conn_send(Connection *c, const char *data, size_t len){
+    struct iovec iov = { (void *)data, len };
+    return conn_sendv(c, &iov, 1);
+}
+
+int conn_sendv(Connection *c, const struct iovec *iov, int count){
+    u_int8_t was_empty = (c->out_len == c->out_off);
+    size_t total = 0, sent = 0;
+    for (int i = 0; i < count; i++){
+        total += iov[i].iov_len;
+    }
+
+    // Nothing queued, so the replies can go straight to the socket. A
+    // short send means its buffer is full, the rest waits for LOOP_WRITE.
+    if (was_empty){
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = (struct iovec *)iov;
+        msg.msg_iovlen = count;
+
+        ssize_t n;
+        do {
+            n = sendmsg(c->h.fd, &msg, MSG_NOSIGNAL);
+        } while (n == -1 && errno == EINTR);
+        if (n == -1){
+            if (errno != EAGAIN && errno != EWOULDBLOCK){
+                perror("send");
+                conn_close(c);
+                return -1;
+            }
+            n = 0;
+        }
+        c->bytes_out += n;
+        CONN_STAT_ADD(bytes_out, n);
+        sent = n;
+        if (sent == total){
+            return 0;
+        }
+    }
+
+    for (int i = 0; i < count; i++){
+        if (sent >= iov[i].iov_len){
+            sent -= iov[i].iov_len;
+            continue;
+        }
+        if (conn_buffer(c, (const char *)iov[i].iov_base + sent, iov[i].iov_len - sent) == -1){
+            fprintf(stderr, "server: client on socket %d is not reading its replies, disconnecting\n", c->h.fd);
+            conn_close(c);
+            return -1;
+        }
+        sent = 0;
+    }
+
+    // First pending byte, start waiting for the socket to drain
+    if (was_empty && loop_mod(c->h.loop, &c->h, LOOP_READ | LOOP_WRITE) == -1){
+        perror("loop_mod");
+        conn_close(c);
+        return -1;
+    }
+    return 0;
+}
+
+int conn_flush(Connection *c){
+    while (c->out_off < c->out_len){
+        ssize_t n = send(c->h.fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+        if (n == -1){
+            if (errno == EINTR){
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK){
+                return 0;   // still full, LOOP_WRITE stays armed
+            }
+            perror("send");
+            conn_close(c);
+            return -1;
+        }
+        c->bytes_out += n;
+        CONN_STAT_ADD(bytes_out, n);
+        c->out_off += n;
+    }
+
+    // All sent, stop asking for POLLOUT/EPOLLOUT
+    c->out_off = 0;
+    c->out_len = 0;
+    if (loop_mod(c->h.loop, &c->h, LOOP_READ) == -1){
+        perror("loop_mod");
+        conn_close(c);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,761 @@
+#define _GNU_SOURCE     // recvmmsg / sendmmsg
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../../include/const.h"
+#include "../../include/functions/atom_warehouse_funcs.h"
+#include "../../include/functions/event_loop_funcs.h"
+#include "../../include/functions/drinks_bar_funcs.h"
+#include "../../include/functions/timer_wheel_funcs.h"
+#include "../../include/functions/connection_funcs.h"
+#include "../../include/functions/uring_loop_funcs.h"
+#include "../../include/functions/latency_funcs.h"
+#include "../../include/functions/wire_funcs.h"
+#include "../../include/functions/stream_funcs.h"
+#include "../../include/functions/resp_funcs.h"
+#include "../../include/functions/hold_funcs.h"
+#include "../../include/functions/backorder_funcs.h"
+#include "../../include/functions/reply_funcs.h"
+
+// flag for storage file
+u_int8_t file_flag = 0;
+int storage_fd = -1;
+
+LoopBackend loop_backend = LOOP_POLL;
+
+int unix_tcp_sockfd = -1;
+int unix_udp_sockfd = -1;
+
+Reactor *reactors = NULL;
+int reactor_count = 0;
+
+int connected_clients = 0;
+int max_clients = 0;
+int conn_slabs = 0;
+
+int idle_timeout = 0;
+volatile sig_atomic_t shutdown_requested = 0;
+unsigned long long server_last_activity = 0;
+
+int dgram_batch = DGRAM_BATCH_DEFAULT;
+int listen_backlog = BACKLOG;
+ServerStats server_stats = {0};
+
+// inactivity timeout of the whole server, -t
+extern int alarm_timeout;
+
+int set_nonblocking(int fd){
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1){
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+void register_server_fd(EventLoop *loop, int fd, u_int8_t kind){
+    Handler *h = calloc(1, sizeof(Handler));
+    if (h == NULL){
+        perror("calloc");
+        exit(1);
+    }
+    h->fd = fd;
+    h->kind = kind;
+
+    u_int32_t events = LOOP_READ;
+    switch(kind){
+        case HANDLER_TCP_LISTEN:
+        case HANDLER_RESP_LISTEN:
+            h->on_event = on_stream_listen;
+            break;
+        case HANDLER_TIMER:
+            h->on_event = on_timer;
+            break;
+        case HANDLER_WAREHOUSE_TIMER:
+            h->on_event = on_warehouse_timer;
+            break;
+        case HANDLER_UDP:
+            h->on_event = on_dgram;
+            break;
+        case HANDLER_UNIX_LISTEN:
+            h->on_event = on_stream_listen;
+            events |= LOOP_SHARED;
+            break;
+        case HANDLER_UNIX_UDP:
+            h->on_event = on_dgram;
+            events |= LOOP_SHARED;
+            break;
+        default:
+            h->on_event = on_stream_client;
+            break;
+    }
+
+    // listeners are drained until EAGAIN, so they must never block
+    if (set_nonblocking(fd) == -1){
+        perror("fcntl");
+        exit(1);
+    }
+
+    if (loop_add(loop, h, events) == -1){
+        perror("loop_add");
+        exit(1);
+    }
+}
+
+void on_timer(Handler *h, u_int32_t events){
+    wheel_expire(h->loop->wheel);
+}
+
+void on_warehouse_timer(Handler *h, u_int32_t events){
+    warehouse_timers_expire(file_flag, storage_fd);
+}
+
+void on_stream_listen(Handler *h, u_int32_t events){
+    if (events & LOOP_ERROR){
+        fprintf(stderr, "Critical error on listening socket (fd %d). Server should exit or restart!\n", h->fd);
+        return;
+    }
+
+    struct sockaddr_storage their_addr;    // Storage for client's address information
+    char s[INET6_ADDRSTRLEN];              // Buffer to store client IP address as string
+
+    // Take the whole queue of pending connections, up to the budget
+    for (int budget = IO_BUDGET; budget > 0; budget--) {
+        socklen_t sin_size = sizeof their_addr;
+        int new_fd = accept4(h->fd, (struct sockaddr *)&their_addr, &sin_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (new_fd == -1) {
+            // EAGAIN also when another reactor won the race for a shared listener,
+            // EMFILE/ENFILE leave the connection queued until a client leaves
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+            }
+            return;
+        }
+        __atomic_add_fetch(&server_stats.accepts, 1, __ATOMIC_RELAXED);
+
+        // Make sure we have room for a new client
+        if (conn_admit() == -1) {
+            printf("server: too many clients, rejecting new connection\n");
+            close(new_fd);
+            continue;
+        }
+
+        Connection *client = conn_new(new_fd, h->kind);
+        if (client == NULL) {
+            conn_release();
+            close(new_fd);
+            continue;
+        }
+
+        if (loop_add(h->loop, &client->h, LOOP_READ) == -1) {
+            perror("loop_add");
+            conn_free(client);
+            conn_release();
+            close(new_fd);
+            continue;
+        }
+        conn_watch_idle(client);
+
+        if (h->kind != HANDLER_UNIX_LISTEN) {
+            inet_ntop(their_addr.ss_family, get_in_addr((struct sockaddr*)&their_addr),
+                      s, sizeof s);
+            printf("server: new %sconnection from %s on socket %d\n", h->kind == HANDLER_RESP_LISTEN ? "RESP " : "", s, new_fd);
+        } else {
+            printf("server: new UNIX TCP connection on socket %d\n", new_fd);
+        }
+    }
+
+    // Budget used up before EAGAIN, let the other fds run first
+    __atomic_add_fetch(&server_stats.yields, 1, __ATOMIC_RELAXED);
+    loop_yield(h->loop, h);
+}
+
+// Per reactor thread: a client's leftover request followed by what one
+// recvmsg() returns, and the replies to it
+static __thread char stream_in[MAXDATASIZE + STREAM_READ_SIZE + 1];
+static __thread StreamBatch stream_batch;
+
+// All the replies of one read leave with one gathering send
+static int send_stream_batch(StreamBatch *b){
+    Connection *c = b->ctx;
+    if (conn_sendv(c, b->iov, b->count) == -1){
+        return -1;
+    }
+    if (!low_latency){
+        printf("server: sent %d response(s) to socket %d\n", b->count, b->fd);
+    }
+    return 0;
+}
+
+void on_stream_client(Handler *h, u_int32_t events){
+    Connection *c = (Connection *)h;
+
+    if (events & LOOP_ERROR){
+        conn_close(c);
+        return;
+    }
+
+    // The socket drained, push out what is still queued
+    if ((events & LOOP_WRITE) && conn_flush(c) == -1){
+        return;
+    }
+    if (!(events & LOOP_READ)){
+        return;
+    }
+
+    StreamBatch *b = &stream_batch;
+    b->fd = h->fd;
+    b->file_flag = file_flag;
+    b->storage_fd = storage_fd;
+    b->flush = send_stream_batch;
+    b->ctx = c;
+    b->count = 0;
+    b->served = 0;
+
+    // Read until EAGAIN, bounded so one busy client cannot starve the others
+    for (int budget = IO_BUDGET; budget > 0; budget--) {
+        // The incomplete request of the last read goes first, the control message carries the arrival time
+        char control[CMSG_SPACE(sizeof(struct timespec))];
+        memcpy(stream_in, c->in, c->in_len);
+        struct iovec iov = { stream_in + c->in_len, STREAM_READ_SIZE };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        int numbytes = recvmsg(h->fd, &msg, 0);
+
+        if (numbytes < 1) {
+            if (numbytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return;
+            }
+            // Error or connection closed
+            if (numbytes == -1) {
+                perror("recv");
+            }
+            conn_close(c);
+            return;
+        }
+
+        // We have data from a client
+        __atomic_add_fetch(&server_stats.stream_reads, 1, __ATOMIC_RELAXED);
+        if (idle_timeout > 0 && budget == IO_BUDGET) {
+            c->last_active = monotonic_ms();
+        }
+        c->bytes_in += numbytes;
+        CONN_STAT_ADD(bytes_in, numbytes);
+        b->arrived = latency_rx_ns(&msg);
+
+        // Answer every complete command of the read, keep the incomplete rest
+        size_t len = c->in_len + numbytes;
+        ssize_t used = c->transport == HANDLER_RESP_LISTEN ? resp_serve(b, stream_in, len)
+                                                           : stream_serve(b, stream_in, len, &c->framed);
+        if (used == STREAM_CLOSED) {
+            return;
+        }
+        c->messages += b->served;
+        CONN_STAT_ADD(messages, b->served);
+        b->served = 0;
+        if (stream_flush(b) == -1) {
+            return;
+        }
+        if (used == STREAM_MALFORMED) {
+            fprintf(stderr, "server: malformed request on socket %d, disconnecting\n", h->fd);
+            conn_close(c);
+            return;
+        }
+        c->in_len = len - used;
+        memcpy(c->in, stream_in + used, c->in_len);
+    }
+
+    __atomic_add_fetch(&server_stats.yields, 1, __ATOMIC_RELAXED);
+    loop_yield(h->loop, h);
+}
+
+// Sends all the replies with as few sendmmsg() calls as possible
+static void flush_replies(int fd, struct mmsghdr *replies, int count){
+    int sent = 0;
+    while (sent < count) {
+        int n = sendmmsg(fd, replies + sent, count - sent, 0);
+        __atomic_add_fetch(&server_stats.send_calls, 1, __ATOMIC_RELAXED);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // the reply at 'sent' failed (e.g. its UNIX peer is gone), skip it
+            perror("sendmmsg");
+            sent++;
+            continue;
+        }
+        __atomic_add_fetch(&server_stats.replies, n, __ATOMIC_RELAXED);
+        sent += n;
+    }
+}
+
+// Per reactor thread, too big for the stack of every wakeup
+static __thread struct DgramBuffers {
+    char bufs[DGRAM_BATCH_MAX][MAXDATASIZE];
+    char responses[DGRAM_BATCH_MAX][256];
+    struct sockaddr_storage addrs[DGRAM_BATCH_MAX];     // large enough for sockaddr_un too
+    char control[DGRAM_BATCH_MAX][CMSG_SPACE(sizeof(struct timespec))];     // SO_TIMESTAMPNS
+    unsigned long long arrived[DGRAM_BATCH_MAX];        // realtime_ns() arrival of each reply's request
+    struct iovec in_iov[DGRAM_BATCH_MAX], out_iov[DGRAM_BATCH_MAX];
+    struct mmsghdr in[DGRAM_BATCH_MAX], out[DGRAM_BATCH_MAX];
+    MessageCall calls[DGRAM_BATCH_MAX];                 // one per reply, see message_submit()
+} dgram_bufs;
+
+static void count_batch(int n){
+    int bucket = 0;
+    while ((1 << (bucket + 1)) <= n && bucket < DGRAM_HIST_BUCKETS - 1) {
+        bucket++;
+    }
+    __atomic_add_fetch(&server_stats.batches, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&server_stats.datagrams, n, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&server_stats.hist[bucket], 1, __ATOMIC_RELAXED);
+}
+
+void on_dgram(Handler *h, u_int32_t events){
+    if (events & LOOP_ERROR){
+        fprintf(stderr, "Critical error on datagram socket (fd %d). Server should exit or restart!\n", h->fd);
+        return;
+    }
+
+    char (*bufs)[MAXDATASIZE] = dgram_bufs.bufs;
+    char (*responses)[256] = dgram_bufs.responses;
+    struct sockaddr_storage *addrs = dgram_bufs.addrs;
+    struct iovec *in_iov = dgram_bufs.in_iov, *out_iov = dgram_bufs.out_iov;
+    struct mmsghdr *in = dgram_bufs.in, *out = dgram_bufs.out;
+    unsigned long long *arrived = dgram_bufs.arrived;
+
+    for (int budget = IO_BUDGET; budget > 0; budget--) {
+        for (int i = 0; i < dgram_batch; i++) {
+            in_iov[i].iov_base = bufs[i];
+            in_iov[i].iov_len = MAXDATASIZE - 1;
+            memset(&in[i], 0, sizeof(in[i]));
+            in[i].msg_hdr.msg_name = &addrs[i];
+            in[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            in[i].msg_hdr.msg_iov = &in_iov[i];
+            in[i].msg_hdr.msg_iovlen = 1;
+            in[i].msg_hdr.msg_control = dgram_bufs.control[i];
+            in[i].msg_hdr.msg_controllen = sizeof(dgram_bufs.control[i]);
+        }
+
+        int n = recvmmsg(h->fd, in, dgram_batch, MSG_DONTWAIT, NULL);
+        if (n == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("recvmmsg");
+            }
+            return;
+        }
+        count_batch(n);
+
+        // Answer the whole batch against the inventory, then reply at once
+        int replies = 0;
+        for (int i = 0; i < n; i++) {
+            int numbytes = in[i].msg_len;
+            if (numbytes == 0) {
+                continue;
+            }
+            arrived[replies] = latency_rx_ns(&in[i].msg_hdr);
+
+            // Nobody waits for the answer any more, not even an error
+            size_t req_len = numbytes;
+            if (request_expired(bufs[i], &req_len, arrived[replies])) {
+                continue;
+            }
+
+            // One datagram is one command, text or a binary frame
+            MessageCall *call = &dgram_bufs.calls[replies];
+            if (wire_is_binary(bufs[i], numbytes)) {
+                message_submit(call, 1, bufs[i], numbytes, UDP_HANDLE, responses[i], sizeof(responses[i]), file_flag, storage_fd);
+            } else {
+                bufs[i][req_len] = '\0';
+                backorder_origin(h->fd, &addrs[i], in[i].msg_hdr.msg_namelen);
+                message_submit(call, 0, bufs[i], req_len, UDP_HANDLE, responses[i], sizeof(responses[i]), file_flag, storage_fd);
+            }
+
+            out_iov[replies].iov_base = responses[i];
+            memset(&out[replies], 0, sizeof(out[replies]));
+            out[replies].msg_hdr.msg_name = &addrs[i];
+            out[replies].msg_hdr.msg_namelen = in[i].msg_hdr.msg_namelen;
+            out[replies].msg_hdr.msg_iov = &out_iov[replies];
+            out[replies].msg_hdr.msg_iovlen = 1;
+            replies++;
+        }
+
+        // With -I pipeline the apply thread ran the batch meanwhile
+        pipeline_wait();
+        for (int r = 0; r < replies; r++) {
+            out_iov[r].iov_len = dgram_bufs.calls[r].len;
+            // A command datagrams do not take, answered rather than an empty datagram
+            if (out_iov[r].iov_len == 0) {
+                out_iov[r].iov_len = sizeof(REPLY_UNKNOWN_COMMAND) - 1;
+                memcpy(out_iov[r].iov_base, REPLY_UNKNOWN_COMMAND, sizeof(REPLY_UNKNOWN_COMMAND));
+            }
+        }
+        flush_replies(h->fd, out, replies);
+
+        unsigned long long sent = realtime_ns();
+        for (int i = 0; i < replies; i++) {
+            latency_record(sent - arrived[i]);
+        }
+
+        // a short batch means the queue is empty
+        if (n < dgram_batch) {
+            return;
+        }
+    }
+
+    __atomic_add_fetch(&server_stats.yields, 1, __ATOMIC_RELAXED);
+    loop_yield(h->loop, h);
+}
+
+void print_server_stats(FILE *out){
+    ServerStats st;
+    memcpy(&st, &server_stats, sizeof(st));
+
+    fprintf(out, "LOOP: wakeups=%llu accepts=%llu stream_reads=%llu yields=%llu reads_per_wakeup=%.2f\n",
+            st.wakeups, st.accepts, st.stream_reads, st.yields,
+            st.wakeups ? (double)(st.accepts + st.stream_reads + st.datagrams) / st.wakeups : 0.0);
+
+    fprintf(out, "CONN: open=%d limit=%d slabs=%d conn_size=%zu slab_bytes=%zu\n",
+            __atomic_load_n(&connected_clients, __ATOMIC_RELAXED), max_clients,
+            __atomic_load_n(&conn_slabs, __ATOMIC_RELAXED), sizeof(Connection),
+            (size_t)__atomic_load_n(&conn_slabs, __ATOMIC_RELAXED) * CONN_SLAB_SIZE * sizeof(Connection));
+
+    fprintf(out, "DGRAM: batches=%llu datagrams=%llu avg_batch=%.2f send_calls=%llu replies=%llu\n",
+            st.batches, st.datagrams, st.batches ? (double)st.datagrams / st.batches : 0.0,
+            st.send_calls, st.replies);
+    fprintf(out, "DGRAM batch sizes:");
+    for (int i = 0; i < DGRAM_HIST_BUCKETS; i++) {
+        if (i == DGRAM_HIST_BUCKETS - 1) {
+            fprintf(out, " %d+:%llu", 1 << i, st.hist[i]);
+        } else {
+            fprintf(out, " %d-%d:%llu", 1 << i, (1 << (i + 1)) - 1, st.hist[i]);
+        }
+    }
+    fprintf(out, "\n");
+    fprintf(out, "DEADLINE: expired=%llu\n", __atomic_load_n(&expired_requests, __ATOMIC_RELAXED));
+    if (warehouse_combining) {
+        unsigned long long batches = __atomic_load_n(&warehouse_combiner.batches, __ATOMIC_RELAXED);
+        unsigned long long combined = __atomic_load_n(&warehouse_combiner.combined, __ATOMIC_RELAXED);
+        fprintf(out, "COMBINE: batches=%llu ops=%llu avg_batch=%.2f\n", batches, combined,
+                batches ? (double)combined / batches : 0.0);
+    }
+    if (warehouse_partitioned) {
+        unsigned long long changes = 0, rebalances = 0;
+        for (int i = 0; i < partition_count; i++) {
+            changes += __atomic_load_n(&partitions[i].changes, __ATOMIC_RELAXED);
+            rebalances += __atomic_load_n(&partitions[i].rebalances, __ATOMIC_RELAXED);
+        }
+        fprintf(out, "PARTITION: slices=%d changes=%llu rebalances=%llu\n", partition_count, changes, rebalances);
+    }
+    if (warehouse_inventory == INVENTORY_PIPELINE) {
+        unsigned long long batches = __atomic_load_n(&pipeline_batches, __ATOMIC_RELAXED);
+        unsigned long long events = __atomic_load_n(&pipeline_events, __ATOMIC_RELAXED);
+        fprintf(out, "PIPELINE: batches=%llu events=%llu avg_batch=%.2f\n", batches, events,
+                batches ? (double)events / batches : 0.0);
+    }
+
+    if (reactors == NULL) {
+        return;
+    }
+    print_latency(out, "LATENCY", &reactors[0].latency, sizeof(Reactor), reactor_count);
+    if (low_latency) {
+        fprintf(out, "SPIN: hits=%llu blocks=%llu budget_us=", st.spin_hits, st.spin_blocks);
+        for (int i = 0; i < reactor_count; i++) {
+            fprintf(out, "%s%llu", i ? "," : "", __atomic_load_n(&reactors[i].spin_ns, __ATOMIC_RELAXED) / 1000);
+        }
+        fprintf(out, "\n");
+    }
+}
+
+int open_inet_socket(const char *port, int socktype, u_int8_t reuseport){
+    int sockfd = -1;
+    int yes = 1;
+    int rv;                      // Return value for getaddrinfo()
+
+    // Network address structures for server setup
+    struct addrinfo hints, *servinfo, *p;  // hints = criteria, servinfo = results list, p = iterator
+
+    // STEP 1: Configure server address criteria
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET;      // Use IPv4
+    hints.ai_socktype = socktype;   // TCP (SOCK_STREAM) or UDP (SOCK_DGRAM)
+    hints.ai_flags = AI_PASSIVE;    // Use local machine's IP address
+
+    // STEP 2: Get list of possible addresses to bind to
+    if ((rv = getaddrinfo(NULL, port, &hints, &servinfo)) != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
+        exit(1);
+    }
+
+    // STEP 3: Try to create socket and bind to first available address
+    for(p = servinfo; p != NULL; p = p->ai_next) {
+        // Create socket with the address family, type, and protocol
+        if ((sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
+            perror("server: socket");
+            continue;  // Try next address if socket creation fails
+        }
+
+        // Arrival timestamps for the latency histogram, busy polling in --low-latency
+        enable_rx_timestamps(sockfd);
+        if (low_latency) {
+            set_busy_poll(sockfd);
+        }
+
+        // Let every reactor bind the same port, the kernel balances between them
+        if (reuseport && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof yes) == -1) {
+            perror("setsockopt SO_REUSEPORT");
+            exit(1);
+        }
+
+        // Bind socket to the address and port
+        if (bind(sockfd, p->ai_addr, p->ai_addrlen) == -1) {
+            close(sockfd);
+            perror("server: bind");
+            continue;  // Try next address if bind fails
+        }
+
+        break;  // Success! Exit the loop
+    }
+
+    freeaddrinfo(servinfo); // Clean up the address list
+
+    // Check if we successfully bound to an address
+    if (p == NULL)  {
+        fprintf(stderr, "server: failed to bind %s socket\n", socktype == SOCK_STREAM ? "TCP" : "UDP");
+        exit(1);
+    }
+
+    // STEP 4: Start listening for client connections
+    if (socktype == SOCK_STREAM && listen(sockfd, listen_backlog) == -1) {
+        perror("listen");
+        exit(1);
+    }
+    return sockfd;
+}
+
+void on_shutdown_signal(int signum){
+    shutdown_requested = SHUTDOWN_SIGNAL;
+}
+
+// Reactor 0's -t timer, the other reactors only publish their activity
+static void on_inactivity(TimerWheel *w, Timer *t){
+    unsigned long long idle_ms = monotonic_ms() - __atomic_load_n(&server_last_activity, __ATOMIC_RELAXED);
+    if (idle_ms < alarm_timeout * 1000ULL) {
+        timer_add(w, t, alarm_timeout * 1000ULL - idle_ms);
+        return;
+    }
+    shutdown_requested = SHUTDOWN_INACTIVE;
+}
+
+// --low-latency wait: polls without blocking until work shows up or the
+// reactor's spin budget runs out, then blocks. The budget doubles when
+// spinning found work and halves when it did not, so a reactor under
+// steady load keeps spinning and an idle one soon goes back to sleep.
+static int spin_then_block(Reactor *r, int (*wait)(void *loop, u_int8_t block), void *loop){
+    unsigned long long start = monotonic_ns();
+    do {
+        int n = wait(loop, 0);
+        if (n != 0) {
+            if (n > 0) {
+                __atomic_store_n(&r->spin_ns, r->spin_ns * 2 < SPIN_MAX_NS ? r->spin_ns * 2 : SPIN_MAX_NS, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&server_stats.spin_hits, 1, __ATOMIC_RELAXED);
+            }
+            return n;
+        }
+    } while (!shutdown_requested && monotonic_ns() - start < r->spin_ns);
+
+    __atomic_store_n(&r->spin_ns, r->spin_ns / 2 > SPIN_MIN_NS ? r->spin_ns / 2 : SPIN_MIN_NS, __ATOMIC_RELAXED);
+    if (shutdown_requested) {
+        return 0;
+    }
+    __atomic_add_fetch(&server_stats.spin_blocks, 1, __ATOMIC_RELAXED);
+    return wait(loop, 1);
+}
+
+static int wait_loop(void *loop, u_int8_t block){
+    return loop_run_once(loop, block ? -1 : 0);
+}
+
+#ifdef HAVE_IO_URING
+static int wait_ring(void *ring, u_int8_t block){
+    return uring_run_once(ring, block);
+}
+#endif
+
+// Book-keeping after each wait, returns 1 when reactor 0 must shut down
+static int after_wakeup(Reactor *r, TimerWheel *w, int n){
+    static __thread unsigned long long noted = 0;
+
+    __atomic_add_fetch(&server_stats.wakeups, 1, __ATOMIC_RELAXED);
+
+    // Anything but the timerfd counts as activity, published once per tick at most
+    if (alarm_timeout > 0 && n > w->fired) {
+        unsigned long long now = monotonic_ms();
+        if (now - noted >= WHEEL_TICK_MS) {
+            noted = now;
+            __atomic_store_n(&server_last_activity, now, __ATOMIC_RELAXED);
+        }
+    }
+    w->fired = 0;
+    return r->id == 0 && shutdown_requested;
+}
+
+// Runs with the warehouse to itself and never gives it back: no request
+// may change it after this point, open holds go back
+static void shutdown_now(void *arg){
+    (void)arg;
+    holds_release_all();
+    if (file_flag && storage_fd != -1) {
+        save_to_file(storage_fd);
+        if (fsync(storage_fd) == -1) {
+            perror("fsync");
+        }
+    }
+
+    if (shutdown_requested == SHUTDOWN_INACTIVE) {
+        fprintf(stdout,"Server didnt recieved any input in the past %d seconds\nTERMINATING!\n", alarm_timeout);
+    } else {
+        fprintf(stdout,"server: caught a termination signal, shutting down\n");
+    }
+    print_server_stats(stdout);
+    exit(0);
+}
+
+void server_shutdown(void){
+    warehouse_call(shutdown_now, NULL);
+}
+
+void *reactor_main(void *arg){
+    Reactor *r = arg;
+
+    // Only the main thread takes SIGINT/SIGTERM, reactor 0 notices them when its wait is interrupted
+    if (r->id != 0) {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGINT);
+        sigaddset(&set, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &set, NULL);
+    }
+
+    conn_stats_attach(&r->stats);
+    latency_attach(&r->latency);
+    partition_attach(r->id);
+
+    // --low-latency: an own CPU, and the hot memory is faulted in before the first request
+    pin_reactor(r->id);
+    if (low_latency) {
+        r->spin_ns = SPIN_MIN_NS;
+        prefault_stack();
+        prefault(&dgram_bufs, sizeof(dgram_bufs));
+        if (conn_pool_reserve() == -1) {
+            perror("malloc");
+        }
+    }
+
+    // Idle timeouts and the -t inactivity timeout of this reactor
+    TimerWheel wheel;
+    if (wheel_init(&wheel) == -1) {
+        perror("timerfd_create");
+        exit(1);
+    }
+    Timer inactivity;
+    if (r->id == 0 && alarm_timeout > 0) {
+        __atomic_store_n(&server_last_activity, monotonic_ms(), __ATOMIC_RELAXED);
+        timer_init(&inactivity, on_inactivity, NULL);
+        timer_add(&wheel, &inactivity, alarm_timeout * 1000ULL);
+    }
+
+#ifdef HAVE_IO_URING
+    if (loop_backend == LOOP_URING) {
+        UringLoop ring;
+        if (uring_init(&ring, storage_fd, file_flag) == -1) {
+            perror("io_uring");
+            exit(1);
+        }
+        ring.wheel = &wheel;
+
+        uring_register_server_fd(&ring, wheel.fd, HANDLER_TIMER);
+        if (r->id == 0) {
+            uring_register_server_fd(&ring, warehouse_wheel.fd, HANDLER_WAREHOUSE_TIMER);
+        }
+        uring_register_server_fd(&ring, r->tcp_sockfd, HANDLER_TCP_LISTEN);
+        uring_register_server_fd(&ring, r->udp_sockfd, HANDLER_UDP);
+        if (unix_udp_sockfd != -1) {
+            uring_register_server_fd(&ring, unix_udp_sockfd, HANDLER_UNIX_UDP);
+        }
+        if (unix_tcp_sockfd != -1) {
+            uring_register_server_fd(&ring, unix_tcp_sockfd, HANDLER_UNIX_LISTEN);
+        }
+        if (r->resp_sockfd != -1) {
+            uring_register_server_fd(&ring, r->resp_sockfd, HANDLER_RESP_LISTEN);
+        }
+
+        while(1) {
+            int n = low_latency ? spin_then_block(r, wait_ring, &ring) : uring_run_once(&ring, 1);
+            if (n == -1) {
+                perror("io_uring_enter");
+                exit(1);
+            }
+            if (after_wakeup(r, &wheel, n)) {
+                uring_quiesce(&ring);
+                server_shutdown();
+            }
+        }
+    }
+#endif
+
+    // Every server fd gets a handler, clients are added by the listeners
+    EventLoop loop;
+    if (loop_init(&loop, loop_backend, LOOP_INITIAL_CAPACITY) == -1) {
+        perror("loop_init");
+        exit(1);
+    }
+    loop.wheel = &wheel;
+
+    register_server_fd(&loop, wheel.fd, HANDLER_TIMER);
+    if (r->id == 0) {
+        register_server_fd(&loop, warehouse_wheel.fd, HANDLER_WAREHOUSE_TIMER);
+    }
+    register_server_fd(&loop, r->tcp_sockfd, HANDLER_TCP_LISTEN);
+    register_server_fd(&loop, r->udp_sockfd, HANDLER_UDP);
+    if (unix_udp_sockfd != -1) {
+        register_server_fd(&loop, unix_udp_sockfd, HANDLER_UNIX_UDP);
+    }
+    if (unix_tcp_sockfd != -1) {
+        register_server_fd(&loop, unix_tcp_sockfd, HANDLER_UNIX_LISTEN);
+    }
+    if (r->resp_sockfd != -1) {
+        register_server_fd(&loop, r->resp_sockfd, HANDLER_RESP_LISTEN);
+    }
+
+    // Main reactor loop - wait for activity and dispatch the ready handlers
+    while(1) {
+
+        // Wait for activity on the sockets (blocks until activity occurs or a timer is due)
+        int n = low_latency ? spin_then_block(r, wait_loop, &loop) : loop_run_once(&loop, -1);
+        if (n == -1) {
+            perror("poll");
+            exit(1);
+        }
+        if (after_wakeup(r, &wheel, n)) {
+            server_shutdown();
+        }
+    }
+    loop_destroy(&loop);
+    wheel_destroy(&wheel);
+    return NULL;
+}
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include "../../include/const.h"
+#include "../../include/functions/event_loop_funcs.h"
+
+#define EPOLL_BATCH 64  // max events returned by one epoll_wait()
+
+int loop_backend_from_str(const char *str, LoopBackend *backend){
+    if (strcmp(str, "poll") == 0){
+        *backend = LOOP_POLL;
+        return 0;
+    }
+    if (strcmp(str, "epoll") == 0){
+        *backend = LOOP_EPOLL;
+        return 0;
+    }
+#ifdef HAVE_IO_URING
+    if (strcmp(str, "uring") == 0){
+        *backend = LOOP_URING;
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+static u_int32_t to_epoll(u_int32_t events){
+    u_int32_t ev = (events & LOOP_LEVEL) ? 0 : EPOLLET;
+    if (events & LOOP_SHARED) ev |= EPOLLEXCLUSIVE;
+    if (events & LOOP_READ)  ev |= EPOLLIN;
+    if (events & LOOP_WRITE) ev |= EPOLLOUT;
+    return ev;
+}
+
+static short to_poll(u_int32_t events){
+    short ev = 0;
+    if (events & LOOP_READ)  ev |= POLLIN;
+    if (events & LOOP_WRITE) ev |= POLLOUT;
+    return ev;
+}
+
+int loop_init(EventLoop *loop, LoopBackend backend, int capacity){
+    memset(loop, 0, sizeof(*loop));
+    loop->backend = backend;
+    loop->epfd = -1;
+
+    if (backend == LOOP_EPOLL){
+        loop->edge_triggered = 1;
+        loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+        return loop->epfd == -1 ? -1 : 0;
+    }
+
+    if (capacity < 1){
+        capacity = 1;
+    }
+    loop->capacity = capacity;
+    loop->pfds = calloc(capacity, sizeof(struct pollfd));
+    loop->handlers = calloc(capacity, sizeof(Handler*));
+    loop->free_slots = calloc(capacity, sizeof(int));
+    if (loop->pfds == NULL || loop->handlers == NULL || loop->free_slots == NULL){
+        free(loop->pfds);
+        free(loop->handlers);
+        free(loop->free_slots);
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+// Doubles the poll arrays, the slots keep their index
+static int loop_grow(EventLoop *loop){
+    int capacity = loop->capacity * 2;
+
+    struct pollfd *pfds = realloc(loop->pfds, capacity * sizeof(struct pollfd));
+    if (pfds == NULL){
+        return -1;
+    }
+    loop->pfds = pfds;
+
+    Handler **handlers = realloc(loop->handlers, capacity * sizeof(Handler*));
+    if (handlers == NULL){
+        return -1;
+    }
+    loop->handlers = handlers;
+
+    int *free_slots = realloc(loop->free_slots, capacity * sizeof(int));
+    if (free_slots == NULL){
+        return -1;
+    }
+    loop->free_slots = free_slots;
+
+    loop->capacity = capacity;
+    return 0;
+}
+
+int loop_add(EventLoop *loop, Handler *h, u_int32_t events){
+    h->loop = loop;
+
+    if (loop->backend == LOOP_EPOLL){
+        struct epoll_event ev;
+        ev.events = to_epoll(events);
+        ev.data.ptr = h;
+        return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, h->fd, &ev);
+    }
+
+    // Reuse a hole left by loop_del(), else append
+    if (loop->free_count > 0){
+        h->slot = loop->free_slots[--loop->free_count];
+    } else {
+        if (loop->nfds == loop->capacity && loop_grow(loop) == -1){
+            errno = ENOMEM;
+            return -1;
+        }
+        h->slot = loop->nfds++;
+    }
+    loop->pfds[h->slot].fd = h->fd;
+    loop->pfds[h->slot].events = to_poll(events);
+    loop->pfds[h->slot].revents = 0;    // the slot may still hold the old owner's events
+    loop->handlers[h->slot] = h;
+    return 0;
+}
+
+int loop_mod(EventLoop *loop, Handler *h, u_int32_t events){
+    if (loop->backend == LOOP_EPOLL){
+        struct epoll_event ev;
+        ev.events = to_epoll(events);
+        ev.data.ptr = h;
+        return epoll_ctl(loop->epfd, EPOLL_CTL_MOD, h->fd, &ev);
+    }
+
+    loop->pfds[h->slot].events = to_poll(events);
+    return 0;
+}
+
+static void defer_unlink(EventLoop *loop, Handler *h){
+    if (h->defer_prev != NULL) h->defer_prev->defer_next = h->defer_next;
+    else loop->defer_head = h->defer_next;
+    if (h->defer_next != NULL) h->defer_next->defer_prev = h->defer_prev;
+    else loop->defer_tail = h->defer_prev;
+    h->defer_prev = h->defer_next = NULL;
+    h->deferred = 0;
+    loop->deferred_count--;
+}
+
+void loop_yield(EventLoop *loop, Handler *h){
+    if (!loop->edge_triggered || h->deferred){
+        return;
+    }
+    h->deferred = 1;
+    h->defer_next = NULL;
+    h->defer_prev = loop->defer_tail;
+    if (loop->defer_tail != NULL) loop->defer_tail->defer_next = h;
+    else loop->defer_head = h;
+    loop->defer_tail = h;
+    loop->deferred_count++;
+}
+
+// Re-runs the handlers that yielded, the ones yielding again wait for the next round
+static void run_deferred(EventLoop *loop){
+    int count = loop->deferred_count;
+    while (count-- > 0 && loop->defer_head != NULL){
+        Handler *h = loop->defer_head;
+        defer_unlink(loop, h);
+        h->on_event(h, LOOP_READ);
+    }
+}
+
+void loop_del(EventLoop *loop, Handler *h){
+    if (h->deferred){
+        defer_unlink(loop, h);
+    }
+
+    if (loop->backend == LOOP_EPOLL){
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, h->fd, NULL);
+        return;
+    }
+
+    // Leave a hole that poll() skips, the next loop_add() fills it
+    loop->pfds[h->slot].fd = -1;
+    loop->pfds[h->slot].revents = 0;
+    loop->handlers[h->slot] = NULL;
+    loop->free_slots[loop->free_count++] = h->slot;
+}
+
+static int run_epoll(EventLoop *loop, int timeout_ms){
+    struct epoll_event events[EPOLL_BATCH];
+
+    int n = epoll_wait(loop->epfd, events, EPOLL_BATCH, timeout_ms);
+    if (n == -1){
+        return errno == EINTR ? 0 : -1;
+    }
+
+    for (int i = 0; i < n; i++){
+        Handler *h = events[i].data.ptr;
+        u_int32_t ev = 0;
+        if (events[i].events & EPOLLIN)  ev |= LOOP_READ;
+        if (events[i].events & EPOLLOUT) ev |= LOOP_WRITE;
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) ev |= LOOP_ERROR;
+        h->on_event(h, ev);
+    }
+    return n;
+}
+
+static int run_poll(EventLoop *loop, int timeout_ms){
+    int n = poll(loop->pfds, loop->nfds, timeout_ms);
+    if (n == -1){
+        return errno == EINTR ? 0 : -1;
+    }
+
+    // Handlers added during dispatch start with no revents and wait for the next round
+    int count = loop->nfds;
+    for (int i = 0; i < count; i++){
+        short re = loop->pfds[i].revents;
+        Handler *h = loop->handlers[i];
+        if (re == 0 || h == NULL){
+            continue;
+        }
+        loop->pfds[i].revents = 0;
+
+        u_int32_t ev = 0;
+        if (re & POLLIN)  ev |= LOOP_READ;
+        if (re & POLLOUT) ev |= LOOP_WRITE;
+        if (re & (POLLERR | POLLHUP | POLLNVAL)) ev |= LOOP_ERROR;
+        h->on_event(h, ev);
+    }
+    return n;
+}
+
+int loop_run_once(EventLoop *loop, int timeout_ms){
+    // Deferred work is ready now, only collect new events
+    if (loop->defer_head != NULL){
+        timeout_ms = 0;
+    }
+
+    int n = loop->backend == LOOP_EPOLL ? run_epoll(loop, timeout_ms) : run_poll(loop, timeout_ms);
+    if (n == -1){
+        return -1;
+    }
+    if (loop->defer_head != NULL){
+        n += loop->deferred_count;
+        run_deferred(loop);
+    }
+    return n;
+}
+
+void loop_destroy(EventLoop *loop){
+    if (loop->epfd != -1){
+        close(loop->epfd);
+    }
+    free(loop->pfds);
+    free(loop->handlers);
+    free(loop->free_slots);
+    memset(loop, 0, sizeof(*loop));
+    loop->epfd = -1;
+}
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "../../include/const.h"
+#include "../../include/functions/hold_funcs.h"
+#include "../../include/functions/atom_warehouse_funcs.h"
+#include "../../include/functions/timer_wheel_funcs.h"
+#include "../../include/functions/latency_funcs.h"
+
+_Static_assert((HOLDS_MAX & (HOLDS_MAX - 1)) == 0, "hold ids keep the slot in their low bits");
+
+#define HOLD_SLOT_BITS __builtin_ctz(HOLDS_MAX)
+
+static Hold holds[HOLDS_MAX];
+static Hold *free_holds = NULL;
+static unsigned long long hold_sequence = 0;   // the high bits of the ids, a settled id is never reused
+
+void holds_init(void){
+    for (int i = HOLDS_MAX - 1; i >= 0; i--){
+        holds[i].next_free = free_holds;
+        free_holds = &holds[i];
+    }
+}
+
+// The open hold of an id, NULL if it is unknown, expired or settled
+static Hold *find_hold(unsigned long long id){
+    Hold *h = &holds[id & (HOLDS_MAX - 1)];
+    return id != 0 && h->id == id ? h : NULL;
+}
+
+static void free_hold(Hold *h, Hold *held){
+    if (held != NULL){
+        *held = *h;
+    }
+    timer_del(&warehouse_wheel, &h->ttl);
+    h->id = 0;
+    h->next_free = free_holds;
+    free_holds = h;
+}
+
+static void put_back(const Hold *h){
+    warehouse.carbon += h->atoms.carbon;
+    warehouse.oxygen += h->atoms.oxygen;
+    warehouse.hydrogen += h->atoms.hydrogen;
+}
+
+// The TTL is over: the atoms go back as if the hold was released,
+// warehouse_timers_expire() saves them
+static void on_hold_expire(TimerWheel *w, Timer *t){
+    Hold *h = t->data;
+    if (!low_latency){
+        printf("HOLD #%llu expired, its atoms are back in the warehouse\n", h->id);
+    }
+    put_back(h);
+    free_hold(h, NULL);
+}
+
+WarehouseStatus warehouse_hold(Element element, unsigned long long amount, unsigned long long ttl, unsigned long long *id){
+    if (free_holds == NULL){
+        return WAREHOUSE_HOLDS_FULL;
+    }
+    AtomStorage taken;
+    WarehouseStatus status = warehouse_take(element, amount, &taken);
+    if (status != WAREHOUSE_OK){
+        return status;
+    }
+
+    Hold *h = free_holds;
+    free_holds = h->next_free;
+    h->id = (++hold_sequence << HOLD_SLOT_BITS) | (unsigned long long)(h - holds);
+    h->element = element;
+    h->amount = amount;
+    h->atoms = taken;
+    timer_init(&h->ttl, on_hold_expire, h);
+    timer_add(&warehouse_wheel, &h->ttl, ttl * 1000ULL);
+    *id = h->id;
+    return WAREHOUSE_OK;
+}
+
+WarehouseStatus warehouse_commit(unsigned long long id, Hold *held){
+    Hold *h = find_hold(id);
+    if (h == NULL){
+        return WAREHOUSE_NO_HOLD;
+    }
+    free_hold(h, held);
+    return WAREHOUSE_OK;
+}
+
+WarehouseStatus warehouse_release(unsigned long long id, Hold *held){
+    Hold *h = find_hold(id);
+    if (h == NULL){
+        return WAREHOUSE_NO_HOLD;
+    }
+    put_back(h);
+    free_hold(h, held);
+    return WAREHOUSE_OK;
+}
+
+// warehouse_apply_hold() on the apply thread (-I pipeline)
+typedef struct HoldCall {
+    WarehouseOp op;
+    Element element;
+    unsigned long long amount, ttl;
+    unsigned long long *id;
+    const unsigned long long *if_version;
+    unsigned long long *version;
+    WarehouseStatus status;
+} HoldCall;
+
+static void run_hold_call(void *arg){
+    HoldCall *c = arg;
+    c->status = warehouse_apply_hold(c->op, c->element, c->amount, c->ttl, c->id, c->if_version, c->version, 0, -1);
+}
+
+WarehouseStatus warehouse_apply_hold(WarehouseOp op, Element element, unsigned long long amount, unsigned long long ttl,
+                                     unsigned long long *id, const unsigned long long *if_version,
+                                     unsigned long long *version, int file_flag, int fd){
+    if (pipeline_active()){
+        HoldCall call = {op, element, amount, ttl, id, if_version, version};
+        pipeline_call(run_hold_call, &call);
+        return call.status;
+    }
+    warehouse_lock();
+    AtomStorage before = warehouse;
+    WarehouseStatus status = WAREHOUSE_VERSION_MISMATCH;
+    if (if_version == NULL || *if_version == warehouse_generation){
+        if(file_flag){
+            reload_from_file(fd);
+        }
+        before = warehouse;
+        switch(op){
+            case WAREHOUSE_OP_HOLD:
+                status = warehouse_hold(element, amount, ttl, id);
+                break;
+            case WAREHOUSE_OP_COMMIT:
+                status = warehouse_commit(*id, NULL);
+                break;
+            default:
+                status = warehouse_release(*id, NULL);
+                break;
+        }
+    }
+    // COMMIT leaves the inventory as it is, the hold already took the atoms
+    warehouse_unlock(&before, NULL, version, file_flag, fd);
+    return status;
+}
+
+void holds_release_all(void){
+    for (int i = 0; i < HOLDS_MAX; i++){
+        if (holds[i].id != 0){
+            put_back(&holds[i]);
+            free_hold(&holds[i], NULL);
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#include "../../include/functions/inventory_funcs.h"
+
+// Takes n from one counter unless that would go below zero
+static int take(unsigned long long *counter, unsigned long long n){
+    if (n == 0){
+        return 0;
+    }
+    unsigned long long have = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    do {
+        if (have < n){
+            return -1;
+        }
+    } while (!__atomic_compare_exchange_n(counter, &have, have - n, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    return 0;
+}
+
+int inventory_reserve(AtomStorage *inv, const AtomStorage *need){
+    unsigned long long *counters[3] = {&inv->carbon, &inv->oxygen, &inv->hydrogen};
+    const unsigned long long amounts[3] = {need->carbon, need->oxygen, need->hydrogen};
+
+    for (int i = 0; i < 3; i++){
+        if (take(counters[i], amounts[i]) == -1){
+            // Roll back what this reservation already took
+            while (--i >= 0){
+                __atomic_add_fetch(counters[i], amounts[i], __ATOMIC_RELEASE);
+            }
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void inventory_add(AtomStorage *inv, const AtomStorage *amount){
+    if (amount->carbon){
+        __atomic_add_fetch(&inv->carbon, amount->carbon, __ATOMIC_RELEASE);
+    }
+    if (amount->oxygen){
+        __atomic_add_fetch(&inv->oxygen, amount->oxygen, __ATOMIC_RELEASE);
+    }
+    if (amount->hydrogen){
+        __atomic_add_fetch(&inv->hydrogen, amount->hydrogen, __ATOMIC_RELEASE);
+    }
+}
+
+void inventory_load(const AtomStorage *inv, AtomStorage *out){
+    out->carbon = __atomic_load_n(&inv->carbon, __ATOMIC_ACQUIRE);
+    out->oxygen = __atomic_load_n(&inv->oxygen, __ATOMIC_ACQUIRE);
+    out->hydrogen = __atomic_load_n(&inv->hydrogen, __ATOMIC_ACQUIRE);
+}
+
+void inventory_store(AtomStorage *inv, const AtomStorage *value){
+    __atomic_store_n(&inv->carbon, value->carbon, __ATOMIC_RELEASE);
+    __atomic_store_n(&inv->oxygen, value->oxygen, __ATOMIC_RELEASE);
+    __atomic_store_n(&inv->hydrogen, value->hydrogen, __ATOMIC_RELEASE);
+}
+
+void inventory_write_begin(InventorySeq *s){
+    __atomic_add_fetch(&s->begun, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_RELEASE);    // the counters change after begun
+}
+
+void inventory_write_end(InventorySeq *s){
+    __atomic_add_fetch(&s->ended, 1, __ATOMIC_SEQ_CST);
+}
+
+int inventory_seq_idle(const InventorySeq *s){
+    unsigned long long ended = __atomic_load_n(&s->ended, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&s->begun, __ATOMIC_SEQ_CST) == ended;
+}
+
+unsigned long long inventory_read_begin(const InventorySeq *s){
+    return __atomic_load_n(&s->ended, __ATOMIC_ACQUIRE);
+}
+
+int inventory_read_retry(const InventorySeq *s, unsigned long long start){
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);    // the copy is read before begun
+    return __atomic_load_n(&s->begun, __ATOMIC_RELAXED) != start;
+}
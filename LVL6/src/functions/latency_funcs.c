@@ -0,0 +1,288 @@
+#define _GNU_SOURCE     // CPU_SET / pthread_setaffinity_np
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include "../../include/const.h"
+#include "../../include/functions/latency_funcs.h"
+#include "../../include/functions/parse_funcs.h"
+#include "../../include/functions/wire_funcs.h"
+
+u_int8_t low_latency = 0;
+int busy_poll_usec = BUSY_POLL_DEFAULT_US;
+int *pin_cpus = NULL;
+int pin_cpu_count = 0;
+unsigned long long expired_requests = 0;
+
+static LatencyHist unattached_hist;
+__thread LatencyHist *latency_hist = &unattached_hist;
+
+// mlockall() failed, prefault() then tries to lock each buffer on its own
+static u_int8_t memory_locked = 0;
+
+void latency_attach(LatencyHist *hist){
+    latency_hist = hist;
+}
+
+unsigned long long realtime_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int request_expired(const char *buf, size_t *len, unsigned long long arrived){
+    unsigned long long timeout_ms = 0;
+    if (wire_is_binary(buf, *len)){
+        if (*len >= WIRE_HEADER_SIZE){
+            timeout_ms = wire_request_timeout(buf);
+        }
+    } else if (parse_timeout(buf, len, &timeout_ms) != 1){
+        return 0;       // a malformed TIMEOUT_MS is process_message()'s to report
+    }
+
+    unsigned long long now = realtime_ns();
+    if (timeout_ms == 0 || now <= arrived || (now - arrived) / 1000000ULL < timeout_ms){
+        return 0;
+    }
+    __atomic_add_fetch(&expired_requests, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+unsigned long long monotonic_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void enable_rx_timestamps(int fd){
+    int yes = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &yes, sizeof yes) == -1){
+        perror("setsockopt SO_TIMESTAMPNS");
+    }
+}
+
+unsigned long long latency_rx_ns(const struct msghdr *msg){
+    if (msg->msg_control != NULL){
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(msg); cm != NULL; cm = CMSG_NXTHDR((struct msghdr *)msg, cm)){
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS){
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+                return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+            }
+        }
+    }
+    return realtime_ns();
+}
+
+static int bucket_of(unsigned long long ns){
+    if (ns < LAT_SUB_BUCKETS){
+        return (int)ns;
+    }
+    int e = 63 - __builtin_clzll(ns);
+    int b = (e - LAT_SUB_BITS + 1) * LAT_SUB_BUCKETS + (int)((ns >> (e - LAT_SUB_BITS)) & (LAT_SUB_BUCKETS - 1));
+    return b < LAT_BUCKETS ? b : LAT_BUCKETS - 1;
+}
+
+// Middle of the values a bucket holds
+static unsigned long long bucket_value(int b){
+    if (b < LAT_SUB_BUCKETS){
+        return b;
+    }
+    int e = b / LAT_SUB_BUCKETS + LAT_SUB_BITS - 1;
+    unsigned long long low = (unsigned long long)(LAT_SUB_BUCKETS + b % LAT_SUB_BUCKETS) << (e - LAT_SUB_BITS);
+    return low + ((1ULL << (e - LAT_SUB_BITS)) >> 1);
+}
+
+void latency_record(unsigned long long ns){
+    LatencyHist *h = latency_hist;
+    int b = bucket_of(ns);
+    __atomic_store_n(&h->buckets[b], h->buckets[b] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+    if (ns > h->max_ns){
+        __atomic_store_n(&h->max_ns, ns, __ATOMIC_RELAXED);
+    }
+}
+
+// Smallest recorded value with at least q of all the samples at or below it
+static unsigned long long percentile(const unsigned long long *buckets, unsigned long long count, double q){
+    unsigned long long rank = (unsigned long long)(q * count);
+    if (rank < 1){
+        rank = 1;
+    }
+    unsigned long long seen = 0;
+    for (int b = 0; b < LAT_BUCKETS; b++){
+        seen += buckets[b];
+        if (seen >= rank){
+            return bucket_value(b);
+        }
+    }
+    return 0;
+}
+
+void print_latency(FILE *out, const char *label, const LatencyHist *hists, size_t stride, int n){
+    static unsigned long long merged[LAT_BUCKETS];
+    static pthread_mutex_t merge_mutex = PTHREAD_MUTEX_INITIALIZER;
+    unsigned long long count = 0, max_ns = 0;
+
+    pthread_mutex_lock(&merge_mutex);
+    memset(merged, 0, sizeof(merged));
+    for (int i = 0; i < n; i++){
+        const LatencyHist *h = (const LatencyHist *)((const char *)hists + i * stride);
+        for (int b = 0; b < LAT_BUCKETS; b++){
+            unsigned long long v = __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+            merged[b] += v;
+            count += v;     // the sum of the buckets read, not h->count, so the ranks stay consistent
+        }
+        unsigned long long m = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+        if (m > max_ns){
+            max_ns = m;
+        }
+    }
+
+    if (count == 0){
+        fprintf(out, "%s: count=0\n", label);
+    } else {
+        fprintf(out, "%s: count=%llu p50=%.1fus p99=%.1fus p999=%.1fus max=%.1fus\n", label, count,
+                percentile(merged, count, 0.50) / 1000.0, percentile(merged, count, 0.99) / 1000.0,
+                percentile(merged, count, 0.999) / 1000.0, max_ns / 1000.0);
+    }
+    pthread_mutex_unlock(&merge_mutex);
+}
+
+int parse_cpu_list(const char *str){
+    int cap = 8, count = 0;
+    int *cpus = malloc(cap * sizeof(int));
+    if (cpus == NULL){
+        return -1;
+    }
+
+    const char *p = str;
+    while (*p != '\0'){
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p || first < 0 || first >= CPU_SETSIZE){
+            free(cpus);
+            return -1;
+        }
+        p = end;
+        if (*p == '-'){
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first || last >= CPU_SETSIZE){
+                free(cpus);
+                return -1;
+            }
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++){
+            if (count == cap){
+                cap *= 2;
+                int *grown = realloc(cpus, cap * sizeof(int));
+                if (grown == NULL){
+                    free(cpus);
+                    return -1;
+                }
+                cpus = grown;
+            }
+            cpus[count++] = (int)cpu;
+        }
+        if (*p == ','){
+            p++;
+        } else if (*p != '\0'){
+            free(cpus);
+            return -1;
+        }
+    }
+    if (count == 0){
+        free(cpus);
+        return -1;
+    }
+
+    free(pin_cpus);
+    pin_cpus = cpus;
+    pin_cpu_count = count;
+    return 0;
+}
+
+int allowed_cpu_list(void){
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1){
+        return -1;
+    }
+    int *cpus = malloc(CPU_COUNT(&allowed) * sizeof(int));
+    if (cpus == NULL){
+        return -1;
+    }
+    int count = 0;
+    for (int i = 0; i < CPU_SETSIZE; i++){
+        if (CPU_ISSET(i, &allowed)){
+            cpus[count++] = i;
+        }
+    }
+
+    free(pin_cpus);
+    pin_cpus = cpus;
+    pin_cpu_count = count;
+    return 0;
+}
+
+void pin_reactor(int id){
+    if (pin_cpu_count == 0){
+        return;
+    }
+    int cpu = pin_cpus[id % pin_cpu_count];
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0){
+        fprintf(stderr, "server: reactor %d: cannot pin to CPU %d: %s\n", id, cpu, strerror(rc));
+        return;
+    }
+    printf("server: reactor %d pinned to CPU %d\n", id, cpu);
+}
+
+void set_busy_poll(int fd){
+    static u_int8_t warned = 0;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_usec, sizeof busy_poll_usec) == -1 &&
+        !__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED)){
+        perror("setsockopt SO_BUSY_POLL (needs CAP_NET_ADMIN above net.core.busy_read)");
+    }
+}
+
+void lock_memory(void){
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0){
+        memory_locked = 1;
+        return;
+    }
+    perror("mlockall (RLIMIT_MEMLOCK), prefaulting the hot buffers only");
+}
+
+void prefault(void *addr, size_t len){
+    if (!memory_locked){
+        mlock(addr, len);       // best effort, RLIMIT_MEMLOCK may not cover it
+    }
+    // Write every page back to itself, a read alone could map the shared zero page
+    volatile char *p = addr;
+    for (size_t i = 0; i < len; i += 4096){
+        p[i] = p[i];
+    }
+    if (len > 0){
+        p[len - 1] = p[len - 1];
+    }
+}
+
+void prefault_stack(void){
+    volatile char stack[STACK_PREFAULT];
+    for (size_t i = 0; i < sizeof(stack); i += 4096){
+        stack[i] = 0;
+    }
+}
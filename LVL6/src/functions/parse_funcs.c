@@ -0,0 +1,222 @@
+#include <string.h>
+#include "../../include/const.h"
+#include "../../include/elements.h"
+#include "../../include/functions/parse_funcs.h"
+
+#define MAX_TOKENS 4        // one more than any command has, to find the GEN element's second word
+
+typedef struct Token {
+    const char *p;
+    size_t len;
+} Token;
+
+static int is_blank(char c){
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+Command command_from_name(const char *name, size_t len){
+    if (len == 0){
+        return CMD_UNKNOWN;
+    }
+    switch (COMMAND_HASH(name[0], name[len - 1], len)){
+        case COMMAND_HASH('A', 'D', 3):
+            return len == 3 && memcmp(name, "ADD", 3) == 0 ? CMD_ADD : CMD_UNKNOWN;
+        case COMMAND_HASH('D', 'R', 7):
+            return len == 7 && memcmp(name, "DELIVER", 7) == 0 ? CMD_DELIVER : CMD_UNKNOWN;
+        case COMMAND_HASH('G', 'N', 3):
+            return len == 3 && memcmp(name, "GEN", 3) == 0 ? CMD_GEN : CMD_UNKNOWN;
+        case COMMAND_HASH('O', 'R', 5):
+            return len == 5 && memcmp(name, "ORDER", 5) == 0 ? CMD_ORDER : CMD_UNKNOWN;
+        case COMMAND_HASH('H', 'D', 4):
+            return len == 4 && memcmp(name, "HOLD", 4) == 0 ? CMD_HOLD : CMD_UNKNOWN;
+        case COMMAND_HASH('C', 'T', 6):
+            return len == 6 && memcmp(name, "COMMIT", 6) == 0 ? CMD_COMMIT : CMD_UNKNOWN;
+        case COMMAND_HASH('R', 'E', 7):
+            return len == 7 && memcmp(name, "RELEASE", 7) == 0 ? CMD_RELEASE : CMD_UNKNOWN;
+        default:
+            return CMD_UNKNOWN;
+    }
+}
+
+// A decimal amount, all digits and no overflow. -1 otherwise.
+static int parse_amount(const Token *t, unsigned long long *amount){
+    unsigned long long v = 0;
+    for (size_t i = 0; i < t->len; i++){
+        unsigned d = (unsigned char)t->p[i] - '0';
+        if (d > 9 || v > (~0ULL - d) / 10){
+            return -1;
+        }
+        v = v * 10 + d;
+    }
+    *amount = v;
+    return 0;
+}
+
+// The words of a two word element name, looked up as "FIRST SECOND"
+static Element two_word_element(const Token *first, const Token *second){
+    // Usually they are already one space apart in the buffer
+    if (second->p == first->p + first->len + 1 && first->p[first->len] == ' '){
+        return element_from_name(first->p, second->p + second->len - first->p);
+    }
+    char name[MAXDATASIZE];
+    if (first->len + 1 + second->len > sizeof(name)){
+        return UNKNOWN;
+    }
+    memcpy(name, first->p, first->len);
+    name[first->len] = ' ';
+    memcpy(name + first->len + 1, second->p, second->len);
+    return element_from_name(name, first->len + 1 + second->len);
+}
+
+// Up to max words of buf, stops at a NUL. Number of words found.
+static int tokenize(const char *buf, size_t len, Token *tokens, int max){
+    int count = 0;
+    const char *p = buf, *end = buf + len;
+
+    while (count < max){
+        while (p < end && is_blank(*p)){
+            p++;
+        }
+        if (p == end || *p == '\0'){
+            break;
+        }
+        tokens[count].p = p;
+        while (p < end && *p != '\0' && !is_blank(*p)){
+            p++;
+        }
+        tokens[count].len = p - tokens[count].p;
+        count++;
+    }
+    return count;
+}
+
+void parse_request(const char *buf, size_t len, Request *req){
+    Token tokens[MAX_TOKENS];
+    int count = tokenize(buf, len, tokens, MAX_TOKENS);
+
+    memset(req, 0, sizeof(*req));
+    req->cmd = count > 0 ? command_from_name(tokens[0].p, tokens[0].len) : CMD_UNKNOWN;
+    req->element = UNKNOWN;
+
+    if (count >= 3 && parse_amount(&tokens[2], &req->amount) == 0){
+        req->has_amount = 1;
+        req->element = element_from_name(tokens[1].p, tokens[1].len);
+    } else if (count == 2 || (count >= 3 && tokens[2].len <= 1)){
+        req->element = element_from_name(tokens[1].p, tokens[1].len);
+    } else if (count >= 3){
+        req->element = two_word_element(&tokens[1], &tokens[2]);
+    }
+}
+
+int parse_order(const char *buf, size_t len, OrderItem *items){
+    // One word more than a full order, to tell it was too long
+    Token tokens[2 + 2 * ORDER_ITEMS_MAX];
+    int count = tokenize(buf, len, tokens, 2 + 2 * ORDER_ITEMS_MAX);
+    if (count < 3 || count % 2 == 0){
+        return -1;
+    }
+
+    int n = 0;
+    for (int i = 1; i < count; i += 2, n++){
+        if (parse_amount(&tokens[i + 1], &items[n].amount) == -1){
+            return -1;
+        }
+        items[n].molecule = element_from_name(tokens[i].p, tokens[i].len);
+    }
+    return n;
+}
+
+// "<name> <value>" at the end of a command, cut off. Words are found
+// from the end, the command stops at a NUL. 1, 0 if absent, -1 if the
+// value is missing or not a decimal that fits.
+static int trailing_option(const char *buf, size_t *len, const char *name, size_t name_len, unsigned long long *value){
+    const char *nul = memchr(buf, '\0', *len);
+    size_t end = nul != NULL ? (size_t)(nul - buf) : *len;
+    while (end > 0 && is_blank(buf[end - 1])){
+        end--;
+    }
+    size_t start = end;
+    while (start > 0 && !is_blank(buf[start - 1])){
+        start--;
+    }
+    if (end - start == name_len && memcmp(buf + start, name, name_len) == 0){
+        return -1;      // the value is missing
+    }
+
+    size_t word_end = start;
+    while (word_end > 0 && is_blank(buf[word_end - 1])){
+        word_end--;
+    }
+    size_t word = word_end;
+    while (word > 0 && !is_blank(buf[word - 1])){
+        word--;
+    }
+    if (word_end - word != name_len || memcmp(buf + word, name, name_len) != 0){
+        return 0;
+    }
+
+    Token number = {buf + start, end - start};
+    if (parse_amount(&number, value) == -1){
+        return -1;
+    }
+    *len = word;
+    return 1;
+}
+
+int parse_if_version(const char *buf, size_t *len, unsigned long long *version){
+    return trailing_option(buf, len, "IF_VERSION", 10, version);
+}
+
+int parse_timeout(const char *buf, size_t *len, unsigned long long *timeout_ms){
+    return trailing_option(buf, len, "TIMEOUT_MS", 10, timeout_ms);
+}
+
+int parse_backorder(const char *buf, size_t len, unsigned long long *priority, unsigned long long *deadline){
+    // One word more than the longest form, to tell it was too long
+    Token tokens[9];
+    int count = tokenize(buf, len, tokens, 9);
+    *priority = 0;
+    *deadline = BACKORDER_DEADLINE_DEFAULT;
+    if (count < 4 || tokens[3].len != 9 || memcmp(tokens[3].p, "BACKORDER", 9) != 0){
+        return 0;
+    }
+
+    u_int8_t seen_priority = 0, seen_deadline = 0;
+    for (int i = 4; i < count; i += 2){
+        if (i + 1 == count){
+            return -1;
+        }
+        if (tokens[i].len == 8 && memcmp(tokens[i].p, "PRIORITY", 8) == 0 && !seen_priority){
+            seen_priority = 1;
+            if (parse_amount(&tokens[i + 1], priority) == -1){
+                return -1;
+            }
+        } else if (tokens[i].len == 8 && memcmp(tokens[i].p, "DEADLINE", 8) == 0 && !seen_deadline){
+            seen_deadline = 1;
+            if (parse_amount(&tokens[i + 1], deadline) == -1){
+                return -1;
+            }
+        } else {
+            return -1;
+        }
+    }
+    return count == 9 ? -1 : 1;
+}
+
+int parse_hold(const char *buf, size_t len, Element *element, unsigned long long *amount, unsigned long long *ttl){
+    Token tokens[MAX_TOKENS + 1];
+    if (tokenize(buf, len, tokens, MAX_TOKENS + 1) != 4 ||
+        parse_amount(&tokens[2], amount) == -1 || parse_amount(&tokens[3], ttl) == -1){
+        return -1;
+    }
+    *element = element_from_name(tokens[1].p, tokens[1].len);
+    return 0;
+}
+
+int parse_hold_id(const char *buf, size_t len, unsigned long long *id){
+    Token tokens[3];
+    if (tokenize(buf, len, tokens, 3) != 2 || parse_amount(&tokens[1], id) == -1){
+        return -1;
+    }
+    return 0;
+}
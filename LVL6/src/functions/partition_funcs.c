@@ -0,0 +1,156 @@
+#include <string.h>
+#include <sched.h>
+#include "../../include/functions/partition_funcs.h"
+
+Partition partitions[PARTITIONS_MAX];
+int partition_count = 1;
+
+// Closed by the holder of warehouse_mutex, only read on the common path
+static u_int8_t gate __attribute__((aligned(64))) = 0;
+
+static __thread int own_id = 0;
+
+static unsigned long long *counter(AtomStorage *inv, int i){
+    return i == 0 ? &inv->carbon : i == 1 ? &inv->oxygen : &inv->hydrogen;
+}
+
+// Takes up to want from one counter, returns what it got
+static unsigned long long take_upto(unsigned long long *c, unsigned long long want){
+    unsigned long long have = __atomic_load_n(c, __ATOMIC_RELAXED);
+    unsigned long long n;
+    do {
+        n = have < want ? have : want;
+        if (n == 0){
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(c, &have, have - n, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    return n;
+}
+
+void partitions_init(int count){
+    memset(partitions, 0, sizeof(partitions));
+    partition_count = count < 1 ? 1 : count > PARTITIONS_MAX ? PARTITIONS_MAX : count;
+}
+
+void partition_attach(int id){
+    own_id = id % partition_count;
+}
+
+int partition_enter(void){
+    Partition *p = &partitions[own_id];
+    inventory_write_begin(&p->seq);
+    if (__atomic_load_n(&gate, __ATOMIC_SEQ_CST)){
+        inventory_write_end(&p->seq);
+        return 0;
+    }
+    return 1;
+}
+
+void partition_leave(void){
+    inventory_write_end(&partitions[own_id].seq);
+}
+
+void partition_add(const AtomStorage *atoms){
+    Partition *p = &partitions[own_id];
+    inventory_add(&p->stock, atoms);
+    __atomic_add_fetch(&p->changes, 1, __ATOMIC_RELAXED);
+}
+
+// Pulls atoms into the slice for each counter that is short of need
+static void rebalance(const AtomStorage *need, AtomStorage *central){
+    Partition *p = &partitions[own_id];
+    const unsigned long long amounts[3] = {need->carbon, need->oxygen, need->hydrogen};
+
+    for (int i = 0; i < 3; i++){
+        unsigned long long have = __atomic_load_n(counter(&p->stock, i), __ATOMIC_ACQUIRE);
+        if (have >= amounts[i]){
+            continue;
+        }
+        unsigned long long missing = amounts[i] - have;
+
+        // A share of the central pool, so the slices refill from it evenly
+        unsigned long long share = __atomic_load_n(counter(central, i), __ATOMIC_RELAXED) / partition_count;
+        unsigned long long got = take_upto(counter(central, i), share > missing ? share : missing);
+
+        // Then half of what each other slice holds, nearest first
+        for (int k = 1; k < partition_count && got < missing; k++){
+            unsigned long long *c = counter(&partitions[(own_id + k) % partition_count].stock, i);
+            unsigned long long half = __atomic_load_n(c, __ATOMIC_RELAXED) / 2;
+            got += take_upto(c, half > missing - got ? half : missing - got);
+        }
+        if (got > 0){
+            __atomic_add_fetch(counter(&p->stock, i), got, __ATOMIC_RELEASE);
+        }
+    }
+    __atomic_store_n(&p->rebalances, p->rebalances + 1, __ATOMIC_RELAXED);
+}
+
+int partition_take(const AtomStorage *need, AtomStorage *central){
+    Partition *p = &partitions[own_id];
+    if (inventory_reserve(&p->stock, need) == -1){
+        rebalance(need, central);
+        if (inventory_reserve(&p->stock, need) == -1){
+            return -1;      // what it pulled stays in the slice for the next ones
+        }
+    }
+    __atomic_add_fetch(&p->changes, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+unsigned long long partition_gather(AtomStorage *into){
+    __atomic_store_n(&gate, 1, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < partition_count; i++){
+        while (!inventory_seq_idle(&partitions[i].seq)){
+            sched_yield();      // an operation is a few compare-and-swaps
+        }
+    }
+
+    unsigned long long changes = 0;
+    AtomStorage empty = {0, 0, 0};
+    for (int i = 0; i < partition_count; i++){
+        Partition *p = &partitions[i];
+        AtomStorage slice;
+        inventory_load(&p->stock, &slice);
+        inventory_store(&p->stock, &empty);
+        into->carbon += slice.carbon;
+        into->oxygen += slice.oxygen;
+        into->hydrogen += slice.hydrogen;
+
+        unsigned long long now = __atomic_load_n(&p->changes, __ATOMIC_RELAXED);
+        changes += now - p->folded;
+        p->folded = now;
+    }
+    return changes;
+}
+
+void partition_open(void){
+    __atomic_store_n(&gate, 0, __ATOMIC_SEQ_CST);
+}
+
+void partition_sum(AtomStorage *out){
+    for (int i = 0; i < partition_count; i++){
+        AtomStorage slice;
+        inventory_load(&partitions[i].stock, &slice);
+        out->carbon += slice.carbon;
+        out->oxygen += slice.oxygen;
+        out->hydrogen += slice.hydrogen;
+    }
+}
+
+// Every begun is at least the ended read before it, equal sums mean equal pairs
+unsigned long long partition_read_begin(void){
+    unsigned long long ended = 0;
+    for (int i = 0; i < partition_count; i++){
+        ended += inventory_read_begin(&partitions[i].seq);
+    }
+    return ended;
+}
+
+int partition_read_retry(unsigned long long start){
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    unsigned long long begun = 0;
+    for (int i = 0; i < partition_count; i++){
+        begun += __atomic_load_n(&partitions[i].seq.begun, __ATOMIC_RELAXED);
+    }
+    return begun != start;
+}
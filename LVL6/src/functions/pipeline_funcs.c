@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include "../../include/functions/pipeline_funcs.h"
+
+// A producer thread's completions, the apply thread counts done
+typedef struct PipelineWaiter {
+    unsigned long long submitted;   // only its own thread writes it
+    unsigned long long done;
+    u_int8_t sleeping;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} PipelineWaiter;
+
+unsigned long long pipeline_events = 0;
+unsigned long long pipeline_batches = 0;
+
+static PipelineEvent ring[PIPELINE_RING_SIZE];
+static unsigned long long claimed = 0;      // next sequence handed to a producer
+static unsigned long long consumed = 0;     // every event before it ran and was released
+static u_int8_t running = 0;
+static void (*on_batch_end)(void) = NULL;
+
+// The apply thread sleeps on these when the ring is empty
+static u_int8_t apply_sleeping = 0;
+static pthread_mutex_t idle_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+
+static __thread u_int8_t is_apply_thread = 0;
+static __thread PipelineWaiter waiter = {0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+static int published(unsigned long long sequence){
+    return __atomic_load_n(&ring[sequence & (PIPELINE_RING_SIZE - 1)].sequence, __ATOMIC_SEQ_CST) == sequence;
+}
+
+// Back to the producers of [first, next), in order
+static void release(unsigned long long first, unsigned long long next){
+    for (unsigned long long s = first; s < next; s++){
+        PipelineWaiter *w = ring[s & (PIPELINE_RING_SIZE - 1)].waiter;
+        __atomic_add_fetch(&w->done, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&w->sleeping, __ATOMIC_SEQ_CST)){
+            pthread_mutex_lock(&w->mutex);
+            pthread_cond_signal(&w->cond);
+            pthread_mutex_unlock(&w->mutex);
+        }
+    }
+    __atomic_store_n(&consumed, next, __ATOMIC_RELEASE);
+}
+
+static void *apply_main(void *arg){
+    is_apply_thread = 1;
+    unsigned long long next = 0;
+
+    for (;;){
+        // Everything published in a row is one batch
+        unsigned long long first = next;
+        while (next - first < PIPELINE_RING_SIZE && published(next)){
+            PipelineEvent *e = &ring[next & (PIPELINE_RING_SIZE - 1)];
+            e->fn(e->arg);
+            next++;
+        }
+        if (next != first){
+            if (on_batch_end != NULL){
+                on_batch_end();
+            }
+            release(first, next);
+            __atomic_store_n(&pipeline_events, pipeline_events + (next - first), __ATOMIC_RELAXED);
+            __atomic_store_n(&pipeline_batches, pipeline_batches + 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        int spins = 0;
+        while (!published(next) && spins < PIPELINE_SPINS){
+            spins++;
+        }
+        if (spins < PIPELINE_SPINS){
+            continue;
+        }
+        pthread_mutex_lock(&idle_mutex);
+        __atomic_store_n(&apply_sleeping, 1, __ATOMIC_SEQ_CST);
+        while (!published(next)){
+            pthread_cond_wait(&idle_cond, &idle_mutex);
+        }
+        __atomic_store_n(&apply_sleeping, 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&idle_mutex);
+    }
+    return NULL;
+}
+
+int pipeline_start(void (*batch_end)(void)){
+    for (int i = 0; i < PIPELINE_RING_SIZE; i++){
+        ring[i].sequence = ~0ULL;   // no sequence maps to slot i yet
+    }
+    on_batch_end = batch_end;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, apply_main, NULL) != 0){
+        return -1;
+    }
+    pthread_detach(thread);
+    running = 1;
+    return 0;
+}
+
+int pipeline_active(void){
+    return running && !is_apply_thread;
+}
+
+void pipeline_submit(PipelineFn fn, void *arg){
+    unsigned long long sequence = __atomic_fetch_add(&claimed, 1, __ATOMIC_ACQ_REL);
+
+    // The ring is full until the apply thread releases the slot's last event
+    for (int spins = 0; sequence - __atomic_load_n(&consumed, __ATOMIC_ACQUIRE) >= PIPELINE_RING_SIZE; spins++){
+        if (spins >= PIPELINE_SPINS){
+            sched_yield();
+        }
+    }
+
+    PipelineEvent *e = &ring[sequence & (PIPELINE_RING_SIZE - 1)];
+    e->fn = fn;
+    e->arg = arg;
+    e->waiter = &waiter;
+    waiter.submitted++;
+    __atomic_store_n(&e->sequence, sequence, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&apply_sleeping, __ATOMIC_SEQ_CST)){
+        pthread_mutex_lock(&idle_mutex);
+        pthread_cond_signal(&idle_cond);
+        pthread_mutex_unlock(&idle_mutex);
+    }
+}
+
+static int all_done(void){
+    return __atomic_load_n(&waiter.done, __ATOMIC_SEQ_CST) == waiter.submitted;
+}
+
+void pipeline_wait(void){
+    for (int spins = 0; spins < PIPELINE_SPINS; spins++){
+        if (all_done()){
+            return;
+        }
+    }
+    pthread_mutex_lock(&waiter.mutex);
+    __atomic_store_n(&waiter.sleeping, 1, __ATOMIC_SEQ_CST);
+    while (!all_done()){
+        pthread_cond_wait(&waiter.cond, &waiter.mutex);
+    }
+    __atomic_store_n(&waiter.sleeping, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&waiter.mutex);
+}
+
+void pipeline_call(PipelineFn fn, void *arg){
+    pipeline_submit(fn, arg);
+    pipeline_wait();
+}
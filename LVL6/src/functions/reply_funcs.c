@@ -0,0 +1,81 @@
+#include <string.h>
+#include "../../include/const.h"
+#include "../../include/functions/reply_funcs.h"
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+size_t u64_to_ascii(unsigned long long v, char *out){
+    // Fill from the end of a scratch buffer, then move the digits to the front
+    char tmp[U64_DIGITS_MAX];
+    char *p = tmp + sizeof(tmp);
+    while (v >= 100){
+        unsigned pair = (unsigned)(v % 100) * 2;
+        v /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if (v >= 10){
+        *--p = digit_pairs[v * 2 + 1];
+        *--p = digit_pairs[v * 2];
+    } else {
+        *--p = (char)('0' + v);
+    }
+    size_t len = tmp + sizeof(tmp) - p;
+    memcpy(out, p, len);
+    return len;
+}
+
+void reply_init(ReplyWriter *w, char *out, size_t size){
+    w->out = out;
+    w->size = size;
+    w->len = 0;
+    if (size > 0){
+        out[0] = '\0';
+    }
+}
+
+void reply_resume(ReplyWriter *w, char *out, size_t size, size_t len){
+    w->out = out;
+    w->size = size;
+    w->len = 0;
+    if (size > 0){
+        w->len = len < size - 1 ? len : size - 1;
+        out[w->len] = '\0';
+    }
+}
+
+void reply_append(ReplyWriter *w, const char *s, size_t len){
+    if (w->size == 0){
+        return;
+    }
+    size_t room = w->size - 1 - w->len;
+    if (len > room){
+        len = room;
+    }
+    memcpy(w->out + w->len, s, len);
+    w->len += len;
+    w->out[w->len] = '\0';
+}
+
+void reply_str(ReplyWriter *w, const char *s){
+    reply_append(w, s, strlen(s));
+}
+
+void reply_u64(ReplyWriter *w, unsigned long long v){
+    char digits[U64_DIGITS_MAX];
+    reply_append(w, digits, u64_to_ascii(v, digits));
+}
+
+size_t reply_len(const ReplyWriter *w){
+    return w->len;
+}
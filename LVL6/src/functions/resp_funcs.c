@@ -0,0 +1,437 @@
+#include <stdio.h>
+#include <string.h>
+#include "../../include/const.h"
+#include "../../include/elements.h"
+#include "../../include/functions/resp_funcs.h"
+#include "../../include/functions/stream_funcs.h"
+#include "../../include/functions/atom_warehouse_funcs.h"
+#include "../../include/functions/parse_funcs.h"
+#include "../../include/functions/reply_funcs.h"
+#include "../../include/functions/hold_funcs.h"
+
+#define RESP_NEED_MORE -3       // parse_array(): the request is not complete yet
+
+typedef struct RespArg {
+    char *p;
+    size_t len;
+} RespArg;
+
+// Decimal after a '*' or '$' up to its "\r\n". 0 and the position after
+// the line, RESP_NEED_MORE, or STREAM_MALFORMED.
+static int parse_length(char *p, char *end, long *value, char **next){
+    char *cr = memchr(p, '\r', end - p);
+    if (cr == NULL || cr + 1 >= end){
+        return RESP_NEED_MORE;
+    }
+    if (cr[1] != '\n' || cr == p || cr - p > 9){
+        return STREAM_MALFORMED;
+    }
+    long v = 0;
+    for (char *d = p; d < cr; d++){
+        if (*d < '0' || *d > '9'){
+            return STREAM_MALFORMED;
+        }
+        v = v * 10 + (*d - '0');
+    }
+    *value = v;
+    *next = cr + 2;
+    return 0;
+}
+
+// *<n>\r\n followed by n times $<len>\r\n<bytes>\r\n. Bytes used, RESP_NEED_MORE or STREAM_MALFORMED.
+static ssize_t parse_array(char *buf, size_t len, RespArg *args, int *argc){
+    char *p = buf + 1, *end = buf + len;
+    long count;
+    int rc = parse_length(p, end, &count, &p);
+    if (rc != 0){
+        return rc;
+    }
+    if (count < 1 || count > RESP_ARGS_MAX){
+        return STREAM_MALFORMED;
+    }
+
+    for (long i = 0; i < count; i++){
+        if (p >= end){
+            return RESP_NEED_MORE;
+        }
+        if (*p != '$'){
+            return STREAM_MALFORMED;
+        }
+        long bulk;
+        rc = parse_length(p + 1, end, &bulk, &p);
+        if (rc != 0){
+            return rc;
+        }
+        if (bulk >= MAXDATASIZE){
+            return STREAM_MALFORMED;
+        }
+        if (end - p < bulk + 2){
+            return RESP_NEED_MORE;
+        }
+        if (p[bulk] != '\r' || p[bulk + 1] != '\n'){
+            return STREAM_MALFORMED;
+        }
+        args[i].p = p;
+        args[i].len = bulk;
+        p += bulk + 2;
+    }
+    *argc = (int)count;
+    return p - buf;
+}
+
+// Inline command: the words of one line. Bytes used or RESP_NEED_MORE.
+static ssize_t parse_inline(char *buf, size_t len, RespArg *args, int *argc){
+    char *nl = memchr(buf, '\n', len);
+    if (nl == NULL){
+        return RESP_NEED_MORE;
+    }
+    char *p = buf;
+    *argc = 0;
+    while (p < nl && *argc < RESP_ARGS_MAX){
+        while (p < nl && (*p == ' ' || *p == '\t' || *p == '\r')){
+            p++;
+        }
+        if (p == nl){
+            break;
+        }
+        args[*argc].p = p;
+        while (p < nl && *p != ' ' && *p != '\t' && *p != '\r'){
+            p++;
+        }
+        args[*argc].len = p - args[*argc].p;
+        (*argc)++;
+    }
+    return nl + 1 - buf;
+}
+
+static void upcase(RespArg *a){
+    for (size_t i = 0; i < a->len; i++){
+        if (a->p[i] >= 'a' && a->p[i] <= 'z'){
+            a->p[i] -= 'a' - 'A';
+        }
+    }
+}
+
+static int is_name(const RespArg *a, const char *name){
+    return a->len == strlen(name) && memcmp(a->p, name, a->len) == 0;
+}
+
+static int parse_amount(const RespArg *a, unsigned long long *amount){
+    if (a->len == 0){
+        return -1;
+    }
+    unsigned long long v = 0;
+    for (size_t i = 0; i < a->len; i++){
+        unsigned d = (unsigned char)a->p[i] - '0';
+        if (d > 9 || v > (~0ULL - d) / 10){
+            return -1;
+        }
+        v = v * 10 + d;
+    }
+    *amount = v;
+    return 0;
+}
+
+// "GEN SOFT DRINK" may come as two arguments, joined for the lookup
+static Element drink_of(RespArg *args, int argc){
+    if (argc == 2){
+        return element_from_name(args[1].p, args[1].len);
+    }
+    char name[MAXDATASIZE];
+    if (args[1].len + 1 + args[2].len > sizeof(name)){
+        return UNKNOWN;
+    }
+    memcpy(name, args[1].p, args[1].len);
+    name[args[1].len] = ' ';
+    memcpy(name + args[1].len + 1, args[2].p, args[2].len);
+    return element_from_name(name, args[1].len + 1 + args[2].len);
+}
+
+static void wrong_args(ReplyWriter *w, const char *cmd){
+    reply_literal(w, "-ERR wrong number of arguments for '");
+    reply_str(w, cmd);
+    reply_literal(w, "' command\r\n");
+}
+
+static void integer_reply(ReplyWriter *w, unsigned long long v){
+    reply_literal(w, ":");
+    reply_u64(w, v);
+    reply_literal(w, "\r\n");
+}
+
+static void version_mismatch(ReplyWriter *w, unsigned long long version){
+    reply_literal(w, "-ERR version mismatch, the inventory is at version ");
+    reply_u64(w, version);
+    reply_literal(w, "\r\n");
+}
+
+// Runs one request, the reply goes to w
+static void run_command(RespArg *args, int argc, ReplyWriter *w, int file_flag, int fd){
+    for (int i = 0; i < argc; i++){
+        upcase(&args[i]);
+    }
+    Command cmd = command_from_name(args[0].p, args[0].len);
+    unsigned long long amount = 0, count = 0, version = 0;
+    AtomStorage after;
+
+    // ... IF_VERSION <version>: the command runs only on that version
+    unsigned long long expected;
+    const unsigned long long *if_version = NULL;
+    if (argc >= 3 && is_name(&args[argc - 2], "IF_VERSION")){
+        if (parse_amount(&args[argc - 1], &expected) == -1){
+            reply_literal(w, "-ERR value is not an integer or out of range\r\n");
+            return;
+        }
+        if_version = &expected;
+        argc -= 2;
+    }
+
+    switch(cmd){
+        case CMD_ADD: {
+            if (argc != 3){
+                wrong_args(w, "add");
+                return;
+            }
+            Element atom = element_from_name(args[1].p, args[1].len);
+            if (parse_amount(&args[2], &amount) == -1){
+                reply_literal(w, "-ERR value is not an integer or out of range\r\n");
+                return;
+            }
+            switch(warehouse_apply(WAREHOUSE_OP_ADD, atom, amount, if_version, NULL, &after, &version, file_flag, fd)){
+                case WAREHOUSE_OK:
+                    break;
+                case WAREHOUSE_VERSION_MISMATCH:
+                    version_mismatch(w, version);
+                    return;
+                default:
+                    reply_literal(w, "-ERR unknown atom type\r\n");
+                    return;
+            }
+            integer_reply(w, atom == CARBON ? after.carbon : atom == OXYGEN ? after.oxygen : after.hydrogen);
+            return;
+        }
+        case CMD_DELIVER: {
+            if (argc != 3){
+                wrong_args(w, "deliver");
+                return;
+            }
+            Element molecule = element_from_name(args[1].p, args[1].len);
+            if (parse_amount(&args[2], &amount) == -1){
+                reply_literal(w, "-ERR value is not an integer or out of range\r\n");
+                return;
+            }
+            switch(warehouse_apply(WAREHOUSE_OP_DELIVER, molecule, amount, if_version, NULL, NULL, &version, file_flag, fd)){
+                case WAREHOUSE_OK:
+                    integer_reply(w, amount);
+                    break;
+                case WAREHOUSE_VERSION_MISMATCH:
+                    version_mismatch(w, version);
+                    break;
+                case WAREHOUSE_NOT_ENOUGH:
+                    reply_literal(w, "-ERR not enough atoms to make ");
+                    reply_append(w, args[1].p, args[1].len);
+                    reply_literal(w, "\r\n");
+                    break;
+                default:
+                    reply_literal(w, "-ERR unknown molecule type\r\n");
+                    break;
+            }
+            return;
+        }
+        case CMD_ORDER: {
+            if (argc < 3 || argc % 2 == 0){
+                wrong_args(w, "order");
+                return;
+            }
+            OrderItem items[ORDER_ITEMS_MAX];
+            int n = 0;
+            for (int i = 1; i < argc; i += 2, n++){
+                if (parse_amount(&args[i + 1], &items[n].amount) == -1){
+                    reply_literal(w, "-ERR value is not an integer or out of range\r\n");
+                    return;
+                }
+                items[n].molecule = element_from_name(args[i].p, args[i].len);
+                count += items[n].amount;
+            }
+            switch(warehouse_apply_order(items, n, if_version, &version, file_flag, fd)){
+                case WAREHOUSE_OK:
+                    integer_reply(w, count);
+                    break;
+                case WAREHOUSE_VERSION_MISMATCH:
+                    version_mismatch(w, version);
+                    break;
+                case WAREHOUSE_NOT_ENOUGH:
+                    reply_literal(w, "-ERR not enough atoms for the whole order\r\n");
+                    break;
+                default:
+                    reply_literal(w, "-ERR unknown molecule type\r\n");
+                    break;
+            }
+            return;
+        }
+        case CMD_HOLD: {
+            unsigned long long ttl, id;
+            if (argc != 4){
+                wrong_args(w, "hold");
+                return;
+            }
+            if (parse_amount(&args[2], &amount) == -1 || parse_amount(&args[3], &ttl) == -1 || ttl == 0 || ttl > HOLD_TTL_MAX){
+                reply_literal(w, "-ERR value is not an integer or out of range\r\n");
+                return;
+            }
+            switch(warehouse_apply_hold(WAREHOUSE_OP_HOLD, element_from_name(args[1].p, args[1].len), amount, ttl, &id,
+                                        if_version, &version, file_flag, fd)){
+                case WAREHOUSE_OK:
+                    integer_reply(w, id);
+                    break;
+                case WAREHOUSE_VERSION_MISMATCH:
+                    version_mismatch(w, version);
+                    break;
+                case WAREHOUSE_NOT_ENOUGH:
+                    reply_literal(w, "-ERR not enough atoms to hold ");
+                    reply_append(w, args[1].p, args[1].len);
+                    reply_literal(w, "\r\n");
+                    break;
+                case WAREHOUSE_HOLDS_FULL:
+                    reply_literal(w, "-ERR too many open holds\r\n");
+                    break;
+                default:
+                    reply_literal(w, "-ERR unknown atom or molecule type\r\n");
+                    break;
+            }
+            return;
+        }
+        case CMD_COMMIT:
+        case CMD_RELEASE: {
+            unsigned long long id;
+            if (argc != 2){
+                wrong_args(w, cmd == CMD_COMMIT ? "commit" : "release");
+                return;
+            }
+            if (parse_amount(&args[1], &id) == -1){
+                reply_literal(w, "-ERR value is not an integer or out of range\r\n");
+                return;
+            }
+            switch(warehouse_apply_hold(cmd == CMD_COMMIT ? WAREHOUSE_OP_COMMIT : WAREHOUSE_OP_RELEASE, UNKNOWN, 0, 0, &id,
+                                        if_version, &version, file_flag, fd)){
+                case WAREHOUSE_OK:
+                    reply_literal(w, "+OK\r\n");
+                    break;
+                case WAREHOUSE_VERSION_MISMATCH:
+                    version_mismatch(w, version);
+                    break;
+                default:
+                    reply_literal(w, "-ERR no such hold\r\n");
+                    break;
+            }
+            return;
+        }
+        case CMD_GEN: {
+            if (argc != 2 && argc != 3){
+                wrong_args(w, "gen");
+                return;
+            }
+            switch(warehouse_apply(WAREHOUSE_OP_GEN, drink_of(args, argc), 0, if_version, &count, NULL, &version, file_flag, fd)){
+                case WAREHOUSE_OK:
+                    break;
+                case WAREHOUSE_VERSION_MISMATCH:
+                    version_mismatch(w, version);
+                    return;
+                default:
+                    reply_literal(w, "-ERR unknown drink type\r\n");
+                    return;
+            }
+            integer_reply(w, count);
+            return;
+        }
+        default:
+            break;
+    }
+
+    if (is_name(&args[0], "VERSION")){
+        warehouse_snapshot(&after, &version);
+        integer_reply(w, version);
+    } else if (is_name(&args[0], "PING")){
+        reply_literal(w, "+PONG\r\n");
+    } else if (is_name(&args[0], "COMMAND") || is_name(&args[0], "CONFIG")){
+        reply_literal(w, "*0\r\n");
+    } else {
+        reply_literal(w, "-ERR unknown command '");
+        reply_append(w, args[0].p, args[0].len < 32 ? args[0].len : 32);
+        reply_literal(w, "'\r\n");
+    }
+}
+
+// -I pipeline: a request run on the apply thread with the rest of its
+// read, the reply goes to its slot of the batch
+typedef struct RespCall {
+    RespArg args[RESP_ARGS_MAX];
+    int argc;
+    char *reply;
+    MessageCall *call;      // its len is the reply length, see stream_settle()
+} RespCall;
+
+static __thread RespCall resp_calls[STREAM_BATCH_MAX];
+
+// The apply thread owns the storage file and saves it once per batch
+static void run_resp_call(void *arg){
+    RespCall *c = arg;
+    ReplyWriter w;
+    reply_init(&w, c->reply, STREAM_REPLY_SIZE);
+    run_command(c->args, c->argc, &w, 0, -1);
+    c->call->len = reply_len(&w);
+}
+
+// The arguments point into buf, which stays as it is until stream_settle()
+static ssize_t serve_requests(StreamBatch *b, char *buf, size_t len){
+    size_t off = 0;
+    while (off < len){
+        RespArg args[RESP_ARGS_MAX];
+        int argc = 0;
+        ssize_t used = buf[off] == '*' ? parse_array(buf + off, len - off, args, &argc)
+                                       : parse_inline(buf + off, len - off, args, &argc);
+        if (used == RESP_NEED_MORE){
+            if (len - off >= MAXDATASIZE){
+                return STREAM_MALFORMED;    // longer than any request
+            }
+            break;
+        }
+        if (used < 0){
+            return STREAM_MALFORMED;
+        }
+        off += used;
+        if (argc == 0){
+            continue;   // blank inline line
+        }
+
+        if (pipeline_active()){
+            MessageCall *call = stream_add_pending(b, STREAM_REPLY_RAW);
+            if (call == NULL){
+                return STREAM_CLOSED;
+            }
+            RespCall *c = &resp_calls[call - b->calls];
+            memcpy(c->args, args, argc * sizeof(RespArg));
+            c->argc = argc;
+            c->reply = b->replies[call - b->calls];
+            c->call = call;
+            pipeline_submit(run_resp_call, c);
+            continue;
+        }
+
+        char *reply = stream_reply_slot(b);
+        if (reply == NULL){
+            return STREAM_CLOSED;
+        }
+        ReplyWriter w;
+        reply_init(&w, reply, STREAM_REPLY_SIZE);
+        run_command(args, argc, &w, b->file_flag, b->storage_fd);
+        stream_add_reply(b, reply_len(&w));
+    }
+    return off;
+}
+
+ssize_t resp_serve(StreamBatch *b, char *buf, size_t len){
+    ssize_t rc = serve_requests(b, buf, len);
+    stream_settle(b);
+    return rc;
+}
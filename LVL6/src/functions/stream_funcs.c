@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <string.h>
+#include "../../include/const.h"
+#include "../../include/functions/stream_funcs.h"
+#include "../../include/functions/atom_warehouse_funcs.h"
+#include "../../include/functions/latency_funcs.h"
+#include "../../include/functions/wire_funcs.h"
+#include "../../include/functions/reply_funcs.h"
+
+char *stream_reply_slot(StreamBatch *b){
+    if (b->count == STREAM_BATCH_MAX && stream_flush(b) == -1){
+        return NULL;
+    }
+    return b->replies[b->count];
+}
+
+void stream_add_reply(StreamBatch *b, size_t len){
+    b->iov[b->count].iov_base = b->replies[b->count];
+    b->iov[b->count].iov_len = len;
+    b->pending[b->count] = STREAM_REPLY_READY;
+    b->count++;
+    b->served++;
+}
+
+MessageCall *stream_add_pending(StreamBatch *b, u_int8_t how){
+    if (stream_reply_slot(b) == NULL){
+        return NULL;
+    }
+    int slot = b->count;
+    stream_add_reply(b, 0);
+    b->pending[slot] = how;
+    b->waiting = 1;
+    return &b->calls[slot];
+}
+
+// No text reply is empty, and with line framing every one ends with a
+// newline, so a pipelining client can match them up
+static size_t end_reply(char *reply, size_t n, u_int8_t framed){
+    // Framed or not, the client waits for an answer: never send it nothing
+    if (n == 0){
+        n = sizeof(REPLY_UNKNOWN_COMMAND) - 1;
+        memcpy(reply, REPLY_UNKNOWN_COMMAND, n + 1);
+    } else if (framed && reply[n - 1] != '\n' && n < STREAM_REPLY_SIZE - 1){
+        reply[n++] = '\n';
+        reply[n] = '\0';
+    }
+    return n;
+}
+
+void stream_settle(StreamBatch *b){
+    if (!b->waiting){
+        return;
+    }
+    pipeline_wait();
+    b->waiting = 0;
+    for (int i = 0; i < b->count; i++){
+        if (b->pending[i] == STREAM_REPLY_READY){
+            continue;
+        }
+        size_t n = b->calls[i].len;
+        if (b->pending[i] != STREAM_REPLY_RAW){
+            n = end_reply(b->replies[i], n, b->pending[i] == STREAM_REPLY_FRAMED);
+        }
+        b->iov[i].iov_len = n;
+        b->pending[i] = STREAM_REPLY_READY;
+    }
+}
+
+// Runs one text command, the line stays in place until stream_settle()
+static int serve_line(StreamBatch *b, char *line, size_t len, u_int8_t framed){
+    const char *text = NULL;
+    if (len >= MAXDATASIZE){
+        text = REPLY_TOO_LONG;
+    } else if (request_expired(line, &len, b->arrived)){
+        text = REPLY_TIMED_OUT;     // still answered, a pipelining client matches the replies up by order
+    }
+    if (text != NULL){
+        char *reply = stream_reply_slot(b);
+        if (reply == NULL){
+            return -1;
+        }
+        size_t n = strlen(text);
+        memcpy(reply, text, n + 1);
+        stream_add_reply(b, n);
+        return 0;
+    }
+
+    line[len] = '\0';
+    if (!low_latency){
+        printf("server: received '%s' on socket %d\n", line, b->fd);
+    }
+    MessageCall *call = stream_add_pending(b, framed ? STREAM_REPLY_FRAMED : STREAM_REPLY_LINE);
+    if (call == NULL){
+        return -1;
+    }
+    message_submit(call, 0, line, len, TCP_HANDLE, b->replies[call - b->calls], STREAM_REPLY_SIZE, b->file_flag, b->storage_fd);
+    return 0;
+}
+
+// The requests served stay in buf until their replies are settled
+static ssize_t serve_requests(StreamBatch *b, char *buf, size_t len, u_int8_t *framed){
+    size_t off = 0;
+    while (off < len){
+        char *p = buf + off;
+        size_t left = len - off;
+
+        // Binary frames are told apart by their first byte
+        if (wire_is_binary(p, left)){
+            ssize_t frame = wire_frame_length(p, left);
+            if (frame == -1){
+                return STREAM_MALFORMED;
+            }
+            if (frame == 0 || (size_t)frame > left){
+                break;
+            }
+            off += frame;
+            size_t frame_len = frame;
+            if (request_expired(p, &frame_len, b->arrived)){
+                continue;       // a binary reply is matched by its request id, none is needed
+            }
+            MessageCall *call = stream_add_pending(b, STREAM_REPLY_RAW);
+            if (call == NULL){
+                return STREAM_CLOSED;
+            }
+            message_submit(call, 1, p, frame, TCP_HANDLE, b->replies[call - b->calls], STREAM_REPLY_SIZE, b->file_flag, b->storage_fd);
+            continue;
+        }
+
+        size_t line_len, consumed;
+        char *nl = memchr(p, '\n', left);
+        if (nl != NULL){
+            *framed = 1;
+            line_len = nl - p;
+            consumed = line_len + 1;
+        } else if (!*framed){
+            // A client that never sent a newline: the read is the command
+            line_len = left;
+            consumed = left;
+        } else if (left >= MAXDATASIZE){
+            return STREAM_MALFORMED;    // no command is that long, the client is not speaking the protocol
+        } else {
+            break;      // the rest of the line is still on its way
+        }
+
+        p[line_len] = '\0';
+        if (line_len > 0 && p[line_len - 1] == '\r'){
+            p[--line_len] = '\0';
+        }
+        off += consumed;
+
+        if (line_len == 0 && *framed){
+            continue;   // blank line
+        }
+        if (serve_line(b, p, line_len, *framed) == -1){
+            return STREAM_CLOSED;
+        }
+    }
+    return off;
+}
+
+ssize_t stream_serve(StreamBatch *b, char *buf, size_t len, u_int8_t *framed){
+    ssize_t rc = serve_requests(b, buf, len, framed);
+    stream_settle(b);
+    return rc;
+}
+
+int stream_flush(StreamBatch *b){
+    stream_settle(b);
+    if (b->count == 0){
+        return 0;
+    }
+    int count = b->count;
+    if (b->flush(b) == -1){
+        b->count = 0;
+        return -1;
+    }
+    b->count = 0;
+
+    unsigned long long ns = realtime_ns() - b->arrived;
+    for (int i = 0; i < count; i++){
+        latency_record(ns);
+    }
+    return 0;
+}
@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include "../../include/const.h"
+#include "../../include/functions/timer_wheel_funcs.h"
+
+_Static_assert(WHEEL_SLOTS == 64, "one occupancy bit per slot in an unsigned long long");
+
+#define SLOT_MASK (WHEEL_SLOTS - 1)
+#define LEVEL_SPAN(level) (1ULL << (WHEEL_BITS * (level)))     // ticks covered by one slot of the level
+
+unsigned long long monotonic_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static unsigned long long clock_tick(void){
+    return monotonic_ms() / WHEEL_TICK_MS;
+}
+
+int wheel_init(TimerWheel *w){
+    memset(w, 0, sizeof(*w));
+    w->now = clock_tick();
+    w->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    return w->fd == -1 ? -1 : 0;
+}
+
+void timer_init(Timer *t, void (*on_expire)(TimerWheel *w, Timer *t), void *data){
+    memset(t, 0, sizeof(*t));
+    t->on_expire = on_expire;
+    t->data = data;
+}
+
+// Links a timer into the slot matching its distance from w->now
+static void slot_insert(TimerWheel *w, Timer *t){
+    unsigned long long expires = t->expires;
+    unsigned long long delta = expires - w->now;
+
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= LEVEL_SPAN(level + 1)){
+        level++;
+    }
+    // Past the last level, park it in the farthest slot, the cascade places it again
+    if (delta >= LEVEL_SPAN(WHEEL_LEVELS)){
+        expires = w->now + LEVEL_SPAN(WHEEL_LEVELS) - 1;
+    }
+    int slot = (expires >> (WHEEL_BITS * level)) & SLOT_MASK;
+
+    t->level = level;
+    t->slot = slot;
+    t->prev = NULL;
+    t->next = w->slots[level][slot];
+    if (t->next != NULL){
+        t->next->prev = t;
+    }
+    w->slots[level][slot] = t;
+    w->occupied[level] |= 1ULL << slot;
+}
+
+static void slot_unlink(TimerWheel *w, Timer *t){
+    if (t->prev != NULL){
+        t->prev->next = t->next;
+    } else {
+        w->slots[t->level][t->slot] = t->next;
+        if (t->next == NULL){
+            w->occupied[t->level] &= ~(1ULL << t->slot);
+        }
+    }
+    if (t->next != NULL){
+        t->next->prev = t->prev;
+    }
+    t->prev = t->next = NULL;
+    t->armed = 0;
+    w->count--;
+}
+
+// Next tick with something to do: a non-empty level 0 slot, or the
+// wrap of level 0 that cascades the lowest non-empty level. 0 if none.
+static unsigned long long next_tick(TimerWheel *w){
+    unsigned long long next = 0;
+
+    if (w->occupied[0] != 0){
+        unsigned shift = (w->now + 1) & SLOT_MASK;
+        unsigned long long rot = w->occupied[0];
+        if (shift != 0){
+            rot = (rot >> shift) | (rot << (WHEEL_SLOTS - shift));
+        }
+        next = w->now + 1 + __builtin_ctzll(rot);
+    }
+
+    for (int level = 1; level < WHEEL_LEVELS; level++){
+        if (w->occupied[level] == 0){
+            continue;
+        }
+        unsigned long long boundary = (w->now | (LEVEL_SPAN(level) - 1)) + 1;
+        if (next == 0 || boundary < next){
+            next = boundary;
+        }
+        break;
+    }
+    return next;
+}
+
+// Points the timerfd at next_tick(), disarms it when the wheel is empty
+static void wheel_arm(TimerWheel *w){
+    unsigned long long next = w->count > 0 ? next_tick(w) : 0;
+    if (next == w->armed_tick){
+        return;
+    }
+
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (next != 0){
+        unsigned long long ms = next * WHEEL_TICK_MS;
+        its.it_value.tv_sec = ms / 1000;
+        its.it_value.tv_nsec = (ms % 1000) * 1000000;
+    }
+    if (timerfd_settime(w->fd, TFD_TIMER_ABSTIME, &its, NULL) == -1){
+        perror("timerfd_settime");
+        return;
+    }
+    w->armed_tick = next;
+}
+
+void timer_add(TimerWheel *w, Timer *t, unsigned long long ms){
+    if (t->armed){
+        slot_unlink(w, t);
+    }
+
+    unsigned long long now = clock_tick();
+    if (w->count == 0 && now > w->now){
+        w->now = now;   // nothing can be due in between, skip ahead
+    }
+
+    unsigned long long expires = now + (ms + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+    if (expires <= w->now){
+        expires = w->now + 1;
+    }
+    t->expires = expires;
+    t->armed = 1;
+    slot_insert(w, t);
+    w->count++;
+
+    if (!w->running && (w->armed_tick == 0 || expires < w->armed_tick)){
+        wheel_arm(w);
+    }
+}
+
+void timer_del(TimerWheel *w, Timer *t){
+    if (!t->armed){
+        return;
+    }
+    slot_unlink(w, t);
+    if (w->count == 0 && !w->running){
+        wheel_arm(w);
+    }
+}
+
+// Moves every timer of the current slot of a level down the wheel
+static void cascade(TimerWheel *w, int level){
+    int slot = (w->now >> (WHEEL_BITS * level)) & SLOT_MASK;
+    Timer *t = w->slots[level][slot];
+    w->slots[level][slot] = NULL;
+    w->occupied[level] &= ~(1ULL << slot);
+
+    while (t != NULL){
+        Timer *next = t->next;
+        slot_insert(w, t);
+        t = next;
+    }
+}
+
+// Processes tick w->now: cascades on a level 0 wrap, then runs the due timers
+static void run_tick(TimerWheel *w){
+    int slot = w->now & SLOT_MASK;
+
+    if (slot == 0){
+        for (int level = 1; level < WHEEL_LEVELS; level++){
+            cascade(w, level);
+            if (((w->now >> (WHEEL_BITS * level)) & SLOT_MASK) != 0){
+                break;
+            }
+        }
+    }
+
+    // One at a time, a callback may add or delete other timers
+    Timer *t;
+    while ((t = w->slots[0][slot]) != NULL){
+        slot_unlink(w, t);
+        t->on_expire(w, t);
+    }
+}
+
+void wheel_expire(TimerWheel *w){
+    unsigned long long expirations;
+    while (read(w->fd, &expirations, sizeof(expirations)) == -1 && errno == EINTR){
+        continue;
+    }
+    w->fired = 1;
+    w->armed_tick = 0;      // one-shot, it is spent
+    w->running = 1;
+
+    // Jump from one busy tick to the next instead of walking every tick
+    unsigned long long target = clock_tick();
+    while (w->now < target){
+        unsigned long long next = w->count > 0 ? next_tick(w) : 0;
+        if (next == 0 || next > target){
+            w->now = target;
+            break;
+        }
+        w->now = next;
+        run_tick(w);
+    }
+
+    w->running = 0;
+    wheel_arm(w);
+}
+
+void wheel_destroy(TimerWheel *w){
+    if (w->fd != -1){
+        close(w->fd);
+    }
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+}
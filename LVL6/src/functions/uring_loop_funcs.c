@@ -0,0 +1,757 @@
+#ifdef HAVE_IO_URING
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+#include "../../include/const.h"
+#include "../../include/functions/atom_warehouse_funcs.h"
+#include "../../include/functions/drinks_bar_funcs.h"
+#include "../../include/functions/connection_funcs.h"
+#include "../../include/functions/uring_loop_funcs.h"
+#include "../../include/functions/latency_funcs.h"
+#include "../../include/functions/wire_funcs.h"
+#include "../../include/functions/stream_funcs.h"
+#include "../../include/functions/resp_funcs.h"
+#include "../../include/functions/backorder_funcs.h"
+#include "../../include/functions/reply_funcs.h"
+
+// Only one snapshot write may be in flight at a time, whichever ring owns
+// it re-checks warehouse_generation when it completes, so writes from
+// several reactors never land out of order
+static u_int8_t write_busy = 0;
+static unsigned long long written_generation = 0;
+static u_int8_t storage_closed = 0;     // uring_quiesce() was called
+
+_Static_assert(WIRE_FRAME_MAX < URING_PARTIAL_MAX, "a partial binary frame must fit the RECV op");
+
+// Replies of one completion, per ring
+static __thread StreamBatch stream_batch;
+static __thread UringLoop *batch_ring;  // the ring stream_batch is flushed to
+_Static_assert(URING_CONTROL_SIZE >= CMSG_SPACE(sizeof(struct timespec)), "SO_TIMESTAMPNS must fit the recvmsg control space");
+
+// No liburing dependency, the three syscalls are called directly
+static int sys_uring_setup(unsigned entries, struct io_uring_params *p){
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags){
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args){
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// Hands one provided buffer back to the kernel
+static void recycle_buffer(UringLoop *ring, u_int16_t bid){
+    struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_tail & (URING_BUF_COUNT - 1)];
+    buf->addr = (unsigned long)(ring->bufs + (size_t)bid * URING_BUF_SIZE);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+    ring->buf_tail++;
+    __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+int uring_init(UringLoop *ring, int storage_fd, u_int8_t persist){
+    struct io_uring_params p;
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+    ring->storage_fd = storage_fd;
+    ring->persist = persist;
+
+    ring->ring_fd = sys_uring_setup(URING_ENTRIES, &p);
+    if (ring->ring_fd == -1){
+        return -1;
+    }
+
+    // Map the submission ring, the completion ring and the SQE array
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP){
+        if (ring->cq_size > ring->sq_size){
+            ring->sq_size = ring->cq_size;
+        }
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED){
+        close(ring->ring_fd);
+        return -1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP){
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED){
+            ring->cq_ptr = NULL;
+            uring_destroy(ring);
+            return -1;
+        }
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED){
+        ring->sqes = NULL;
+        uring_destroy(ring);
+        return -1;
+    }
+
+    char *sq = ring->sq_ptr, *cq = ring->cq_ptr;
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->sq_entries = p.sq_entries;
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // Provided buffer ring, multishot receives pick their buffer from it
+    ring->buf_ring = mmap(NULL, URING_BUF_COUNT * sizeof(struct io_uring_buf),
+                          PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ring->bufs = malloc((size_t)URING_BUF_COUNT * URING_BUF_SIZE);
+    if (ring->buf_ring == MAP_FAILED || ring->bufs == NULL){
+        if (ring->buf_ring == MAP_FAILED){
+            ring->buf_ring = NULL;
+        }
+        uring_destroy(ring);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)ring->buf_ring;
+    reg.ring_entries = URING_BUF_COUNT;
+    reg.bgid = URING_BGID;
+    if (sys_uring_register(ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1){
+        uring_destroy(ring);
+        return -1;
+    }
+    for (u_int16_t bid = 0; bid < URING_BUF_COUNT; bid++){
+        recycle_buffer(ring, bid);
+    }
+    return 0;
+}
+
+// Submits everything queued so far without waiting
+static int uring_submit(UringLoop *ring){
+    while (ring->to_submit > 0){
+        int ret = sys_uring_enter(ring->ring_fd, ring->to_submit, 0, 0);
+        if (ret == -1){
+            if (errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        ring->to_submit -= ret;
+    }
+    return 0;
+}
+
+// Returns a zeroed SQE that is published on the next submit
+static struct io_uring_sqe *get_sqe(UringLoop *ring){
+    unsigned tail = *ring->sq_tail;
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    if (tail - head >= ring->sq_entries){
+        // Queue full, let the kernel consume what we have
+        if (uring_submit(ring) == -1){
+            perror("io_uring_enter");
+            exit(1);
+        }
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    }
+
+    unsigned idx = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+    return sqe;
+}
+
+static UringOp *new_op(u_int8_t type, u_int8_t kind, int fd, size_t len){
+    UringOp *op = calloc(1, sizeof(UringOp) + len);
+    if (op == NULL){
+        perror("calloc");
+        exit(1);
+    }
+    op->type = type;
+    op->kind = kind;
+    op->fd = fd;
+    op->len = len;
+    return op;
+}
+
+static void arm_accept(UringLoop *ring, UringOp *op){
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = op->fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC | SOCK_NONBLOCK;
+    sqe->user_data = (unsigned long)op;
+}
+
+static void arm_recv(UringLoop *ring, UringOp *op){
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = op->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = (unsigned long)op;
+}
+
+static void arm_recvmsg(UringLoop *ring, UringOp *op){
+    // The kernel lays out io_uring_recvmsg_out, the peer address, the
+    // control messages and the payload in the selected buffer, msg only
+    // tells it the sizes
+    memset(&op->msg, 0, sizeof(op->msg));
+    op->msg.msg_namelen = sizeof(struct sockaddr_storage);
+    op->msg.msg_controllen = URING_CONTROL_SIZE;
+
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = op->fd;
+    sqe->addr = (unsigned long)&op->msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = (unsigned long)op;
+}
+
+static void arm_poll(UringLoop *ring, UringOp *op){
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = op->fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = (unsigned long)op;
+}
+
+// Gathers the replies into one SEND, its payload must outlive the batch
+static void queue_sendv(UringLoop *ring, UringOp *client, const struct iovec *iov, int count){
+    size_t len = 0;
+    for (int i = 0; i < count; i++){
+        len += iov[i].iov_len;
+    }
+    if (len == 0){
+        return;
+    }
+    UringOp *op = new_op(URING_OP_SEND, HANDLER_CLIENT, client->fd, len);
+    char *p = op->data;
+    for (int i = 0; i < count; i++){
+        memcpy(p, iov[i].iov_base, iov[i].iov_len);
+        p += iov[i].iov_len;
+    }
+    op->sending = client;
+    client->sending = op;
+
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = client->fd;
+    sqe->addr = (unsigned long)op->data;
+    sqe->len = len;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;   // the ring retries short sends itself
+    sqe->user_data = (unsigned long)op;
+}
+
+// Appends to the replies waiting for the SEND in flight, -1 past CONN_OUTBUF_MAX
+static int buffer_replies(UringOp *client, const struct iovec *iov, int count){
+    size_t len = 0;
+    for (int i = 0; i < count; i++){
+        len += iov[i].iov_len;
+    }
+    if (client->out_len + len > CONN_OUTBUF_MAX){
+        return -1;
+    }
+    if (client->out_len + len > client->out_cap){
+        size_t cap = client->out_cap ? client->out_cap : 256;
+        while (cap < client->out_len + len){
+            cap *= 2;
+        }
+        if (cap > CONN_OUTBUF_MAX){
+            cap = CONN_OUTBUF_MAX;
+        }
+        char *out = realloc(client->out, cap);
+        if (out == NULL){
+            return -1;
+        }
+        client->out = out;
+        client->out_cap = cap;
+    }
+    for (int i = 0; i < count; i++){
+        memcpy(client->out + client->out_len, iov[i].iov_base, iov[i].iov_len);
+        client->out_len += iov[i].iov_len;
+    }
+    return 0;
+}
+
+// Sends the replies of a stream client, after the SEND it has in flight
+static void client_send(UringLoop *ring, UringOp *client, const struct iovec *iov, int count){
+    if (client->dropped){
+        return;
+    }
+    if (client->sending == NULL){
+        queue_sendv(ring, client, iov, count);
+        return;
+    }
+    if (buffer_replies(client, iov, count) == -1){
+        // It stopped reading, shutting it down ends its recv and on_recv() closes it
+        fprintf(stderr, "server: client on socket %d is not reading its replies, disconnecting\n", client->fd);
+        client->dropped = 1;
+        client->out_len = 0;
+        shutdown(client->fd, SHUT_RDWR);
+    }
+}
+
+static void client_close(UringOp *client){
+    CONN_STAT_ADD(closed, 1);
+    close(client->fd);
+    free(client->out);
+    free(client);
+    conn_release();
+}
+
+// The client's SEND completed, the next one takes what waited meanwhile
+static void on_send(UringLoop *ring, UringOp *op, struct io_uring_cqe *cqe){
+    UringOp *client = op->sending;
+    client->sending = NULL;
+    if (cqe->res < 0){
+        fprintf(stderr, "send: %s\n", strerror(-cqe->res));
+        client->dropped = 1;
+        client->out_len = 0;
+        shutdown(client->fd, SHUT_RDWR);
+    } else {
+        CONN_STAT_ADD(bytes_out, cqe->res);
+        if (!low_latency){
+            printf("server: sent response to socket %d\n", op->fd);
+        }
+    }
+    free(op);
+
+    if (client->out_len > 0){
+        struct iovec iov = { client->out, client->out_len };
+        queue_sendv(ring, client, &iov, 1);
+        client->out_len = 0;
+    } else if (client->closing){
+        client_close(client);
+    }
+}
+
+static void queue_sendmsg(UringLoop *ring, int fd, const char *response, size_t len, const void *addr, socklen_t addr_len){
+    UringOp *op = new_op(URING_OP_SENDMSG, HANDLER_UDP, fd, len);
+    memcpy(op->data, response, len);
+    memcpy(&op->addr, addr, addr_len);
+    op->iov.iov_base = op->data;
+    op->iov.iov_len = len;
+    op->msg.msg_name = &op->addr;
+    op->msg.msg_namelen = addr_len;
+    op->msg.msg_iov = &op->iov;
+    op->msg.msg_iovlen = 1;
+
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)&op->msg;
+    sqe->len = 1;
+    sqe->user_data = (unsigned long)op;
+}
+
+// Writes the current warehouse to the storage file if it changed since the
+// last write and no other write is in flight
+static void queue_snapshot(UringLoop *ring){
+    static UringOp write_op = { .type = URING_OP_WRITE };
+
+    if (__atomic_load_n(&warehouse_generation, __ATOMIC_SEQ_CST) ==
+        __atomic_load_n(&written_generation, __ATOMIC_SEQ_CST)){
+        return;
+    }
+    u_int8_t expected = 0;
+    if (!__atomic_compare_exchange_n(&write_busy, &expected, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)){
+        return;     // the owner of the in-flight write picks our change up
+    }
+    if (__atomic_load_n(&storage_closed, __ATOMIC_SEQ_CST)){
+        __atomic_store_n(&write_busy, 0, __ATOMIC_SEQ_CST);
+        return;     // shutting down, the final write is synchronous
+    }
+    ring->write_pending = 1;
+    warehouse_snapshot(&ring->snapshot, &ring->snapshot_generation);
+
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = ring->storage_fd;
+    sqe->addr = (unsigned long)&ring->snapshot;
+    sqe->len = sizeof(AtomStorage);
+    sqe->off = 0;
+    sqe->user_data = (unsigned long)&write_op;
+}
+
+void uring_register_server_fd(UringLoop *ring, int fd, u_int8_t kind){
+    UringOp *op = new_op(0, kind, fd, 0);
+    switch(kind){
+        case HANDLER_TIMER:
+            op->type = URING_OP_TIMER;
+            arm_poll(ring, op);
+            break;
+        case HANDLER_WAREHOUSE_TIMER:
+            op->type = URING_OP_WAREHOUSE_TIMER;
+            arm_poll(ring, op);
+            break;
+        case HANDLER_TCP_LISTEN:
+        case HANDLER_UNIX_LISTEN:
+        case HANDLER_RESP_LISTEN:
+            op->type = URING_OP_ACCEPT;
+            arm_accept(ring, op);
+            break;
+        default:
+            op->type = URING_OP_RECVMSG;
+            arm_recvmsg(ring, op);
+            break;
+    }
+}
+
+// Runs one request through process_message, the ring persists it afterwards
+static size_t serve(UringLoop *ring, char *buf, int len, u_int8_t sock_handle, char *response, size_t response_size){
+    return process_message(buf, len, sock_handle, response, response_size, 0, ring->storage_fd);
+}
+
+// Shutting the socket down ends its multishot recv, on_recv() then closes it
+static void on_client_idle(TimerWheel *w, Timer *t){
+    UringOp *op = t->data;
+    unsigned long long idle_ms = monotonic_ms() - op->last_active;
+    if (idle_ms < idle_timeout * 1000ULL){
+        timer_add(w, t, idle_timeout * 1000ULL - idle_ms);
+        return;
+    }
+    printf("server: client on socket %d was idle for %d seconds, disconnecting\n", op->fd, idle_timeout);
+    shutdown(op->fd, SHUT_RDWR);
+}
+
+static void on_accept(UringLoop *ring, UringOp *op, struct io_uring_cqe *cqe){
+    if (!(cqe->flags & IORING_CQE_F_MORE)){
+        arm_accept(ring, op);   // multishot ended (error or overflow), re-arm it
+    }
+    if (cqe->res < 0){
+        if (cqe->res != -ECANCELED){
+            fprintf(stderr, "accept: %s\n", strerror(-cqe->res));
+        }
+        return;
+    }
+
+    int new_fd = cqe->res;
+    if (conn_admit() == -1){
+        printf("server: too many clients, rejecting new connection\n");
+        close(new_fd);
+        return;
+    }
+
+    if (op->kind != HANDLER_UNIX_LISTEN){
+        struct sockaddr_storage their_addr;
+        socklen_t sin_size = sizeof their_addr;
+        char s[INET6_ADDRSTRLEN] = "?";
+        if (getpeername(new_fd, (struct sockaddr *)&their_addr, &sin_size) == 0){
+            inet_ntop(their_addr.ss_family, get_in_addr((struct sockaddr*)&their_addr), s, sizeof s);
+        }
+        printf("server: new %sconnection from %s on socket %d\n", op->kind == HANDLER_RESP_LISTEN ? "RESP " : "", s, new_fd);
+    } else {
+        printf("server: new UNIX TCP connection on socket %d\n", new_fd);
+    }
+
+    CONN_STAT_ADD(accepted, 1);
+    UringOp *client = new_op(URING_OP_RECV, HANDLER_CLIENT, new_fd, URING_PARTIAL_MAX);
+    client->len = 0;
+    client->transport = op->kind;
+    if (idle_timeout > 0){
+        timer_init(&client->idle, on_client_idle, client);
+        client->last_active = monotonic_ms();
+        timer_add(ring->wheel, &client->idle, idle_timeout * 1000ULL);
+    }
+    arm_recv(ring, client);
+}
+
+static int send_stream_batch(StreamBatch *b){
+    client_send(batch_ring, b->ctx, b->iov, b->count);
+    return 0;
+}
+
+static void on_recv(UringLoop *ring, UringOp *op, struct io_uring_cqe *cqe){
+    if (cqe->res <= 0){
+        if (cqe->res == -ENOBUFS){
+            arm_recv(ring, op);     // out of buffers, they are recycled below
+            return;
+        }
+        if (cqe->res < 0){
+            fprintf(stderr, "recv: %s\n", strerror(-cqe->res));
+        }
+        timer_del(ring->wheel, &op->idle);
+        // A SEND in flight still uses the fd, it is closed once that completes
+        if (op->sending != NULL){
+            op->closing = 1;
+        } else {
+            client_close(op);
+        }
+        return;
+    }
+
+    // Multishot recv carries no control message, measured from the completion
+    StreamBatch *b = &stream_batch;
+    b->fd = op->fd;
+    b->file_flag = 0;       // the ring persists the batch
+    b->storage_fd = ring->storage_fd;
+    b->arrived = realtime_ns();
+    b->flush = send_stream_batch;
+    b->ctx = op;
+    batch_ring = ring;
+    b->count = 0;
+    b->served = 0;
+    if (idle_timeout > 0){
+        op->last_active = monotonic_ms();
+    }
+    CONN_STAT_ADD(bytes_in, cqe->res);
+
+    // The incomplete request of the last completion goes first
+    u_int16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    char buf[URING_PARTIAL_MAX + URING_BUF_SIZE + 1];
+    size_t len = op->len;
+    memcpy(buf, op->data, len);
+    memcpy(buf + len, ring->bufs + (size_t)bid * URING_BUF_SIZE, cqe->res);
+    recycle_buffer(ring, bid);
+    len += cqe->res;
+
+    ssize_t used = op->transport == HANDLER_RESP_LISTEN ? resp_serve(b, buf, len)
+                                                        : stream_serve(b, buf, len, &op->framed);
+    CONN_STAT_ADD(messages, b->served);
+    stream_flush(b);
+    if (used == STREAM_MALFORMED){
+        // Ends the multishot recv, on_recv() then closes the client
+        fprintf(stderr, "server: malformed request on socket %d, disconnecting\n", op->fd);
+        shutdown(op->fd, SHUT_RDWR);
+        op->len = 0;
+    } else {
+        op->len = len - used;
+        memcpy(op->data, buf + used, op->len);
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)){
+        arm_recv(ring, op);
+    }
+}
+
+static void on_recvmsg(UringLoop *ring, UringOp *op, struct io_uring_cqe *cqe){
+    if (!(cqe->flags & IORING_CQE_F_MORE)){
+        arm_recvmsg(ring, op);
+    }
+    if (cqe->res < 0){
+        if (cqe->res != -ENOBUFS){
+            fprintf(stderr, "recvmsg: %s\n", strerror(-cqe->res));
+        }
+        return;
+    }
+
+    u_int16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    char *base = ring->bufs + (size_t)bid * URING_BUF_SIZE;
+    struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)base;
+    char *name = base + sizeof(*out);
+    char *control = name + sizeof(struct sockaddr_storage);
+    char *payload = control + URING_CONTROL_SIZE;
+    unsigned max_payload = URING_BUF_SIZE - sizeof(*out) - sizeof(struct sockaddr_storage) - URING_CONTROL_SIZE;
+
+    // SO_TIMESTAMPNS arrival of the datagram
+    struct msghdr stamp;
+    memset(&stamp, 0, sizeof(stamp));
+    stamp.msg_control = control;
+    stamp.msg_controllen = out->controllen < URING_CONTROL_SIZE ? out->controllen : URING_CONTROL_SIZE;
+    unsigned long long arrived = latency_rx_ns(&stamp);
+
+    unsigned numbytes = out->payloadlen < max_payload ? out->payloadlen : max_payload;
+    socklen_t addr_len = out->namelen < sizeof(struct sockaddr_storage) ? out->namelen : sizeof(struct sockaddr_storage);
+    struct sockaddr_storage addr;
+    char buf[URING_BUF_SIZE + 1];
+    memcpy(&addr, name, addr_len);
+    memcpy(buf, payload, numbytes);
+    recycle_buffer(ring, bid);
+
+    // Nobody waits for the answer any more, not even an error
+    size_t req_len = numbytes;
+    if (numbytes == 0 || request_expired(buf, &req_len, arrived)){
+        return;
+    }
+
+    // One datagram is one command, text or a binary frame
+    char response[256];
+    size_t len;
+    if (wire_is_binary(buf, numbytes)){
+        len = process_wire_message(buf, numbytes, UDP_HANDLE, response, sizeof(response), 0, ring->storage_fd);
+    } else {
+        buf[req_len] = '\0';
+        backorder_origin(op->fd, &addr, addr_len);
+        len = serve(ring, buf, req_len, UDP_HANDLE, response, sizeof(response));
+    }
+    // A command datagrams do not take, answered rather than an empty datagram
+    if (len == 0){
+        len = sizeof(REPLY_UNKNOWN_COMMAND) - 1;
+        memcpy(response, REPLY_UNKNOWN_COMMAND, len + 1);
+    }
+    queue_sendmsg(ring, op->fd, response, len, &addr, addr_len);
+    latency_record(realtime_ns() - arrived);
+}
+
+int uring_run_once(UringLoop *ring, u_int8_t wait){
+    // One syscall submits the whole batch and waits for the next completion
+    int ret = sys_uring_enter(ring->ring_fd, ring->to_submit, wait ? 1 : 0, IORING_ENTER_GETEVENTS);
+    if (ret == -1){
+        if (errno == EINTR || errno == EBUSY){
+            return 0;
+        }
+        return -1;
+    }
+    ring->to_submit -= ret;
+
+    int handled = 0;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail){
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        UringOp *op = (UringOp *)(unsigned long)cqe->user_data;
+
+        switch(op->type){
+            case URING_OP_ACCEPT:
+                on_accept(ring, op, cqe);
+                break;
+            case URING_OP_RECV:
+                on_recv(ring, op, cqe);
+                break;
+            case URING_OP_RECVMSG:
+                on_recvmsg(ring, op, cqe);
+                break;
+            case URING_OP_SEND:
+                on_send(ring, op, cqe);
+                break;
+            case URING_OP_SENDMSG:
+                if (cqe->res < 0){
+                    fprintf(stderr, "send: %s\n", strerror(-cqe->res));
+                }
+                free(op);
+                break;
+            case URING_OP_WRITE:
+                if (cqe->res < 0){
+                    fprintf(stderr, "storage write: %s\n", strerror(-cqe->res));
+                }
+                ring->write_pending = 0;
+                __atomic_store_n(&written_generation, ring->snapshot_generation, __ATOMIC_SEQ_CST);
+                __atomic_store_n(&write_busy, 0, __ATOMIC_SEQ_CST);
+                break;
+            case URING_OP_TIMER:
+                wheel_expire(ring->wheel);
+                arm_poll(ring, op);
+                break;
+            case URING_OP_WAREHOUSE_TIMER:
+                warehouse_timers_expire(0, ring->storage_fd);     // persisted with the batch
+                arm_poll(ring, op);
+                break;
+        }
+
+        handled++;
+        head++;
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        if (head == tail){
+            // pick up completions that arrived while we were busy
+            tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        }
+    }
+
+    // Persist the whole batch with a single write through the ring
+    if (ring->persist){
+        queue_snapshot(ring);
+    }
+    return handled;
+}
+
+void uring_quiesce(UringLoop *ring){
+    // Pairs with the storage_closed check after the write_busy CAS in queue_snapshot()
+    __atomic_store_n(&storage_closed, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&write_busy, __ATOMIC_SEQ_CST)){
+        if (!ring->write_pending){
+            sched_yield();      // another ring reaps it
+        } else if (uring_run_once(ring, 1) == -1){
+            perror("io_uring_enter");
+            return;
+        }
+    }
+}
+
+// A FLUSH write in the rings' turn, see uring_flush_storage()
+typedef struct UringFlushCall {
+    int fd;
+    unsigned long long generation;
+    int rc;
+} UringFlushCall;
+
+static void uring_flush_call(void *arg){
+    UringFlushCall *c = arg;
+    AtomStorage copy = warehouse;
+    c->generation = warehouse_generation;
+    c->rc = pwrite(c->fd, &copy, sizeof(AtomStorage), 0) == sizeof(AtomStorage) ? 0 : -1;
+    if (c->rc == 0){
+        __atomic_store_n(&written_generation, c->generation, __ATOMIC_SEQ_CST);
+    }
+    __atomic_store_n(&write_busy, 0, __ATOMIC_SEQ_CST);
+}
+
+int uring_flush_storage(int fd, unsigned long long *generation){
+    u_int8_t expected = 0;
+    while (!__atomic_compare_exchange_n(&write_busy, &expected, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)){
+        expected = 0;
+        sched_yield();      // the ring that owns the write reaps it
+    }
+    if (__atomic_load_n(&storage_closed, __ATOMIC_SEQ_CST)){
+        __atomic_store_n(&write_busy, 0, __ATOMIC_SEQ_CST);
+        errno = ECANCELED;  // shutting down, the final write is synchronous
+        return -1;
+    }
+
+    UringFlushCall call = {fd, 0, 0};
+    warehouse_call(uring_flush_call, &call);
+    *generation = call.generation;
+    return call.rc == -1 ? -1 : fsync(fd);
+}
+
+void uring_destroy(UringLoop *ring){
+    if (ring->sqes != NULL){
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr){
+        munmap(ring->cq_ptr, ring->cq_size);
+    }
+    if (ring->sq_ptr != NULL){
+        munmap(ring->sq_ptr, ring->sq_size);
+    }
+    if (ring->buf_ring != NULL){
+        munmap(ring->buf_ring, URING_BUF_COUNT * sizeof(struct io_uring_buf));
+    }
+    free(ring->bufs);
+    close(ring->ring_fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->ring_fd = -1;
+}
+
+#endif
@@ -0,0 +1,121 @@
+#include <string.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include "../../include/const.h"
+#include "../../include/functions/wire_funcs.h"
+
+int wire_is_binary(const char *buf, size_t len){
+    return len > 0 && (u_int8_t)buf[0] == WIRE_MAGIC;
+}
+
+ssize_t wire_frame_length(const char *buf, size_t len){
+    if (len < 4){
+        return 0;
+    }
+    u_int16_t length;
+    memcpy(&length, buf + 2, sizeof(length));
+    length = ntohs(length);
+
+    if ((u_int8_t)buf[0] != WIRE_MAGIC || (u_int8_t)buf[1] != WIRE_VERSION ||
+        length < WIRE_HEADER_SIZE || length > WIRE_FRAME_MAX){
+        return -1;
+    }
+    return length;
+}
+
+u_int32_t wire_request_timeout(const char *buf){
+    u_int32_t timeout_ms;
+    memcpy(&timeout_ms, buf + 12, sizeof(timeout_ms));
+    return ntohl(timeout_ms);
+}
+
+static void put_u64(char *p, unsigned long long v){
+    v = htobe64(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static unsigned long long get_u64(const char *p){
+    unsigned long long v;
+    memcpy(&v, p, sizeof(v));
+    return be64toh(v);
+}
+
+size_t wire_encode(const WireMessage *msg, char *out, size_t out_size){
+    size_t len = (msg->opcode & WIRE_OP_REPLY) ? WIRE_REPLY_SIZE :
+                 msg->has_if_version ? WIRE_IF_VERSION_SIZE : WIRE_HEADER_SIZE;
+    if (out_size < len){
+        return 0;
+    }
+
+    u_int16_t length = htons(len);
+    u_int16_t status = htons(msg->status);
+    u_int32_t request_id = htonl(msg->request_id);
+    u_int32_t timeout_ms = htonl(msg->timeout_ms);
+
+    memset(out, 0, WIRE_HEADER_SIZE);
+    out[0] = (char)WIRE_MAGIC;
+    out[1] = WIRE_VERSION;
+    memcpy(out + 2, &length, sizeof(length));
+    out[4] = msg->opcode;
+    out[5] = msg->element;
+    memcpy(out + 6, &status, sizeof(status));
+    memcpy(out + 8, &request_id, sizeof(request_id));
+    memcpy(out + 12, &timeout_ms, sizeof(timeout_ms));
+    put_u64(out + 16, msg->amount);
+
+    if (msg->opcode & WIRE_OP_REPLY){
+        put_u64(out + 24, msg->carbon);
+        put_u64(out + 32, msg->oxygen);
+        put_u64(out + 40, msg->hydrogen);
+        put_u64(out + 48, msg->version);
+    } else if (msg->has_if_version){
+        put_u64(out + 24, msg->if_version);
+    }
+    return len;
+}
+
+int wire_decode(const char *buf, size_t len, WireMessage *msg){
+    ssize_t length = wire_frame_length(buf, len);
+    if (length <= 0 || (size_t)length > len){
+        return -1;
+    }
+
+    u_int16_t status;
+    u_int32_t request_id;
+    memcpy(&status, buf + 6, sizeof(status));
+    memcpy(&request_id, buf + 8, sizeof(request_id));
+
+    memset(msg, 0, sizeof(*msg));
+    msg->opcode = buf[4];
+    msg->element = buf[5];
+    msg->status = ntohs(status);
+    msg->request_id = ntohl(request_id);
+    msg->timeout_ms = wire_request_timeout(buf);
+    msg->amount = get_u64(buf + 16);
+
+    if (msg->opcode & WIRE_OP_REPLY){
+        if (length < WIRE_REPLY_SIZE){
+            return -1;
+        }
+        msg->carbon = get_u64(buf + 24);
+        msg->oxygen = get_u64(buf + 32);
+        msg->hydrogen = get_u64(buf + 40);
+        msg->version = get_u64(buf + 48);
+    } else if (length >= WIRE_IF_VERSION_SIZE){
+        msg->has_if_version = 1;
+        msg->if_version = get_u64(buf + 24);
+    }
+    return 0;
+}
+
+const char *wire_status_str(u_int16_t status){
+    switch(status){
+        case WIRE_OK:             return "OK";
+        case WIRE_ERR_FORMAT:     return "ERROR: malformed request";
+        case WIRE_ERR_ELEMENT:    return "ERROR: unknown element";
+        case WIRE_ERR_NOT_ENOUGH: return "ERROR: not enough atoms";
+        case WIRE_ERR_TRANSPORT:  return "ERROR: wrong transport for this command";
+        case WIRE_ERR_VERSION:    return "ERROR: version mismatch";
+        default:                  return "ERROR: unknown status";
+    }
+}
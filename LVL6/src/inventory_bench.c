@@ -0,0 +1,304 @@
+/**
+ * @file inventory_bench.c
+ * @brief Contention benchmark of the inventory: ADDs and DELIVERs under
+ * one mutex, as warehouse_take() does them, against the lock-free
+ * inventory_reserve(), against flat combining (combine_funcs.h) and
+ * against per-thread slices (partition_funcs.h), at 1 to 64 threads.
+ * Checks that none of them sold an atom twice. Then the mutex writers
+ * again with a reader thread copying the inventory nonstop, under the
+ * mutex or through an InventorySeq.
+ * @date 2026-10-17
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "../include/functions/inventory_funcs.h"
+#include "../include/functions/combine_funcs.h"
+#include "../include/functions/partition_funcs.h"
+
+#define DEFAULT_ROUNDS 200000       // operations per thread
+#define MAX_THREADS 64
+#define ADD_EVERY 4                 // one operation in 4 is an ADD
+
+// WATER, CARBON DIOXIDE, GLUCOSE and ALCOHOL, one molecule each
+static const AtomStorage recipes[] = {
+    {0, 1, 2},
+    {1, 2, 0},
+    {6, 6, 12},
+    {2, 1, 6},
+};
+#define RECIPE_COUNT (sizeof(recipes) / sizeof(recipes[0]))
+
+// What an ADD brings, a little less than the DELIVERs between two ADDs take
+static const AtomStorage supply = {6, 6, 12};
+
+// How the threads reach the inventory
+typedef enum {
+    BENCH_MUTEX,
+    BENCH_LOCK_FREE,
+    BENCH_COMBINING,
+    BENCH_PARTITIONED
+} BenchMode;
+static const char *mode_names[] = {"mutex", "lock-free", "combining", "partitioned"};
+
+// A published operation of the combining run
+typedef struct BenchOp {
+    u_int8_t add;
+    const AtomStorage *atoms;
+    int taken;
+} BenchOp;
+
+// How the reader thread copies the inventory, if there is one
+typedef enum {
+    READER_NONE,
+    READER_MUTEX,
+    READER_SEQ
+} ReaderMode;
+
+static AtomStorage inventory;
+static pthread_mutex_t inventory_mutex = PTHREAD_MUTEX_INITIALIZER;
+static InventorySeq inventory_seq;      // the mutex writers' sections, READER_SEQ only
+static ReaderMode reader_mode = READER_NONE;
+static u_int8_t reader_stop;
+static Combiner combiner;
+static long rounds = DEFAULT_ROUNDS;
+
+typedef struct Worker {
+    pthread_t thread;
+    int id;
+    BenchMode mode;
+    unsigned long long added;
+    unsigned long long delivered[RECIPE_COUNT];
+} Worker;
+
+// warehouse_take() before the lock-free inventory
+static void lock_writer(void){
+    pthread_mutex_lock(&inventory_mutex);
+    if (reader_mode == READER_SEQ){
+        inventory_write_begin(&inventory_seq);
+    }
+}
+
+static void unlock_writer(void){
+    if (reader_mode == READER_SEQ){
+        inventory_write_end(&inventory_seq);
+    }
+    pthread_mutex_unlock(&inventory_mutex);
+}
+
+static int reserve_locked(const AtomStorage *need){
+    lock_writer();
+    if (need->carbon > inventory.carbon || need->oxygen > inventory.oxygen || need->hydrogen > inventory.hydrogen){
+        unlock_writer();
+        return -1;
+    }
+    inventory.carbon -= need->carbon;
+    inventory.oxygen -= need->oxygen;
+    inventory.hydrogen -= need->hydrogen;
+    unlock_writer();
+    return 0;
+}
+
+static void add_locked(const AtomStorage *atoms){
+    lock_writer();
+    inventory.carbon += atoms->carbon;
+    inventory.oxygen += atoms->oxygen;
+    inventory.hydrogen += atoms->hydrogen;
+    unlock_writer();
+}
+
+// A dashboard: copies the inventory until the writers are done
+static void *reader_main(void *arg){
+    AtomStorage copy;
+    while (!__atomic_load_n(&reader_stop, __ATOMIC_RELAXED)){
+        if (reader_mode == READER_MUTEX){
+            pthread_mutex_lock(&inventory_mutex);
+            copy = inventory;
+            pthread_mutex_unlock(&inventory_mutex);
+        } else {
+            unsigned long long start;
+            do {
+                start = inventory_read_begin(&inventory_seq);
+                inventory_load(&inventory, &copy);
+            } while (inventory_read_retry(&inventory_seq, start));
+        }
+        if (copy.carbon == ~0ULL){
+            break;      // keeps the copy from being optimized away
+        }
+    }
+    return NULL;
+}
+
+// The combiner owns the inventory while it runs a batch, plain arithmetic
+static void apply_batch(Combiner *c, void **ops, int count){
+    for (int i = 0; i < count; i++){
+        BenchOp *op = ops[i];
+        const AtomStorage *a = op->atoms;
+        if (op->add){
+            inventory.carbon += a->carbon;
+            inventory.oxygen += a->oxygen;
+            inventory.hydrogen += a->hydrogen;
+            op->taken = 0;
+        } else if (a->carbon > inventory.carbon || a->oxygen > inventory.oxygen || a->hydrogen > inventory.hydrogen){
+            op->taken = -1;
+        } else {
+            inventory.carbon -= a->carbon;
+            inventory.oxygen -= a->oxygen;
+            inventory.hydrogen -= a->hydrogen;
+            op->taken = 0;
+        }
+    }
+}
+
+static void *worker_main(void *arg){
+    Worker *w = arg;
+    partition_attach(w->id);
+    for (long r = 0; r < rounds; r++){
+        u_int8_t add = (r + w->id) % ADD_EVERY == 0;
+        size_t m = ((r + w->id) / ADD_EVERY) % RECIPE_COUNT;
+        const AtomStorage *atoms = add ? &supply : &recipes[m];
+        int taken;
+        switch(w->mode){
+            case BENCH_MUTEX:
+                if (add){
+                    add_locked(atoms);
+                    taken = 0;
+                } else {
+                    taken = reserve_locked(atoms);
+                }
+                break;
+            case BENCH_LOCK_FREE:
+                if (add){
+                    inventory_add(&inventory, atoms);
+                    taken = 0;
+                } else {
+                    taken = inventory_reserve(&inventory, atoms);
+                }
+                break;
+            case BENCH_PARTITIONED:
+                // The initial inventory starts central, the slices pull it in
+                if (add){
+                    partition_add(atoms);
+                    taken = 0;
+                } else {
+                    taken = partition_take(atoms, &inventory);
+                }
+                break;
+            default: {
+                BenchOp op = {add, atoms, 0};
+                combine(&combiner, &op);
+                taken = op.taken;
+                break;
+            }
+        }
+        if (add){
+            w->added++;
+        } else if (taken == 0){
+            w->delivered[m]++;
+        }
+    }
+    return NULL;
+}
+
+static double now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// One run, returns ns per operation, exits if the books do not balance
+static double run(int threads, BenchMode mode){
+    // With the ADDs, enough for most DELIVERs, the rest find it short
+    unsigned long long molecules = rounds * threads / 4 / RECIPE_COUNT;
+    AtomStorage initial = {9 * molecules, 10 * molecules, 20 * molecules};
+    inventory_store(&inventory, &initial);
+    combiner_init(&combiner, apply_batch, NULL);
+    partitions_init(threads);
+
+    static Worker workers[MAX_THREADS];
+    memset(workers, 0, sizeof(workers));
+    pthread_t reader;
+    reader_stop = 0;
+    if (reader_mode != READER_NONE && pthread_create(&reader, NULL, reader_main, NULL) != 0){
+        perror("pthread_create");
+        exit(1);
+    }
+    double start = now_ns();
+    for (int i = 0; i < threads; i++){
+        workers[i].id = i;
+        workers[i].mode = mode;
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0){
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < threads; i++){
+        pthread_join(workers[i].thread, NULL);
+    }
+    double elapsed = now_ns() - start;
+    if (reader_mode != READER_NONE){
+        __atomic_store_n(&reader_stop, 1, __ATOMIC_RELAXED);
+        pthread_join(reader, NULL);
+    }
+
+    // What is left must be exactly what came in and was not delivered
+    AtomStorage used = {0, 0, 0}, left;
+    for (int i = 0; i < threads; i++){
+        initial.carbon += workers[i].added * supply.carbon;
+        initial.oxygen += workers[i].added * supply.oxygen;
+        initial.hydrogen += workers[i].added * supply.hydrogen;
+        for (size_t m = 0; m < RECIPE_COUNT; m++){
+            used.carbon += workers[i].delivered[m] * recipes[m].carbon;
+            used.oxygen += workers[i].delivered[m] * recipes[m].oxygen;
+            used.hydrogen += workers[i].delivered[m] * recipes[m].hydrogen;
+        }
+    }
+    inventory_load(&inventory, &left);
+    partition_sum(&left);
+    if (used.carbon > initial.carbon || used.oxygen > initial.oxygen || used.hydrogen > initial.hydrogen ||
+        left.carbon != initial.carbon - used.carbon || left.oxygen != initial.oxygen - used.oxygen ||
+        left.hydrogen != initial.hydrogen - used.hydrogen){
+        fprintf(stderr, "inventory_bench: %s run with %d threads oversold or lost atoms\n", mode_names[mode], threads);
+        exit(1);
+    }
+    return elapsed / (rounds * threads);
+}
+
+int main(int argc, char *argv[]){
+    if (argc > 1){
+        char *end;
+        rounds = strtol(argv[1], &end, 10);
+        if (*end != '\0' || rounds <= 0){
+            fprintf(stderr, "usage: ./inventory_bench.out [operations per thread=%d]\n", DEFAULT_ROUNDS);
+            exit(1);
+        }
+    }
+
+    printf("operations per thread: %ld, 1 in %d an ADD\n", rounds, ADD_EVERY);
+    printf("threads   mutex ns/op   lock-free ns/op   combining ns/op   partitioned ns/op\n");
+    for (int threads = 1; threads <= MAX_THREADS; threads *= 2){
+        double locked = run(threads, BENCH_MUTEX);
+        double lock_free = run(threads, BENCH_LOCK_FREE);
+        double combining = run(threads, BENCH_COMBINING);
+        double partitioned = run(threads, BENCH_PARTITIONED);
+        printf("%7d   %11.1f   %9.1f (%.1fx)   %9.1f (%.1fx)   %11.1f (%.1fx)\n", threads, locked,
+               lock_free, locked / lock_free, combining, locked / combining, partitioned, locked / partitioned);
+    }
+
+    printf("\nmutex writers with a reader copying the inventory nonstop\n");
+    printf("threads   no reader ns/op   mutex reader ns/op   seqlock reader ns/op\n");
+    for (int threads = 1; threads <= MAX_THREADS; threads *= 2){
+        reader_mode = READER_NONE;
+        double alone = run(threads, BENCH_MUTEX);
+        reader_mode = READER_MUTEX;
+        double locked = run(threads, BENCH_MUTEX);
+        reader_mode = READER_SEQ;
+        double seq = run(threads, BENCH_MUTEX);
+        printf("%7d   %15.1f   %18.1f   %13.1f (%.1fx)\n", threads, alone, locked, seq, locked / seq);
+    }
+    reader_mode = READER_NONE;
+    return 0;
+}
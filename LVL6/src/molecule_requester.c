@@ -18,9 +18,11 @@
  #include <arpa/inet.h>  // Functions for manipulating IP addresses (inet_ntop, etc.)
  #include "../include/const.h"
  #include "../include/functions/atom_supplier_funcs.h"
+ #include "../include/functions/wire_funcs.h"
  #include <unistd.h>
  #include <getopt.h>
  #include <sys/un.h>
+ #include <stddef.h>     // offsetof
  
  // for get opt
  extern char *optarg;
@@ -34,6 +36,9 @@
  int flag_f = 0;
  int flag_h = 0;
  int flag_p = 0;
+ int flag_b = 0;     // -b, speak the binary protocol
+ int flag_w = 0;     // -w, wait in the backorder queue instead of failing when the warehouse is short
+ u_int32_t timeout_ms = 0;   // -t, the server drops the request after this many ms, 0 for never
  
  
  
@@ -48,13 +53,13 @@
  
       // Check if all the needed args was provided as a command-line argument
       if (argc < 3) {
-         fprintf(stderr,"usage: ./atom_supplier.out -h <IP/hostname> -p <port> OR -f <UDS socket file path>\n");
+         fprintf(stderr,"usage: ./molecule_requester.out -h <IP/hostname> -p <port> OR -f <UDS socket file path> (OPTIONAL: -b binary protocol, -w wait for supply, -t <ms> timeout)\n");
          exit(1);
      }
  
  
      // check then option you got from the user:
-     int ret = getopt(argc, argv, "p:h:f:");
+     int ret = getopt(argc, argv, "p:h:f:bwt:");
      char *endptr; // for checking if the value is digit
      long val = 0;
  
@@ -104,8 +109,20 @@
                  PATH = optarg;
                  break;
              }
+             case 'b': {
+                 flag_b = 1;
+                 break;
+             }
+             case 't': {
+                 timeout_ms = parse_timeout_arg(optarg);
+                 break;
+             }
+             case 'w': {
+                 flag_w = 1;
+                 break;
+             }
          }
-         ret = getopt(argc, argv, "p:h:f:");
+         ret = getopt(argc, argv, "p:h:f:bwt:");
      }
  
      if((flag_p !=1 && flag_h ==1) || (flag_h != 1 && flag_p ==1)){
@@ -113,6 +130,11 @@
          exit(1);
      }
  
+     if (flag_b && flag_w) {
+         fprintf(stderr, "ERROR: -w is a text command option, it cannot be used with -b\n");
+         exit(1);
+     }
+
      struct sockaddr_un unix_server_addr;
      struct sockaddr_in udp_server_addr;
  
@@ -179,24 +201,40 @@
          char element[20];
          ask_requester(amount, element, sizeof(element));
  
-         // Format the message to send to server: ADD {atom} {amount}
+         // Format the message to send to server: DELIVER {molecule} {amount}, or its binary frame
          char send_buf[MAXDATASIZE];
-         snprintf(send_buf, MAXDATASIZE, "DELIVER %s %llu", element, *amount);
+         size_t send_len;
+         int n = snprintf(send_buf, MAXDATASIZE, flag_w ? "DELIVER %s %llu BACKORDER" : "DELIVER %s %llu", element, *amount);
+         if (timeout_ms) {
+             snprintf(send_buf + n, MAXDATASIZE - n, " TIMEOUT_MS %u", timeout_ms);
+             set_reply_timeout(sockfd, timeout_ms);
+         }
+         char request[MAXDATASIZE];
+         strcpy(request, send_buf);
+         if (flag_b) {
+             send_len = encode_wire_request(WIRE_OP_DELIVER, element, *amount, timeout_ms, send_buf, sizeof(send_buf));
+         } else {
+             send_len = strlen(send_buf);
+         }
  
          if(flag_p && flag_h){
  
          socklen_t udp_addr_len = sizeof(udp_server_addr);
  
          // Send the formatted request to server
-         if (sendto(sockfd, send_buf, strlen(send_buf), 0, (struct sockaddr*)&udp_server_addr, udp_addr_len) == -1) {
+         if (sendto(sockfd, send_buf, send_len, 0, (struct sockaddr*)&udp_server_addr, udp_addr_len) == -1) {
              perror("sendto");
              close(sockfd);
              exit(1);
          }
  
-         printf("client: sent request via STREAM--> '%s'\n", send_buf);
+         printf("client: sent %srequest via STREAM--> '%s'\n", flag_b ? "binary " : "", request);
  
          if ((numbytes = recvfrom(sockfd, buf, MAXDATASIZE-1, 0, (struct sockaddr*)&udp_server_addr, &udp_addr_len)) == -1) {
+             if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                 printf("client: no reply within %u ms, giving up\n", timeout_ms);
+                 exit(1);
+             }
              perror("recv");
              exit(1);
          }
@@ -205,15 +243,19 @@
          socklen_t unix_addr_len = sizeof(unix_server_addr);
  
          // Send the formatted request to server UNIX
-         if (sendto(sockfd, send_buf, strlen(send_buf), 0, (struct sockaddr*)&unix_server_addr, unix_addr_len) == -1) {
+         if (sendto(sockfd, send_buf, send_len, 0, (struct sockaddr*)&unix_server_addr, unix_addr_len) == -1) {
              perror("sendto");
              close(sockfd);
              exit(1);
          }
  
-         printf("client: sent request via UNIX --> '%s'\n", send_buf);
+         printf("client: sent %srequest via UNIX --> '%s'\n", flag_b ? "binary " : "", request);
  
          if ((numbytes = recvfrom(sockfd, buf, MAXDATASIZE-1, 0, NULL, NULL)) == -1) {
+             if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                 printf("client: no reply within %u ms, giving up\n", timeout_ms);
+                 exit(1);
+             }
              perror("recv");
              close(sockfd);
              exit(1);
@@ -224,7 +266,25 @@
          buf[numbytes] = '\0';
  
          // Print the message received from the server
+         if (flag_b) {
+             char text[MAXDATASIZE * 2];
+             format_wire_reply(buf, numbytes, text, sizeof(text));
+             printf("client: received '%s'\n", text);
+         } else {
          printf("client: received '%s'\n", buf);
+         }
+
+         // A backorder is answered once more, when it is filled or its deadline passes
+         if (flag_w && strncmp(buf, "BACKORDER #", 11) == 0) {
+             set_reply_timeout(sockfd, 0);      // -t only bounds the wait for the queue, not for the supply
+             if ((numbytes = recvfrom(sockfd, buf, MAXDATASIZE-1, 0, NULL, NULL)) == -1) {
+                 perror("recv");
+                 close(sockfd);
+                 exit(1);
+             }
+             buf[numbytes] = '\0';
+             printf("client: received '%s'\n", buf);
+         }
  
          // Clean up by closing the socket
          close(sockfd);
@@ -0,0 +1,124 @@
+/**
+ * @file parse_bench.c
+ * @brief Microbenchmark of the text command parser: ns per request of the
+ * sscanf()/strcmp() parse it replaced and of parse_request()
+ * @date 2026-10-17
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../include/const.h"
+#include "../include/elements.h"
+#include "../include/functions/parse_funcs.h"
+
+#define DEFAULT_ROUNDS 2000000
+
+// A mix of what the servers receive, every command kind and a miss
+static const char *requests[] = {
+    "ADD CARBON 10",
+    "ADD HYDROGEN 250",
+    "ADD OXYGEN 7",
+    "DELIVER WATER 2",
+    "DELIVER CARBONDIOXIDE 1",
+    "DELIVER GLUCOSE 3",
+    "GEN SOFT DRINK",
+    "GEN VODKA",
+    "GEN CHAMPAGNE",
+    "FOO BAR 1",
+};
+#define REQUEST_COUNT (sizeof(requests) / sizeof(requests[0]))
+
+// element_type_from_str() before the perfect hash
+static Element legacy_element(const char *str){
+    if (strcmp(str, "CARBON") == 0) return CARBON;
+    if (strcmp(str, "OXYGEN") == 0) return OXYGEN;
+    if (strcmp(str, "HYDROGEN") == 0) return HYDROGEN;
+    if (strcmp(str, "WATER") == 0) return WATER;
+    if (strcmp(str, "CARBONDIOXIDE") == 0) return CARBON_DIOXIDE;
+    if (strcmp(str, "GLUCOSE") == 0) return GLUCOSE;
+    if (strcmp(str, "ALCOHOL") == 0) return ALCOHOL;
+    if (strcmp(str, "SOFT DRINK") == 0) return SOFT_DRINK;
+    if (strcmp(str, "VODKA") == 0) return VODKA;
+    if (strcmp(str, "CHAMPAGNE") == 0) return CHAMPAGNE;
+    return UNKNOWN;
+}
+
+// The parse of process_message() before the tokenizer
+static void legacy_parse(const char *buf, Request *req){
+    char cmd[10] = {0}, element_str[20] = {0}, element_str2[20] = {0};
+    int amount;
+
+    memset(req, 0, sizeof(*req));
+    req->element = UNKNOWN;
+    if (sscanf(buf, "%s %s %d", cmd, element_str, &amount) == 3){
+        req->has_amount = 1;
+        req->amount = amount;
+        req->element = legacy_element(element_str);
+        req->cmd = !strcmp(cmd, "ADD") ? CMD_ADD : !strcmp(cmd, "DELIVER") ? CMD_DELIVER : CMD_UNKNOWN;
+    } else if (sscanf(buf, "%s %s %s", cmd, element_str, element_str2) && strcmp(cmd, "GEN") == 0){
+        if (strlen(element_str2) > 1){
+            strcat(element_str, " ");
+            strcat(element_str, element_str2);
+        }
+        req->cmd = CMD_GEN;
+        req->element = legacy_element(element_str);
+    }
+}
+
+static double now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]){
+    long rounds = DEFAULT_ROUNDS;
+    if (argc > 1){
+        char *end;
+        rounds = strtol(argv[1], &end, 10);
+        if (*end != '\0' || rounds <= 0){
+            fprintf(stderr, "usage: ./parse_bench.out [rounds=%d]\n", DEFAULT_ROUNDS);
+            exit(1);
+        }
+    }
+
+    size_t lens[REQUEST_COUNT];
+    for (size_t i = 0; i < REQUEST_COUNT; i++){
+        lens[i] = strlen(requests[i]);
+    }
+
+    // Both parsers must agree before their speed means anything
+    for (size_t i = 0; i < REQUEST_COUNT; i++){
+        Request a, b;
+        legacy_parse(requests[i], &a);
+        parse_request(requests[i], lens[i], &b);
+        if (a.cmd != b.cmd || a.element != b.element || a.has_amount != b.has_amount || a.amount != b.amount){
+            fprintf(stderr, "parse_bench: parsers disagree on '%s'\n", requests[i]);
+            exit(1);
+        }
+    }
+
+    volatile unsigned long long sink = 0;      // keeps the results alive
+    Request req;
+
+    double start = now_ns();
+    for (long r = 0; r < rounds; r++){
+        legacy_parse(requests[r % REQUEST_COUNT], &req);
+        sink += req.element + req.cmd;
+    }
+    double legacy = (now_ns() - start) / rounds;
+
+    start = now_ns();
+    for (long r = 0; r < rounds; r++){
+        parse_request(requests[r % REQUEST_COUNT], lens[r % REQUEST_COUNT], &req);
+        sink += req.element + req.cmd;
+    }
+    double tokenizer = (now_ns() - start) / rounds;
+
+    printf("requests: %ld\n", rounds);
+    printf("sscanf + strcmp:        %7.1f ns/request\n", legacy);
+    printf("tokenizer + perfect hash: %5.1f ns/request (%.1fx)\n", tokenizer, legacy / tokenizer);
+    return 0;
+}